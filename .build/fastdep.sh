@@ -4,6 +4,7 @@ INPUT_FILE=""
 INPUT_OBJECT=""
 DEPFILE=".build/.deps"
 COMPILER="gcc"
+INCLUDES=""
 
 print_usage()
 {
@@ -32,6 +33,9 @@ do
 		shift
 		INPUT_OBJECT="$1"
 		;;
+	-I*)
+		INCLUDES="$INCLUDES $1"
+		;;
 	--compiler)
 		[ $# -lt 2 ] && die "missing argument after --compiler"
 		shift
@@ -58,7 +62,7 @@ mkdir -p "$(dirname $DEPFILE)" && touch "$DEPFILE"
 
 function get_deps() # file
 {
-	$COMPILER -MM "$1" | sed 's/\\//g' | cut -d ':' -f 2
+	$COMPILER $INCLUDES -MM "$1" | sed 's/\\//g' | cut -d ':' -f 2
 }
 
 function store_deps() # file, deps
@@ -0,0 +1,357 @@
+#include "bench.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "filed.h"
+
+#ifndef FILED_VERSION
+#define FILED_VERSION "unknown"
+#endif
+
+#define SCREEN_LINES 50
+#define SCREEN_COLS 200
+#define MAX_FRAMES 1000
+#define COPY_FILES 1000
+
+typedef DA(long long) samples;
+
+static const char* version = FILED_VERSION;
+static int repeat = 5;
+static const char* only_bench[16];
+static int n_only_bench;
+
+static const tree_kind listing_kinds[] =
+{
+	{ "flat", 0, gen_flat },
+	{ "wide", 0, gen_wide },
+	{ "deep", 0, gen_deep },
+	{ "owners", 0, gen_owners },
+	{ "symlinks", 0, gen_symlinks },
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static int cmp_ll(const void* a, const void* b)
+{
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+static bool wanted(const char* bench)
+{
+	if (!n_only_bench) return true;
+	for (int i = 0; i < n_only_bench; i++)
+		if (!strcmp(only_bench[i], bench)) return true;
+	return false;
+}
+
+// one json object per line, so results can be appended to a log and diffed
+static void report(const char* bench, const char* tree, int entries,
+		   long long bytes, samples* s)
+{
+	qsort(s->items, s->len, sizeof(*s->items), cmp_ll);
+	long long total = 0;
+	for (int i = 0; i < s->len; i++) total += s->items[i];
+
+	printf("{\"version\":\"%s\",\"bench\":\"%s\",\"tree\":\"%s\","
+	       "\"entries\":%d,\"runs\":%d,\"bytes\":%lld,"
+	       "\"min_ns\":%lld,\"median_ns\":%lld,\"mean_ns\":%lld,"
+	       "\"max_ns\":%lld}\n",
+	       version, bench, tree, entries, s->len, bytes,
+	       s->items[0], s->items[s->len / 2], total / s->len,
+	       s->items[s->len - 1]);
+	fflush(stdout);
+	s->len = 0;
+}
+
+static void report_skip(const char* tree, int entries, const char* why)
+{
+	printf("{\"version\":\"%s\",\"bench\":\"*\",\"tree\":\"%s\","
+	       "\"entries\":%d,\"skipped\":\"%s\"}\n",
+	       version, tree, entries, why);
+	fflush(stdout);
+}
+
+static char* make_tree(const char* root, const tree_kind* kind, int entries)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%s-%d", kind->name, entries);
+	char* path = join_path(root, name);
+	if (mkdir(path, 0755) != 0 || !kind->generate(path, entries))
+	{
+		remove_recursive(path, NULL);
+		free(path);
+		return NULL;
+	}
+	return path;
+}
+
+static void shuffle(directory* cwd)
+{
+	for (int i = cwd->entries.len - 1; i > 0; i--)
+	{
+		int j = rand() % (i + 1);
+		da_swap(cwd->entries, entry, i, j);
+	}
+}
+
+static void bench_listing(WINDOW* wind, const char* path, const char* tree,
+			  int entries)
+{
+	samples s;
+	da_construct(s, repeat);
+	directory cwd = {0};
+
+	for (int run = 0; run < repeat; run++)
+	{
+		long long start = now_ns();
+		change_dir(&cwd, path, NULL);
+		da_append(s, now_ns() - start);
+	}
+	if (wanted("change_dir"))
+		report("change_dir", tree, entries, 0, &s);
+	s.len = 0;
+
+	if (wanted("sort"))
+	{
+		srand(1);
+		for (int run = 0; run < repeat; run++)
+		{
+			shuffle(&cwd);
+			long long start = now_ns();
+			sort_entries(&cwd);
+			da_append(s, now_ns() - start);
+		}
+		report("sort", tree, entries, 0, &s);
+	}
+
+	if (wanted("draw_screen"))
+	{
+		// page through the listing like a user holding 'n'
+		int page = SCREEN_LINES - RESERVED_LINES;
+		int pages = cwd.entries.len / page + 1;
+		int step = pages > MAX_FRAMES ? pages / MAX_FRAMES : 1;
+		for (int p = 0; p < pages; p += step)
+		{
+			cwd.scroll = p * page;
+			cwd.current = 0;
+			long long start = now_ns();
+			draw_screen(wind, &cwd);
+			da_append(s, now_ns() - start);
+		}
+		report("draw_screen", tree, entries, 0, &s);
+	}
+
+	free_dir(&cwd);
+	free(s.items);
+}
+
+static long long copy_all(const char* src, const char* dst, bool move,
+			  long long* bytes)
+{
+	directory listing = {0};
+	change_dir(&listing, src, NULL);
+	*bytes = 0;
+
+	long long start = now_ns();
+	for (int i = 0; i < listing.entries.len; i++)
+	{
+		entry e = listing.entries.items[i];
+		if (e.color == ECOLOR_DIR) continue;
+		bool ok = move ? move_file(e.name, dst, NULL)
+			       : copy_file(e.name, dst, NULL);
+		if (!ok)
+			fatal("failed to %s '%s' to '%s'\n",
+			      move ? "move" : "copy", e.name, dst);
+	}
+	long long elapsed = now_ns() - start;
+
+	struct stat st;
+	for (int i = 0; i < listing.entries.len; i++)
+	{
+		char* file = join_path(dst, listing.entries.items[i].name);
+		if (lstat(file, &st) == 0 && S_ISREG(st.st_mode))
+			*bytes += st.st_size;
+		free(file);
+	}
+	free_dir(&listing);
+	return elapsed;
+}
+
+static void bench_copy(const char* root)
+{
+	if (!wanted("copy_file") && !wanted("move_file")) return;
+
+	tree_kind sized = { "sized", COPY_FILES, gen_sized };
+	char* src = make_tree(root, &sized, COPY_FILES);
+	if (!src)
+	{
+		report_skip(sized.name, COPY_FILES, "cannot generate tree");
+		return;
+	}
+	char* copied = join_path(root, "copied");
+	char* moved = join_path(root, "moved");
+
+	samples copy_s, move_s;
+	da_construct(copy_s, repeat);
+	da_construct(move_s, repeat);
+	long long bytes = 0;
+
+	for (int run = 0; run < repeat; run++)
+	{
+		mkdir(copied, 0755);
+		mkdir(moved, 0755);
+		da_append(copy_s, copy_all(src, copied, false, &bytes));
+		da_append(move_s, copy_all(copied, moved, true, &bytes));
+		remove_recursive(copied, NULL);
+		remove_recursive(moved, NULL);
+	}
+	if (wanted("copy_file"))
+		report("copy_file", sized.name, COPY_FILES, bytes, &copy_s);
+	if (wanted("move_file"))
+		report("move_file", sized.name, COPY_FILES, bytes, &move_s);
+
+	remove_recursive(src, NULL);
+	free(copy_s.items);
+	free(move_s.items);
+	free(copied);
+	free(moved);
+	free(src);
+}
+
+static void bench_remove(const char* root, const tree_kind* kind, int entries)
+{
+	samples s;
+	da_construct(s, repeat);
+
+	for (int run = 0; run < repeat; run++)
+	{
+		char* path = make_tree(root, kind, entries);
+		if (!path) break;
+		long long start = now_ns();
+		bool ok = remove_recursive(path, NULL);
+		da_append(s, now_ns() - start);
+		free(path);
+		if (!ok) fatal("failed to remove tree: %s\n", strerror(errno));
+	}
+	if (s.len)
+		report("remove_recursive", kind->name, entries, 0, &s);
+	free(s.items);
+}
+
+static void parse_list(char* arg, void (*add)(const char*))
+{
+	for (char* tok = strtok(arg, ","); tok; tok = strtok(NULL, ","))
+		add(tok);
+}
+
+static DA(int) sizes;
+static DA(const char*) trees;
+
+static void add_size(const char* s) { da_append(sizes, atoi(s)); }
+static void add_tree(const char* s) { da_append(trees, s); }
+
+static bool tree_selected(const char* name)
+{
+	if (!trees.len) return true;
+	for (int i = 0; i < trees.len; i++)
+		if (!strcmp(trees.items[i], name)) return true;
+	return false;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dir] [-s n,...] [-t tree,...] [-r runs] [bench...]\n"
+		"  -d  directory to generate trees in, should be a tmpfs"
+		" (default /dev/shm)\n"
+		"  -s  entry counts (default 10000,100000,1000000)\n"
+		"  -t  trees: flat,wide,deep,owners,symlinks (default all)\n"
+		"  -r  runs per measurement (default 5)\n"
+		"benches: change_dir sort draw_screen copy_file move_file"
+		" remove_recursive\n", prog);
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	const char* base = "/dev/shm";
+	da_construct(sizes, 4);
+	da_construct(trees, 4);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:s:t:r:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'd': base = optarg; break;
+		case 's': parse_list(optarg, add_size); break;
+		case 't': parse_list(optarg, add_tree); break;
+		case 'r': repeat = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (repeat < 1) usage(argv[0]);
+	for (int i = optind; i < argc && n_only_bench < 16; i++)
+		only_bench[n_only_bench++] = argv[i];
+	if (!sizes.len)
+	{
+		da_append(sizes, 10000);
+		da_append(sizes, 100000);
+		da_append(sizes, 1000000);
+	}
+
+	char* template = join_path(base, "filed-bench.XXXXXX");
+	if (!mkdtemp(template))
+		fatal("failed to create '%s': %s\n", template, strerror(errno));
+	// trees are entered with chdir, so every path has to be absolute
+	char* root = realpath(template, NULL);
+	free(template);
+
+	WINDOW* wind = init_headless_window(SCREEN_LINES, SCREEN_COLS);
+
+	for (size_t k = 0; k < sizeof(listing_kinds) / sizeof(*listing_kinds); k++)
+	{
+		const tree_kind* kind = &listing_kinds[k];
+		if (!tree_selected(kind->name)) continue;
+		for (int i = 0; i < sizes.len; i++)
+		{
+			int entries = sizes.items[i];
+			fprintf(stderr, "generating %s-%d\n", kind->name, entries);
+			char* path = make_tree(root, kind, entries);
+			if (!path)
+			{
+				report_skip(kind->name, entries, "cannot generate tree");
+				continue;
+			}
+			if (wanted("change_dir") || wanted("sort") ||
+			    wanted("draw_screen"))
+				bench_listing(wind, path, kind->name, entries);
+			chdir(root);
+			remove_recursive(path, NULL);
+			free(path);
+
+			if (wanted("remove_recursive"))
+				bench_remove(root, kind, entries);
+		}
+	}
+	chdir(root);
+	bench_copy(root);
+
+	endwin();
+	chdir(base);
+	remove_recursive(root, NULL);
+	free(root);
+	free(sizes.items);
+	free(trees.items);
+	return 0;
+}
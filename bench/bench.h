@@ -0,0 +1,25 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct
+{
+	const char* name;
+	int entries;
+	// fills an empty directory, returns false if the tree can't be made
+	// on this machine (e.g. no permission to chown)
+	bool (*generate)(const char* path, int entries);
+} tree_kind;
+
+bool gen_flat(const char* path, int entries);
+bool gen_wide(const char* path, int entries);
+bool gen_deep(const char* path, int entries);
+bool gen_owners(const char* path, int entries);
+bool gen_symlinks(const char* path, int entries);
+bool gen_sized(const char* path, int entries);
+
+char* join_path(const char* dir, const char* name);
+
+#endif
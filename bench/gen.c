@@ -0,0 +1,245 @@
+#include "bench.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include "fatal.h"
+
+#define DEEP_LEVELS 256
+#define BIG_FILE_SIZE (64 << 20)
+#define SMALL_FILE_MAX (64 << 10)
+
+// deterministic so the same tree is generated on every run
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ull;
+
+static unsigned long long rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+char* join_path(const char* dir, const char* name)
+{
+	size_t sz = strlen(dir) + strlen(name) + 2;
+	char* path = malloc(sz);
+	if (!path) fatal("failed to alloc");
+	snprintf(path, sz, "%s/%s", dir, name);
+	return path;
+}
+
+static bool make_file(int dirfd, const char* name, size_t size)
+{
+	int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) return false;
+
+	static char buf[1 << 16];
+	if (!buf[0]) memset(buf, 'x', sizeof(buf));
+
+	while (size)
+	{
+		size_t n = size < sizeof(buf) ? size : sizeof(buf);
+		ssize_t written = write(fd, buf, n);
+		if (written <= 0)
+		{
+			close(fd);
+			return false;
+		}
+		size -= written;
+	}
+	close(fd);
+	return true;
+}
+
+static void random_name(char* buf, size_t sz, int i)
+{
+	// mixed case and varying length, so sorting is not a no-op
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	unsigned long long r = rng();
+	int len = 4 + r % 12;
+	int n = 0;
+	for (; n < len && n < (int)sz - 12; n++)
+	{
+		buf[n] = chars[r % (sizeof(chars) - 1)];
+		r = r / 7 + rng() % 5;
+	}
+	snprintf(buf + n, sz - n, "-%d", i);
+}
+
+bool gen_flat(const char* path, int entries)
+{
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) return false;
+
+	char name[64];
+	for (int i = 0; i < entries; i++)
+	{
+		random_name(name, sizeof(name), i);
+		if (!make_file(dirfd, name, rng() % 4096))
+		{
+			close(dirfd);
+			return false;
+		}
+	}
+	close(dirfd);
+	return true;
+}
+
+bool gen_wide(const char* path, int entries)
+{
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) return false;
+
+	// accents, CJK (two columns each) and emoji, the names display_width
+	// can't take the ASCII path for
+	static const char* const parts[] = {
+		"café", "über", "日本語", "ファイル", "привет", "😀",
+	};
+	int n_parts = sizeof(parts) / sizeof(*parts);
+	char name[128];
+	char rest[64];
+	for (int i = 0; i < entries; i++)
+	{
+		random_name(rest, sizeof(rest), i);
+		snprintf(name, sizeof(name), "%s%s", parts[rng() % n_parts], rest);
+		if (!make_file(dirfd, name, rng() % 4096))
+		{
+			close(dirfd);
+			return false;
+		}
+	}
+	close(dirfd);
+	return true;
+}
+
+bool gen_deep(const char* path, int entries)
+{
+	int per_level = entries / DEEP_LEVELS;
+	if (per_level < 1) per_level = 1;
+
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) return false;
+
+	char name[64];
+	for (int level = 0; level < DEEP_LEVELS; level++)
+	{
+		for (int i = 0; i < per_level; i++)
+		{
+			random_name(name, sizeof(name), i);
+			if (!make_file(dirfd, name, rng() % 512))
+				goto fail;
+		}
+		if (mkdirat(dirfd, "d", 0755) != 0)
+			goto fail;
+		int next = openat(dirfd, "d", O_RDONLY | O_DIRECTORY);
+		close(dirfd);
+		if (next == -1) return false;
+		dirfd = next;
+	}
+	close(dirfd);
+	return true;
+fail:
+	close(dirfd);
+	return false;
+}
+
+bool gen_owners(const char* path, int entries)
+{
+	if (geteuid() != 0) return false;
+
+	// only owners that exist, listing ids without a name is a separate case
+	DA(uid_t) uids;
+	DA(gid_t) gids;
+	da_construct(uids, 32);
+	da_construct(gids, 32);
+
+	struct passwd* pw;
+	setpwent();
+	while ((pw = getpwent()))
+		da_append(uids, pw->pw_uid);
+	endpwent();
+
+	struct group* gr;
+	setgrent();
+	while ((gr = getgrent()))
+		da_append(gids, gr->gr_gid);
+	endgrent();
+
+	bool ok = uids.len > 1 && gids.len > 1;
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) ok = false;
+
+	char name[64];
+	for (int i = 0; ok && i < entries; i++)
+	{
+		random_name(name, sizeof(name), i);
+		ok = make_file(dirfd, name, 0) &&
+			fchownat(dirfd, name,
+				 uids.items[i % uids.len],
+				 gids.items[(i / uids.len) % gids.len],
+				 AT_SYMLINK_NOFOLLOW) == 0;
+	}
+	if (dirfd != -1) close(dirfd);
+	free(uids.items);
+	free(gids.items);
+	return ok;
+}
+
+bool gen_symlinks(const char* path, int entries)
+{
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) return false;
+
+	int targets = entries / 4;
+	if (targets < 1) targets = 1;
+
+	char name[64];
+	char target[256];
+	for (int i = 0; i < entries; i++)
+	{
+		bool ok;
+		if (i < targets)
+		{
+			snprintf(name, sizeof(name), "target-%d", i);
+			ok = make_file(dirfd, name, 0);
+		}
+		else
+		{
+			random_name(name, sizeof(name), i);
+			if (i % 16 == 0)
+				snprintf(target, sizeof(target),
+					 "../nowhere/dangling/%d", i);
+			else
+				snprintf(target, sizeof(target),
+					 "target-%d", (int)(rng() % targets));
+			ok = symlinkat(target, dirfd, name) == 0;
+		}
+		if (!ok)
+		{
+			close(dirfd);
+			return false;
+		}
+	}
+	close(dirfd);
+	return true;
+}
+
+bool gen_sized(const char* path, int entries)
+{
+	int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) return false;
+
+	bool ok = make_file(dirfd, "big", BIG_FILE_SIZE);
+	char name[64];
+	for (int i = 1; ok && i < entries; i++)
+	{
+		snprintf(name, sizeof(name), "small-%d", i);
+		ok = make_file(dirfd, name, rng() % SMALL_FILE_MAX);
+	}
+	close(dirfd);
+	return ok;
+}
@@ -2,17 +2,44 @@
 
 set -e
 
-CC=clang
+CC=${CC:-clang}
+PROFILE="debug"
+BENCH=false
+
+for arg in $@;
+do
+	if [ "$arg" = "release" ] ;
+	then
+		PROFILE="release"
+	fi
+	if [ "$arg" = "bench" ] ;
+	then
+		# benchmarks are only meaningful on an optimized build
+		PROFILE="release"
+		BENCH=true
+	fi
+done
+
 CCFLAGS=""
-CCFLAGS+=" -std=c11 -D_GNU_SOURCE"
+CCFLAGS+=" -std=c11 -D_GNU_SOURCE -D_XOPEN_SOURCE_EXTENDED"
 CCFLAGS+=" -Wall -Wpedantic -Wextra -Werror -Wshadow"
-CCFLAGS+=" -fsanitize=address,undefined -fno-omit-frame-pointer"
-CCFLAGS+=" -O0 -g"
+CCFLAGS+=" -Ilib -Isrc"
+
+# the wide library, the narrow one draws multibyte names as escapes
+LDFLAGS="-lncursesw -lpthread -lz"
 
-LDFLAGS="-lcurses -fsanitize=address,undefined "
+if [ "$PROFILE" = "release" ] ;
+then
+	CCFLAGS+=" -O2 -DNDEBUG"
+	BIN_DIR=".build/release"
+else
+	CCFLAGS+=" -fsanitize=address,undefined -fno-omit-frame-pointer"
+	CCFLAGS+=" -O0 -g"
+	LDFLAGS+=" -fsanitize=address,undefined"
+	BIN_DIR=".build/bin"
+fi
 
 BUILD_DIR=".build"
-BIN_DIR="$BUILD_DIR/bin"
 DEPFILE="$BUILD_DIR/.deps"
 
 mkdir -p $BUILD_DIR
@@ -36,21 +63,26 @@ do
 	then
 		INSTALL=true
 	fi
+	if [ "$arg" = "bench" ] ;
+	then
+		INSTALL=false
+	fi
 done
 
 TARGET=./filed
+BENCH_TARGET=./filed-bench
 
-objects=""
-for file in src/*.c
-do
-	out=${file/src/$BIN_DIR}.o
-	objects="$objects $out"
-
+function compile() # file, out
+{
 	skip=true
+	if [ ! -f $2 ];
+	then
+		skip=false
+	fi
 
-	for dep in $(.build/fastdep.sh $file -o $out -d $DEPFILE)
+	for dep in $(.build/fastdep.sh $1 -o $2 -d $DEPFILE -Ilib -Isrc)
 	do
-		if [ $file -nt $out ];
+		if [ $1 -nt $2 ];
 		then
 			skip=false;
 		fi
@@ -58,15 +90,64 @@ do
 
 	if $skip;
 	then
-		echo × skipping $file → $out
-		continue
+		echo × skipping $1 → $2
+		return
 	fi
 
-	echo $CC -c $file -o $out $CCFLAGS
-	$CC -c $file -o $out $CCFLAGS
+	echo $CC -c $1 -o $2 $CCFLAGS
+	$CC -c $1 -o $2 $CCFLAGS
+}
+
+# the engine, usable without curses
+LIB=$BIN_DIR/libfiled.a
+lib_objects=""
+for file in lib/*.c
+do
+	out=${file/lib/$BIN_DIR}.o
+	lib_objects="$lib_objects $out"
+	compile $file $out
 done
+rm -f $LIB
+ar rcs $LIB $lib_objects
+
+VERSION=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+objects=""
+for file in src/*.c
+do
+	out=${file/src/$BIN_DIR}.o
+	objects="$objects $out"
+	# main.c reports the version with replayed keys, so like the bench
+	# it is always rebuilt
+	if [ "$file" = "src/main.c" ];
+	then
+		echo $CC -c $file -o $out $CCFLAGS -DFILED_VERSION=\"$VERSION\"
+		$CC -c $file -o $out $CCFLAGS -DFILED_VERSION=\"$VERSION\"
+		continue
+	fi
+	compile $file $out
+done
+
+if $BENCH;
+then
+	CCFLAGS+=" -DFILED_VERSION=\"$VERSION\""
+
+	bench_objects=${objects/$BIN_DIR\/main.c.o/}
+	# always rebuilt, the version string changes between commits
+	for file in bench/*.c
+	do
+		out=$BIN_DIR/bench_$(basename $file).o
+		bench_objects="$bench_objects $out"
+		echo $CC -c $file -o $out $CCFLAGS
+		$CC -c $file -o $out $CCFLAGS
+	done
+
+	$CC $bench_objects $LIB $LDFLAGS -o $BENCH_TARGET
+	echo run $BENCH_TARGET -h for options
+	exit 0
+fi
 
-$CC $LDFLAGS $objects -o $TARGET
+$CC $objects $LIB $LDFLAGS -o $TARGET
 
 if $INSTALL;
 then
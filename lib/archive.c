@@ -0,0 +1,1287 @@
+#include "archive.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+extern char** environ;
+
+#define TAR_BLOCK 512
+// read (and written) at once, also zlib's buffer for compressed tars
+#define CHUNK_SIZE (1 << 17)
+#define PROGRESS_STEP (1 << 20)
+#define INDEX_PROGRESS_STEP 4096
+// long names and pax attributes past this are taken for corruption
+#define TAR_EXTENSION_MAX (1 << 20)
+
+// the end of central directory record, a comment of up to 64KiB may
+// follow it
+#define ZIP_EOCD_SIZE 22
+#define ZIP_TAIL (ZIP_EOCD_SIZE + 65535)
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_EOCD_SIZE 56
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP64_EOCD_SIG 0x06064b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_EXTRA_ZIP64 0x0001
+#define ZIP_EXTRA_TIME 0x5455
+#define ZIP_HOST_UNIX 3
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+static bool ends_with(const char* s, const char* suffix)
+{
+	size_t len = strlen(s), slen = strlen(suffix);
+	return len > slen && !strcasecmp(s + len - slen, suffix);
+}
+
+int archive_format(const char* path)
+{
+	if (ends_with(path, ".tar")) return ARCHIVE_TAR;
+	if (ends_with(path, ".tar.gz") || ends_with(path, ".tgz"))
+		return ARCHIVE_TAR_GZ;
+	if (ends_with(path, ".tar.zst") || ends_with(path, ".tzst"))
+		return ARCHIVE_TAR_ZST;
+	if (ends_with(path, ".zip")) return ARCHIVE_ZIP;
+	return 0;
+}
+
+static const char* member_name(const archive* a, int i)
+{
+	return a->names.items + a->members.items[i].name;
+}
+
+static unsigned add_name(archive* a, const char* name, int len)
+{
+	da_reserve(a->names, len + 1);
+	unsigned at = a->names.len;
+	memcpy(a->names.items + at, name, len);
+	a->names.items[at + len] = '\0';
+	a->names.len += len + 1;
+	return at;
+}
+
+// strips leading "/" and "./" and trailing "/". false for names with a
+// ".." in them, they would land outside of where they are extracted
+static bool clean_name(const char** name, int* len)
+{
+	const char* s = *name;
+	int n = *len;
+	while (n)
+	{
+		if (s[0] == '/')
+		{
+			s++;
+			n--;
+		}
+		else if (n >= 2 && s[0] == '.' && s[1] == '/')
+		{
+			s += 2;
+			n -= 2;
+		}
+		else
+			break;
+	}
+	while (n && s[n - 1] == '/') n--;
+	if (n == 1 && s[0] == '.') n = 0;
+	for (const char* part = s; part < s + n;)
+	{
+		const char* slash = memchr(part, '/', s + n - part);
+		int part_len = slash ? slash - part : s + n - part;
+		if (part_len == 2 && part[0] == '.' && part[1] == '.') return false;
+		part += part_len + 1;
+	}
+	*name = s;
+	*len = n;
+	return true;
+}
+
+static void add_member(archive* a, archive_member m, const char* name,
+		       int len, const char* link)
+{
+	// the entry of the root itself
+	if (!clean_name(&name, &len) || !len) return;
+	m.name = add_name(a, name, len);
+	if (link && link[0])
+	{
+		int link_len = strlen(link);
+		// hard links name another member, so they are cleaned the same
+		if (m.hardlink && !clean_name(&link, &link_len)) return;
+		m.link = add_name(a, link, link_len);
+	}
+	da_append(a->members, m);
+}
+
+// the uncompressed contents of a tar, front to back
+typedef struct
+{
+	gzFile gz;
+	// zstd -dc feeding the stream, 0 when the file is read directly
+	pid_t child;
+	long long pos;
+	long long next_report;
+	char* buffer;
+	const archive* a;
+	reporter* rep;
+} stream;
+
+static bool open_stream(stream* s, const archive* a, reporter* rep)
+{
+	*s = (stream){0};
+	s->a = a;
+	s->rep = rep;
+	int fd = open(a->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		report_error(rep, a->path, "failed to open", errno);
+		return false;
+	}
+	if (a->format == ARCHIVE_TAR_ZST)
+	{
+		int pipe_fds[2];
+		if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+		{
+			report_error(rep, a->path, "failed to create pipe", errno);
+			close(fd);
+			return false;
+		}
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, fd, STDIN_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+		posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+						 "/dev/null", O_WRONLY, 0);
+		char* argv[] = { "zstd", "-dc", NULL };
+		int err = posix_spawnp(&s->child, "zstd", &actions, NULL,
+				       argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		close(pipe_fds[1]);
+		close(fd);
+		if (err)
+		{
+			report_error(rep, a->path, "failed to run zstd", err);
+			close(pipe_fds[0]);
+			s->child = 0;
+			return false;
+		}
+		fd = pipe_fds[0];
+	}
+	// plain tars go through zlib too, it passes them through unchanged
+	s->gz = gzdopen(fd, "rb");
+	if (!s->gz) alloc_failed();
+	gzbuffer(s->gz, CHUNK_SIZE);
+	s->buffer = malloc(CHUNK_SIZE);
+	if (!s->buffer) alloc_failed();
+	return true;
+}
+
+static void close_stream(stream* s)
+{
+	gzclose(s->gz);
+	// zstd may still be writing what nobody wants anymore
+	if (s->child)
+	{
+		kill(s->child, SIGTERM);
+		waitpid(s->child, NULL, 0);
+	}
+	free(s->buffer);
+}
+
+// progress goes by how far into the file the stream is, a pipe only
+// knows how much came out of it
+static bool stream_going(stream* s)
+{
+	if (s->pos >= s->next_report)
+	{
+		s->next_report = s->pos + PROGRESS_STEP;
+		if (s->child)
+			report_progress(s->rep, s->a->path, s->pos, 0);
+		else
+			report_progress(s->rep, s->a->path, gzoffset(s->gz),
+					s->a->st.st_size);
+	}
+	return !report_stopped(s->rep);
+}
+
+static bool read_stream(stream* s, void* buf, long long n)
+{
+	char* at = buf;
+	while (n > 0)
+	{
+		int got = gzread(s->gz, at, n < CHUNK_SIZE ? n : CHUNK_SIZE);
+		if (got <= 0) return false;
+		at += got;
+		n -= got;
+		s->pos += got;
+	}
+	return true;
+}
+
+// compressed data in between has to be read through, plain tars seek
+static bool skip_stream(stream* s, long long to)
+{
+	if (!s->child && gzdirect(s->gz))
+	{
+		if (gzseek(s->gz, to, SEEK_SET) == -1) return false;
+		s->pos = to;
+		return stream_going(s);
+	}
+	while (s->pos < to)
+	{
+		long long n = to - s->pos < CHUNK_SIZE ? to - s->pos : CHUNK_SIZE;
+		if (!read_stream(s, s->buffer, n) || !stream_going(s))
+			return false;
+	}
+	return true;
+}
+
+// octal, or big endian base 256 for what gnu tar can't fit in octal.
+// -1 for negative base 256 values and ones past a long long
+static long long tar_number(const char* field, int len)
+{
+	const unsigned char* p = (const unsigned char*)field;
+	long long n = 0;
+	if (p[0] & 0x80)
+	{
+		if (p[0] & 0x40) return -1;
+		n = p[0] & 0x3f;
+		for (int i = 1; i < len; i++)
+		{
+			if (n > LLONG_MAX >> 8) return -1;
+			n = n << 8 | p[i];
+		}
+		return n;
+	}
+	int i = 0;
+	while (i < len && p[i] == ' ') i++;
+	while (i < len && p[i] >= '0' && p[i] <= '7')
+		n = n * 8 + p[i++] - '0';
+	return n;
+}
+
+static bool tar_checksum(const char* header)
+{
+	const unsigned char* h = (const unsigned char*)header;
+	long long sum = 0;
+	for (int i = 0; i < TAR_BLOCK; i++)
+		sum += i >= 148 && i < 156 ? ' ' : h[i];
+	return sum == tar_number(header + 148, 8);
+}
+
+// what the extended headers of a pax tar override in the next one
+typedef struct
+{
+	char* path;
+	char* linkpath;
+	long long size;
+	long long mtime;
+	long long uid;
+	long long gid;
+} pax_attrs;
+
+static void reset_pax(pax_attrs* pax)
+{
+	free(pax->path);
+	free(pax->linkpath);
+	*pax = (pax_attrs){ NULL, NULL, -1, -1, -1, -1 };
+}
+
+// records are "<length> <key>=<value>\n"
+static void parse_pax(char* text, long long size, pax_attrs* pax)
+{
+	char* at = text;
+	char* end = text + size;
+	while (at < end)
+	{
+		char* space;
+		long long len = strtoll(at, &space, 10);
+		if (len <= 0 || *space != ' ' || len > end - at ||
+		    space + 1 > at + len - 1)
+			break;
+		char* key = space + 1;
+		char* value_end = at + len - 1;
+		char* eq = memchr(key, '=', value_end - key);
+		if (!eq) break;
+		*eq = '\0';
+		*value_end = '\0';
+		char* value = eq + 1;
+		if (!strcmp(key, "path"))
+		{
+			free(pax->path);
+			pax->path = strdup(value);
+		}
+		else if (!strcmp(key, "linkpath"))
+		{
+			free(pax->linkpath);
+			pax->linkpath = strdup(value);
+		}
+		else if (!strcmp(key, "size"))
+			pax->size = strtoll(value, NULL, 10);
+		else if (!strcmp(key, "mtime"))
+			pax->mtime = strtoll(value, NULL, 10);
+		else if (!strcmp(key, "uid"))
+			pax->uid = strtoll(value, NULL, 10);
+		else if (!strcmp(key, "gid"))
+			pax->gid = strtoll(value, NULL, 10);
+		at += len;
+	}
+}
+
+static unsigned tar_type(char type, const char* name)
+{
+	switch (type)
+	{
+	case '5':
+	case 'D': return S_IFDIR;
+	case '2': return S_IFLNK;
+	case '3': return S_IFCHR;
+	case '4': return S_IFBLK;
+	case '6': return S_IFIFO;
+	// old tars mark directories only with a trailing slash
+	case '\0': return name[0] && name[strlen(name) - 1] == '/'
+			? S_IFDIR : S_IFREG;
+	default: return S_IFREG;
+	}
+}
+
+static bool index_tar(archive* a, reporter* rep)
+{
+	stream s;
+	if (!open_stream(&s, a, rep)) return false;
+	char h[TAR_BLOCK];
+	// long names and pax attributes are about the header after them
+	char* long_name = NULL;
+	char* long_link = NULL;
+	pax_attrs pax = {0};
+	reset_pax(&pax);
+	bool ok = true;
+	bool first = true;
+	while (true)
+	{
+		if (!read_stream(&s, h, TAR_BLOCK))
+		{
+			report_error(rep, a->path, first ? "not a tar archive"
+				     : "truncated archive", EINVAL);
+			ok = !first;
+			break;
+		}
+		// the end is marked by zeroed blocks
+		if (!h[0]) break;
+		if (!tar_checksum(h))
+		{
+			report_error(rep, a->path, first ? "not a tar archive"
+				     : "corrupt tar header", EINVAL);
+			ok = !first;
+			break;
+		}
+		first = false;
+
+		char type = h[156];
+		bool extension = type == 'L' || type == 'K' || type == 'x';
+		long long size = tar_number(h + 124, 12);
+		if (!extension && pax.size >= 0) size = pax.size;
+		if (size < 0 || size > LLONG_MAX - TAR_BLOCK ||
+		    (extension && size > TAR_EXTENSION_MAX))
+		{
+			report_error(rep, a->path, "corrupt tar header", EINVAL);
+			break;
+		}
+		long long data = s.pos;
+		long long next = data + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+		if (extension)
+		{
+			char* text = malloc(size + 1);
+			if (!text)
+			{
+				report_error(rep, a->path, "failed to index", ENOMEM);
+				ok = false;
+				break;
+			}
+			if (!read_stream(&s, text, size))
+			{
+				free(text);
+				report_error(rep, a->path, "truncated archive", EINVAL);
+				break;
+			}
+			text[size] = '\0';
+			if (type == 'L')
+			{
+				free(long_name);
+				long_name = text;
+			}
+			else if (type == 'K')
+			{
+				free(long_link);
+				long_link = text;
+			}
+			else
+			{
+				parse_pax(text, size, &pax);
+				free(text);
+			}
+		}
+		// global pax headers and volume labels aren't members
+		else if (type != 'g' && type != 'V')
+		{
+			char* name;
+			if (pax.path)
+				name = strdup(pax.path);
+			else if (long_name)
+				name = strdup(long_name);
+			// posix ustar splits long names, gnu uses the field otherwise
+			else if (!memcmp(h + 257, "ustar\0", 6) && h[345])
+				name = stralloc("%.155s/%.100s", h + 345, h);
+			else
+				name = strndup(h, 100);
+			char* link = pax.linkpath ? strdup(pax.linkpath)
+				: long_link ? strdup(long_link) : strndup(h + 157, 100);
+
+			archive_member m = {0};
+			m.mode = tar_type(type, name) | (tar_number(h + 100, 8) & 07777);
+			m.hardlink = type == '1';
+			m.uid = pax.uid >= 0 ? pax.uid : tar_number(h + 108, 8);
+			m.gid = pax.gid >= 0 ? pax.gid : tar_number(h + 116, 8);
+			m.mtime = pax.mtime >= 0 ? pax.mtime : tar_number(h + 136, 12);
+			m.size = S_ISREG(m.mode) ? size : 0;
+			m.offset = data;
+			add_member(a, m, name, strlen(name),
+				   S_ISLNK(m.mode) || m.hardlink ? link : NULL);
+			free(name);
+			free(link);
+			free(long_name);
+			free(long_link);
+			long_name = long_link = NULL;
+			reset_pax(&pax);
+		}
+		if (!skip_stream(&s, next))
+		{
+			if (!report_stopped(rep))
+				report_error(rep, a->path, "truncated archive", EINVAL);
+			ok = !report_stopped(rep);
+			break;
+		}
+	}
+	free(long_name);
+	free(long_link);
+	free(pax.path);
+	free(pax.linkpath);
+	close_stream(&s);
+	return ok;
+}
+
+static unsigned get16(const unsigned char* p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned get32(const unsigned char* p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static unsigned long long get64(const unsigned char* p)
+{
+	return get32(p) | (unsigned long long)get32(p + 4) << 32;
+}
+
+static bool read_at(int fd, void* buf, long long n, long long at)
+{
+	char* p = buf;
+	while (n > 0)
+	{
+		ssize_t got = pread(fd, p, n, at);
+		if (got <= 0) return false;
+		p += got;
+		n -= got;
+		at += got;
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void* buf, long long n)
+{
+	const char* p = buf;
+	while (n > 0)
+	{
+		ssize_t put = write(fd, p, n);
+		if (put < 0) return false;
+		p += put;
+		n -= put;
+	}
+	return true;
+}
+
+static long long dos_time(unsigned time, unsigned date)
+{
+	struct tm t = {0};
+	t.tm_sec = (time & 31) * 2;
+	t.tm_min = time >> 5 & 63;
+	t.tm_hour = time >> 11;
+	t.tm_mday = date & 31;
+	t.tm_mon = (date >> 5 & 15) - 1;
+	t.tm_year = (date >> 9) + 80;
+	t.tm_isdst = -1;
+	return mktime(&t);
+}
+
+// the data of member m into out, or into buf (of m->size bytes) when out
+// is -1. deflate and stored are the methods anything still writes
+static bool zip_data(int fd, const archive_member* m, const char* name,
+		     int out, char* buf, reporter* rep)
+{
+	unsigned char local[ZIP_LOCAL_SIZE];
+	if (!read_at(fd, local, ZIP_LOCAL_SIZE, m->offset) ||
+	    get32(local) != ZIP_LOCAL_SIG)
+	{
+		report_error(rep, name, "corrupt zip member", EINVAL);
+		return false;
+	}
+	if (m->packed < 0 ||
+	    (m->method != ZIP_STORED && m->method != ZIP_DEFLATED))
+	{
+		report_error(rep, name, m->packed < 0 ? "encrypted member"
+			     : "unsupported compression", ENOTSUP);
+		return false;
+	}
+	long long at = m->offset + ZIP_LOCAL_SIZE +
+		get16(local + 26) + get16(local + 28);
+
+	unsigned char* in = malloc(CHUNK_SIZE * 2);
+	if (!in) alloc_failed();
+	unsigned char* inflated = in + CHUNK_SIZE;
+	z_stream z = {0};
+	if (m->method == ZIP_DEFLATED && inflateInit2(&z, -MAX_WBITS) != Z_OK)
+		alloc_failed();
+	unsigned long crc = crc32(0, NULL, 0);
+	long long left = m->packed;
+	long long written = 0;
+	bool ok = true;
+	const char* what = NULL;
+	while (ok && left > 0)
+	{
+		int n = left < CHUNK_SIZE ? left : CHUNK_SIZE;
+		if (!read_at(fd, in, n, at))
+		{
+			what = "truncated archive";
+			break;
+		}
+		at += n;
+		left -= n;
+		z.next_in = in;
+		z.avail_in = n;
+		do
+		{
+			const unsigned char* data = in;
+			int len = n;
+			if (m->method == ZIP_DEFLATED)
+			{
+				z.next_out = inflated;
+				z.avail_out = CHUNK_SIZE;
+				int ret = inflate(&z, Z_NO_FLUSH);
+				if (ret != Z_OK && ret != Z_STREAM_END &&
+				    ret != Z_BUF_ERROR)
+				{
+					what = "corrupt zip member";
+					ok = false;
+					break;
+				}
+				data = inflated;
+				len = CHUNK_SIZE - z.avail_out;
+			}
+			if (written + len > m->size)
+			{
+				what = "corrupt zip member";
+				ok = false;
+				break;
+			}
+			crc = crc32(crc, data, len);
+			if (out == -1)
+				memcpy(buf + written, data, len);
+			else if (!write_all(out, data, len))
+			{
+				report_error(rep, name, "failed to write", errno);
+				ok = false;
+				break;
+			}
+			written += len;
+		} while (m->method == ZIP_DEFLATED && z.avail_out == 0);
+		if (report_stopped(rep)) ok = false;
+	}
+	if (m->method == ZIP_DEFLATED) inflateEnd(&z);
+	free(in);
+	if (ok && !what && (written != m->size || crc != m->crc))
+		what = "corrupt zip member";
+	if (what) report_error(rep, name, what, EINVAL);
+	return ok && !what;
+}
+
+// everything is in the central directory at the end, nothing before it
+// has to be read
+static bool index_zip(archive* a, int fd, reporter* rep)
+{
+	long long file_size = a->st.st_size;
+	int tail_len = file_size < ZIP_TAIL ? file_size : ZIP_TAIL;
+	unsigned char* tail = malloc(tail_len ? tail_len : 1);
+	if (!tail) alloc_failed();
+	int eocd = -1;
+	if (read_at(fd, tail, tail_len, file_size - tail_len))
+		for (int i = tail_len - ZIP_EOCD_SIZE; i >= 0 && eocd == -1; i--)
+			if (get32(tail + i) == ZIP_EOCD_SIG) eocd = i;
+	if (eocd == -1)
+	{
+		free(tail);
+		report_error(rep, a->path, "not a zip archive", EINVAL);
+		return false;
+	}
+	unsigned long long count = get16(tail + eocd + 10);
+	unsigned long long cd_size = get32(tail + eocd + 12);
+	unsigned long long cd_offset = get32(tail + eocd + 16);
+	// zip64 keeps the real values in a record the locator points at
+	unsigned char rec[ZIP64_EOCD_SIZE];
+	if (eocd >= ZIP64_LOCATOR_SIZE &&
+	    get32(tail + eocd - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIG &&
+	    read_at(fd, rec, ZIP64_EOCD_SIZE,
+		    get64(tail + eocd - ZIP64_LOCATOR_SIZE + 8)) &&
+	    get32(rec) == ZIP64_EOCD_SIG)
+	{
+		count = get64(rec + 32);
+		cd_size = get64(rec + 40);
+		cd_offset = get64(rec + 48);
+	}
+	free(tail);
+	if (cd_size > (unsigned long long)file_size ||
+	    cd_offset > file_size - cd_size ||
+	    count > cd_size / ZIP_CENTRAL_SIZE)
+	{
+		report_error(rep, a->path, "corrupt zip archive", EINVAL);
+		return false;
+	}
+
+	unsigned char* cd = malloc(cd_size ? cd_size : 1);
+	if (!cd)
+	{
+		report_error(rep, a->path, "failed to index", ENOMEM);
+		return false;
+	}
+	if (!read_at(fd, cd, cd_size, cd_offset))
+	{
+		free(cd);
+		report_error(rep, a->path, "truncated archive", EINVAL);
+		return false;
+	}
+	const unsigned char* p = cd;
+	const unsigned char* end = cd + cd_size;
+	bool ok = true;
+	for (unsigned long long i = 0; i < count && ok; i++)
+	{
+		if (end - p < ZIP_CENTRAL_SIZE || get32(p) != ZIP_CENTRAL_SIG ||
+		    end - p < ZIP_CENTRAL_SIZE + get16(p + 28) + get16(p + 30) +
+		    get16(p + 32))
+		{
+			report_error(rep, a->path, "corrupt zip archive", EINVAL);
+			ok = false;
+			break;
+		}
+		unsigned host = get16(p + 4) >> 8;
+		unsigned flags = get16(p + 8);
+		unsigned name_len = get16(p + 28);
+		unsigned extra_len = get16(p + 30);
+		unsigned external = get32(p + 38);
+		const char* name = (const char*)p + ZIP_CENTRAL_SIZE;
+		const unsigned char* extra = p + ZIP_CENTRAL_SIZE + name_len;
+
+		archive_member m = {0};
+		m.method = get16(p + 10);
+		m.mtime = dos_time(get16(p + 12), get16(p + 14));
+		m.crc = get32(p + 16);
+		m.packed = get32(p + 20);
+		m.size = get32(p + 24);
+		m.offset = get32(p + 42);
+		for (const unsigned char* x = extra;
+		     x + 4 <= extra + extra_len; x += 4 + get16(x + 2))
+		{
+			unsigned id = get16(x);
+			unsigned len = get16(x + 2);
+			const unsigned char* field = x + 4;
+			const unsigned char* field_end = field + len;
+			if (field_end > extra + extra_len) break;
+			// only the values that didn't fit are there, in this order
+			if (id == ZIP_EXTRA_ZIP64)
+			{
+				if (m.size == 0xffffffff && field + 8 <= field_end)
+				{
+					m.size = get64(field);
+					field += 8;
+				}
+				if (m.packed == 0xffffffff && field + 8 <= field_end)
+				{
+					m.packed = get64(field);
+					field += 8;
+				}
+				if (m.offset == 0xffffffff && field + 8 <= field_end)
+					m.offset = get64(field);
+			}
+			else if (id == ZIP_EXTRA_TIME && len >= 5 && field[0] & 1)
+				m.mtime = (int)get32(field + 1);
+		}
+		bool dir = name_len && name[name_len - 1] == '/';
+		if (host == ZIP_HOST_UNIX && external >> 16)
+			m.mode = external >> 16;
+		else
+			m.mode = dir ? S_IFDIR | 0755 : S_IFREG | 0644;
+		if (dir) m.mode = S_IFDIR | (m.mode & 07777);
+		if (flags & 1) m.packed = -1;
+		if (!S_ISREG(m.mode) && !S_ISLNK(m.mode)) m.size = 0;
+		char* link = NULL;
+		// a symlink's target is its data
+		if (S_ISLNK(m.mode) && m.size < PATH_MAX)
+		{
+			link = calloc(1, m.size + 1);
+			if (!link) alloc_failed();
+			char* link_name = strndup(name, name_len);
+			if (!zip_data(fd, &m, link_name, -1, link, rep)) link[0] = '\0';
+			free(link_name);
+		}
+		add_member(a, m, name, name_len, link);
+		free(link);
+		p += ZIP_CENTRAL_SIZE + name_len + extra_len + get16(p + 32);
+
+		if (a->members.len % INDEX_PROGRESS_STEP == 0)
+			report_progress(rep, a->path, a->members.len, count);
+		if (report_stopped(rep)) ok = false;
+	}
+	free(cd);
+	return ok;
+}
+
+static int compare_members(const void* x, const void* y, void* arg)
+{
+	const char* names = arg;
+	const archive_member* a = x;
+	const archive_member* b = y;
+	int cmp = strcmp(names + a->name, names + b->name);
+	if (cmp) return cmp;
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+bool open_archive(archive* a, const char* path, reporter* rep)
+{
+	*a = (archive){0};
+	a->format = archive_format(path);
+	if (!a->format)
+	{
+		report_error(rep, path, "not an archive", EINVAL);
+		return false;
+	}
+	a->path = realpath(path, NULL);
+	if (!a->path)
+	{
+		report_error(rep, path, "failed to resolve", errno);
+		return false;
+	}
+	int fd = open(a->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &a->st) != 0)
+	{
+		report_error(rep, a->path, "failed to open", errno);
+		if (fd != -1) close(fd);
+		free(a->path);
+		a->path = NULL;
+		return false;
+	}
+	// offset 0 is the empty name, for members without a link
+	da_construct(a->names, 4096);
+	a->names.items[0] = '\0';
+	a->names.len = 1;
+	da_construct(a->members, 256);
+
+	bool ok = a->format == ARCHIVE_ZIP
+		? index_zip(a, fd, rep) : index_tar(a, rep);
+	close(fd);
+	if (!ok)
+	{
+		free_archive(a);
+		return false;
+	}
+	qsort_r(a->members.items, a->members.len, sizeof(*a->members.items),
+		compare_members, a->names.items);
+	return true;
+}
+
+void free_archive(archive* a)
+{
+	free(a->path);
+	free(a->names.items);
+	free(a->members.items);
+	*a = (archive){0};
+}
+
+bool archive_current(const archive* a, const char* path)
+{
+	struct stat st;
+	if (!a->path || stat(path, &st) != 0) return false;
+	return st.st_dev == a->st.st_dev && st.st_ino == a->st.st_ino &&
+		st.st_size == a->st.st_size &&
+		st.st_mtim.tv_sec == a->st.st_mtim.tv_sec &&
+		st.st_mtim.tv_nsec == a->st.st_mtim.tv_nsec;
+}
+
+// the first member not sorting before prefix
+static int first_member(const archive* a, const char* prefix)
+{
+	int lo = 0, hi = a->members.len;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (strcmp(member_name(a, mid), prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// the latest of the members sharing the name of member i
+static bool superseded(const archive* a, int i)
+{
+	return i + 1 < a->members.len &&
+		!strcmp(member_name(a, i), member_name(a, i + 1));
+}
+
+static struct stat member_stat(const archive* a, const archive_member* m)
+{
+	struct stat st = {0};
+	st.st_mode = m->mode;
+	st.st_nlink = 1;
+	st.st_uid = m->uid;
+	st.st_gid = m->gid;
+	st.st_size = m->size;
+	st.st_mtime = m->mtime;
+	if (!m->hardlink || !m->link) return st;
+	// hard links carry no data of their own
+	int target = first_member(a, a->names.items + m->link);
+	if (target < a->members.len &&
+	    !strcmp(member_name(a, target), a->names.items + m->link))
+		st.st_size = a->members.items[target].size;
+	return st;
+}
+
+// a directory that is only there as part of the paths below it
+static struct stat implied_dir(const archive* a)
+{
+	struct stat st = {0};
+	st.st_mode = S_IFDIR | 0755;
+	st.st_nlink = 1;
+	st.st_uid = a->st.st_uid;
+	st.st_gid = a->st.st_gid;
+	st.st_mtim = a->st.st_mtim;
+	return st;
+}
+
+typedef struct
+{
+	const char* name;
+	int len;
+	// -1 for an implied directory
+	int member;
+} child;
+
+static int compare_children(const void* x, const void* y)
+{
+	const child* a = x;
+	const child* b = y;
+	int len = a->len < b->len ? a->len : b->len;
+	int cmp = memcmp(a->name, b->name, len);
+	if (cmp) return cmp;
+	if (a->len != b->len) return a->len - b->len;
+	// a member of its own wins over the directory its children imply
+	return b->member - a->member;
+}
+
+bool list_archive(directory* dir, const archive* a, const char* inner,
+		  reporter* rep)
+{
+	int inner_len = strlen(inner);
+	DA(child) children;
+	da_construct(children, 64);
+	for (int i = first_member(a, inner); i < a->members.len; i++)
+	{
+		const char* name = member_name(a, i);
+		if (strncmp(name, inner, inner_len)) break;
+		if (superseded(a, i)) continue;
+		const char* rest = name + inner_len;
+		const char* slash = strchr(rest, '/');
+		child c = { rest, slash ? slash - rest : (int)strlen(rest),
+			    slash ? -1 : i };
+		da_append(children, c);
+	}
+	qsort(children.items, children.len, sizeof(*children.items),
+	      compare_children);
+
+	int n = 2;
+	char** names = malloc(sizeof(*names) * (children.len + 2));
+	char** links = malloc(sizeof(*links) * (children.len + 2));
+	struct stat* st = malloc(sizeof(*st) * (children.len + 2));
+	if (!names || !links || !st)
+	{
+		report_error(rep, a->path, "failed to list", ENOMEM);
+		free(names);
+		free(links);
+		free(st);
+		free(children.items);
+		return false;
+	}
+	names[0] = strdup(".");
+	names[1] = strdup("..");
+	links[0] = links[1] = NULL;
+	// the member of inner itself, named without the trailing '/'
+	int self = -1;
+	if (inner_len)
+	{
+		char* own = strndup(inner, inner_len - 1);
+		int i = first_member(a, own);
+		if (i < a->members.len && !strcmp(member_name(a, i), own))
+			self = i;
+		free(own);
+	}
+	st[0] = self != -1 ? member_stat(a, &a->members.items[self])
+		: implied_dir(a);
+	st[1] = implied_dir(a);
+	for (int i = 0; i < children.len; i++)
+	{
+		const child* c = &children.items[i];
+		if (i && c->len == children.items[i - 1].len &&
+		    !memcmp(c->name, children.items[i - 1].name, c->len))
+			continue;
+		names[n] = strndup(c->name, c->len);
+		if (c->member == -1)
+		{
+			st[n] = implied_dir(a);
+			links[n] = NULL;
+		}
+		else
+		{
+			const archive_member* m = &a->members.items[c->member];
+			st[n] = member_stat(a, m);
+			links[n] = S_ISLNK(m->mode) ? a->names.items + m->link : NULL;
+		}
+		n++;
+	}
+
+	char* archive_path = strdup(a->path);
+	char* label = stralloc("in %s/%s", basename(archive_path), inner);
+	bool listed = list_stats(dir, label, names, st, links, n, rep);
+	free(label);
+	free(archive_path);
+	for (int i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	free(links);
+	free(st);
+	free(children.items);
+	return listed;
+}
+
+// opens the directory rel (relative to the directory dir) is in, creating
+// the ones leading up to it if create, and points base at its last part.
+// a link on the way is refused, an earlier member could have made it
+// point anywhere. -1 with errno set if it can't be opened
+static int open_parent(int dir, char* rel, bool create, const char** base)
+{
+	int fd = fcntl(dir, F_DUPFD_CLOEXEC, 0);
+	char* part = rel;
+	for (char* slash; fd != -1 && (slash = strchr(part, '/'));
+	     part = slash + 1)
+	{
+		if (slash == part) continue;
+		*slash = '\0';
+		if (create) mkdirat(fd, part, 0755);
+		int next = openat(fd, part,
+				  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		int error = errno;
+		struct stat st;
+		// linux has O_DIRECTORY win over O_NOFOLLOW
+		if (next == -1 && error == ENOTDIR &&
+		    fstatat(fd, part, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+		    S_ISLNK(st.st_mode))
+			error = ELOOP;
+		*slash = '/';
+		close(fd);
+		errno = error;
+		fd = next;
+	}
+	*base = part;
+	return fd;
+}
+
+// a member to extract and the one its data comes from, the same one
+// unless it is a hard link whose target isn't extracted along with it
+typedef struct
+{
+	int member;
+	int data;
+} extraction;
+
+typedef DA(extraction) extraction_list;
+
+static int compare_picked(const void* x, const void* y)
+{
+	return ((const extraction*)x)->member - ((const extraction*)y)->member;
+}
+
+static int compare_offsets(const void* x, const void* y, void* arg)
+{
+	const archive* a = arg;
+	const archive_member* m = &a->members.items[((const extraction*)x)->data];
+	const archive_member* n = &a->members.items[((const extraction*)y)->data];
+	return (m->offset > n->offset) - (m->offset < n->offset);
+}
+
+// the members a name stands for, directories bring what is below them
+static void pick(const archive* a, const char* inner, const char* name,
+		 extraction_list* picked)
+{
+	char* prefix = !strcmp(name, ".")
+		? strdup(inner) : stralloc("%s%s", inner, name);
+	int len = strlen(prefix);
+	for (int i = first_member(a, prefix); i < a->members.len; i++)
+	{
+		const char* m = member_name(a, i);
+		if (strncmp(m, prefix, len)) break;
+		bool below = !len || m[len] == '\0' || m[len] == '/' ||
+			prefix[len - 1] == '/';
+		extraction e = { i, i };
+		if (below && !superseded(a, i)) da_append(*picked, e);
+	}
+	free(prefix);
+}
+
+// a hard link to a member left behind gets a copy of its data instead
+static void resolve_links(const archive* a, extraction_list* picked)
+{
+	qsort(picked->items, picked->len, sizeof(*picked->items),
+	      compare_picked);
+	for (int i = 0; i < picked->len; i++)
+	{
+		const archive_member* m = &a->members.items[picked->items[i].member];
+		if (!m->hardlink) continue;
+		const char* target = a->names.items + m->link;
+		int t = first_member(a, target);
+		while (t + 1 < a->members.len && superseded(a, t)) t++;
+		if (t >= a->members.len || strcmp(member_name(a, t), target))
+			continue;
+		extraction key = { t, t };
+		if (!bsearch(&key, picked->items, picked->len,
+			     sizeof(*picked->items), compare_picked))
+			picked->items[i].data = t;
+	}
+}
+
+// extracts m as base in the directory at, out is where that is for
+// the errors
+static bool extract_one(const archive* a, const archive_member* m,
+			const archive_member* data, const char* out, int at,
+			const char* base, int dst, const char* inner,
+			stream* s, int fd, reporter* rep)
+{
+	const char* name = a->names.items + m->name;
+	if (S_ISDIR(m->mode))
+	{
+		struct stat st;
+		if (mkdirat(at, base, 0700) == 0 || (errno == EEXIST &&
+		    fstatat(at, base, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+		    S_ISDIR(st.st_mode)))
+			return true;
+		report_error(rep, out, "failed to create", errno);
+		return false;
+	}
+	if (S_ISLNK(m->mode))
+	{
+		if (symlinkat(a->names.items + m->link, at, base) == 0)
+			return true;
+		report_error(rep, out, "failed to create", errno);
+		return false;
+	}
+	if (m->hardlink && data == m)
+	{
+		char* target = strdup(a->names.items + m->link + strlen(inner));
+		const char* from;
+		int from_dir = open_parent(dst, target, false, &from);
+		bool linked = from_dir != -1 &&
+			linkat(from_dir, from, at, base, 0) == 0;
+		if (!linked) report_error(rep, out, "failed to link", errno);
+		if (from_dir != -1) close(from_dir);
+		free(target);
+		return linked;
+	}
+	if (!S_ISREG(data->mode))
+	{
+		report_error(rep, name, "not a regular file", ENOTSUP);
+		return false;
+	}
+
+	int file = openat(at, base, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			  0600);
+	if (file == -1)
+	{
+		report_error(rep, out, errno == EEXIST ? "refusing to overwrite"
+			     : "failed to open for writing", errno);
+		return false;
+	}
+	bool ok = true;
+	if (s)
+	{
+		if (!skip_stream(s, data->offset))
+		{
+			if (!report_stopped(rep))
+				report_error(rep, a->path, "truncated archive", EINVAL);
+			ok = false;
+		}
+		for (long long left = data->size; ok && left > 0;)
+		{
+			long long n = left < CHUNK_SIZE ? left : CHUNK_SIZE;
+			if (!read_stream(s, s->buffer, n))
+			{
+				report_error(rep, a->path, "truncated archive", EINVAL);
+				ok = false;
+			}
+			else if (!write_all(file, s->buffer, n))
+			{
+				report_error(rep, out, "failed to write", errno);
+				ok = false;
+			}
+			else if (!stream_going(s))
+				ok = false;
+			left -= n;
+		}
+	}
+	else
+		ok = zip_data(fd, data, name, file, NULL, rep);
+	if (ok)
+	{
+		struct timespec times[2] = { { 0, UTIME_OMIT }, { m->mtime, 0 } };
+		fchmod(file, m->mode & 07777);
+		futimens(file, times);
+	}
+	if (close(file) != 0 && ok)
+	{
+		report_error(rep, out, "failed to write", errno);
+		ok = false;
+	}
+	// don't leave a truncated file behind
+	if (!ok) unlinkat(at, base, 0);
+	return ok;
+}
+
+bool extract_members(const archive* a, const char* inner,
+		     const char* const* names, int n, const char* dst,
+		     reporter* rep)
+{
+	int dst_fd = open(dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dst_fd == -1)
+	{
+		report_error(rep, dst, errno == ENOTDIR ? "not a directory"
+			     : "failed to open", errno);
+		return false;
+	}
+	extraction_list picked;
+	da_construct(picked, 64);
+	for (int i = 0; i < n; i++)
+		if (strcmp(names[i], "..")) pick(a, inner, names[i], &picked);
+	if (!picked.len)
+	{
+		report_error(rep, dst, "nothing to extract", ENOENT);
+		free(picked.items);
+		close(dst_fd);
+		return false;
+	}
+	resolve_links(a, &picked);
+	// read front to back, a compressed tar only as far as the last one
+	qsort_r(picked.items, picked.len, sizeof(*picked.items),
+		compare_offsets, (void*)a);
+
+	stream s;
+	bool streaming = false;
+	int fd = -1;
+	bool ok = true;
+	if (a->format == ARCHIVE_ZIP)
+	{
+		fd = open(a->path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+		{
+			report_error(rep, a->path, "failed to open", errno);
+			ok = false;
+		}
+	}
+	else
+		ok = streaming = open_stream(&s, a, rep);
+	bool opened = ok;
+
+	int inner_len = strlen(inner);
+	int dst_len = strlen(dst);
+	long long done = 0, total = 0;
+	for (int i = 0; i < picked.len; i++)
+		total += a->members.items[picked.items[i].data].size;
+	for (int i = 0; opened && i < picked.len && !report_stopped(rep); i++)
+	{
+		const archive_member* m = &a->members.items[picked.items[i].member];
+		const archive_member* data = &a->members.items[picked.items[i].data];
+		char* out = stralloc("%s/%s", dst,
+				     a->names.items + m->name + inner_len);
+		const char* base;
+		int at = open_parent(dst_fd, out + dst_len + 1, true, &base);
+		if (at == -1)
+		{
+			report_error(rep, out, errno == ELOOP
+				     ? "refusing to extract through a link"
+				     : "failed to create", errno);
+			ok = false;
+		}
+		else if (!extract_one(a, m, data, out, at, base, dst_fd, inner,
+				      streaming ? &s : NULL, fd, rep))
+			ok = false;
+		if (at != -1) close(at);
+		free(out);
+		done += data->size;
+		if (fd != -1) report_progress(rep, a->path, done, total);
+		// past a read error the stream can't be trusted
+		if (streaming && gzeof(s.gz) && i + 1 < picked.len) break;
+	}
+	if (fd != -1) close(fd);
+	if (streaming) close_stream(&s);
+
+	// last, creating their entries changed them. archives list a
+	// directory before its entries, so going backwards they come first
+	for (int i = picked.len - 1; i >= 0; i--)
+	{
+		const archive_member* m = &a->members.items[picked.items[i].member];
+		if (!S_ISDIR(m->mode)) continue;
+		char* rel = strdup(a->names.items + m->name + inner_len);
+		const char* base;
+		int at = open_parent(dst_fd, rel, false, &base);
+		int dir = at == -1 ? -1 : openat(at, base, O_RDONLY |
+						 O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (dir != -1)
+		{
+			struct timespec times[2] = { { 0, UTIME_OMIT },
+						     { m->mtime, 0 } };
+			fchmod(dir, m->mode & 07777);
+			futimens(dir, times);
+			close(dir);
+		}
+		if (at != -1) close(at);
+		free(rel);
+	}
+	free(picked.items);
+	close(dst_fd);
+	return ok;
+}
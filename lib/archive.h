@@ -0,0 +1,76 @@
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "da.h"
+#include "report.h"
+#include "directory.h"
+
+// tars (plain, gzip or zstd compressed) and zips browsed without
+// unpacking them. a tar is streamed once for its headers, skipping the
+// data in between, a zip is indexed from its central directory. members
+// are extracted by going straight to them, a compressed tar is only
+// read up to the last one wanted.
+
+#define ARCHIVE_TAR 1
+#define ARCHIVE_TAR_GZ 2
+// decompressed by piping it through zstd -dc
+#define ARCHIVE_TAR_ZST 3
+#define ARCHIVE_ZIP 4
+
+typedef struct
+{
+	// offsets into names, link is 0 for members that aren't links
+	unsigned name;
+	unsigned link;
+	// tar hard links are regular files whose link names another member
+	bool hardlink;
+	unsigned mode;
+	unsigned uid;
+	unsigned gid;
+	long long size;
+	long long mtime;
+	// tar: the data in the uncompressed stream, zip: the local header
+	long long offset;
+	// zip only, -1 for an encrypted member
+	long long packed;
+	int method;
+	unsigned crc;
+} archive_member;
+
+typedef struct
+{
+	char* path;
+	int format;
+	// the file the index was built from
+	struct stat st;
+	DA(char) names;
+	// sorted by name, so what a directory contains is next to it. a name
+	// appended to a tar more than once comes last in its latest version
+	DA(archive_member) members;
+} archive;
+
+// the format of path going by its name, 0 if it isn't an archive
+int archive_format(const char* path);
+
+bool open_archive(archive* a, const char* path, reporter* rep);
+
+void free_archive(archive* a);
+
+// false once path is no longer the file the index was built from
+bool archive_current(const archive* a, const char* path);
+
+// lists the members right below inner ("" or ending in '/') into dir,
+// directories only implied by the paths of deeper members included
+bool list_archive(directory* dir, const archive* a, const char* inner,
+		  reporter* rep);
+
+// extracts names (relative to inner, "." for all of it) into the
+// directory dst, directories with everything they contain. existing
+// files are left alone and nothing is extracted through a link
+bool extract_members(const archive* a, const char* inner,
+		     const char* const* names, int n, const char* dst,
+		     reporter* rep);
+
+#endif
@@ -0,0 +1,406 @@
+#include "attrs.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+
+#include "da.h"
+#include "pool.h"
+
+#define POLL_MS 100
+#define ATTR_PROGRESS_STEP 1024
+
+#define WHO_U (S_ISUID | S_IRWXU)
+#define WHO_G (S_ISGID | S_IRWXG)
+#define WHO_O (S_ISVTX | S_IRWXO)
+#define WHO_A (WHO_U | WHO_G | WHO_O)
+
+typedef struct
+{
+	char* path;
+	const char* what;
+	int err;
+} failure;
+
+// shared by the jobs of one change_attrs
+typedef struct
+{
+	const attr_change* c;
+	// jobs submitted and not finished yet, children are counted before
+	// their parent finishes so this only reaches 0 at the very end
+	atomic_int outstanding;
+	atomic_llong changed;
+	atomic_bool cancel;
+	pool* p;
+	pthread_mutex_t lock;
+	DA(failure) failures;
+	int dropped;
+	int dropped_err;
+} walk;
+
+typedef struct
+{
+	walk* w;
+	char* path;
+} tree_job;
+
+attr_change no_change(void)
+{
+	return (attr_change){ 0, {{0}}, (uid_t)-1, (gid_t)-1,
+			      { 0, UTIME_OMIT }, false };
+}
+
+static bool parse_octal(attr_change* c, const char* spec)
+{
+	char* end;
+	long mode = strtol(spec, &end, 8);
+	if (*end || mode < 0 || mode > 07777) return false;
+	c->n_clauses = 1;
+	c->clauses[0] = (mode_clause){ WHO_A, '=', mode, false };
+	return true;
+}
+
+bool parse_mode(attr_change* c, const char* spec, reporter* rep)
+{
+	if (*spec >= '0' && *spec <= '7')
+	{
+		if (parse_octal(c, spec)) return true;
+		report_error(rep, spec, "invalid mode", EINVAL);
+		return false;
+	}
+	mode_t mask = umask(0);
+	umask(mask);
+
+	c->n_clauses = 0;
+	const char* s = spec;
+	while (*s)
+	{
+		mode_t who = 0;
+		for (; *s && strchr("ugoa", *s); s++)
+			who |= *s == 'u' ? WHO_U : *s == 'g' ? WHO_G
+				: *s == 'o' ? WHO_O : WHO_A;
+		if (!who) who = WHO_A & ~mask;
+		// u+x,g-w and u+x-w alike
+		do
+		{
+			if (!*s || !strchr("+-=", *s) ||
+			    c->n_clauses == MODE_MAX_CLAUSES)
+				goto invalid;
+			mode_clause cl = { who, *s++, 0, false };
+			for (; *s && !strchr(",+-=", *s); s++)
+			{
+				switch (*s)
+				{
+				case 'r': cl.perms |= S_IRUSR | S_IRGRP | S_IROTH; break;
+				case 'w': cl.perms |= S_IWUSR | S_IWGRP | S_IWOTH; break;
+				case 'x': cl.perms |= S_IXUSR | S_IXGRP | S_IXOTH; break;
+				case 's': cl.perms |= S_ISUID | S_ISGID; break;
+				case 't': cl.perms |= S_ISVTX; break;
+				case 'X': cl.exec_if = true; break;
+				default: goto invalid;
+				}
+			}
+			c->clauses[c->n_clauses++] = cl;
+		} while (*s && *s != ',');
+		if (*s == ',' && !*++s) goto invalid;
+	}
+	if (c->n_clauses) return true;
+invalid:
+	report_error(rep, spec, "invalid mode", EINVAL);
+	c->n_clauses = 0;
+	return false;
+}
+
+mode_t changed_mode(const attr_change* c, mode_t mode)
+{
+	mode_t m = mode & 07777;
+	for (int i = 0; i < c->n_clauses; i++)
+	{
+		const mode_clause* cl = &c->clauses[i];
+		mode_t perms = cl->perms;
+		if (cl->exec_if && (S_ISDIR(mode) || (mode & 0111)))
+			perms |= S_IXUSR | S_IXGRP | S_IXOTH;
+		perms &= cl->who;
+		if (cl->op == '+')
+			m |= perms;
+		else if (cl->op == '-')
+			m &= ~perms;
+		else
+			m = (m & ~cl->who) | perms;
+	}
+	return m;
+}
+
+static bool parse_id(const char* s, unsigned* id)
+{
+	char* end;
+	unsigned long n = strtoul(s, &end, 10);
+	if (!*s || *end || n >= (unsigned)-1) return false;
+	*id = n;
+	return true;
+}
+
+bool parse_owner(attr_change* c, const char* spec, reporter* rep)
+{
+	char* user = strdup(spec);
+	char* group = strchr(user, ':');
+	if (group) *group++ = '\0';
+	bool ok = *user || (group && *group);
+	unsigned id;
+	if (ok && *user)
+	{
+		struct passwd* pw = getpwnam(user);
+		if (pw)
+			c->uid = pw->pw_uid;
+		else if (parse_id(user, &id))
+			c->uid = id;
+		else
+		{
+			report_error(rep, user, "no such user", EINVAL);
+			ok = false;
+		}
+	}
+	if (ok && group && *group)
+	{
+		struct group* gr = getgrnam(group);
+		if (gr)
+			c->gid = gr->gr_gid;
+		else if (parse_id(group, &id))
+			c->gid = id;
+		else
+		{
+			report_error(rep, group, "no such group", EINVAL);
+			ok = false;
+		}
+	}
+	else if (!ok)
+		report_error(rep, spec, "invalid owner", EINVAL);
+	free(user);
+	return ok;
+}
+
+bool parse_mtime(attr_change* c, const char* spec, reporter* rep)
+{
+	if (!strcmp(spec, "now"))
+	{
+		c->mtime = (struct timespec){ 0, UTIME_NOW };
+		return true;
+	}
+	char* end;
+	if (spec[0] == '@')
+	{
+		long long seconds = strtoll(spec + 1, &end, 10);
+		if (spec[1] && !*end)
+		{
+			c->mtime = (struct timespec){ seconds, 0 };
+			return true;
+		}
+	}
+	const char* formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d",
+	};
+	for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); i++)
+	{
+		struct tm tm = {0};
+		end = strptime(spec, formats[i], &tm);
+		if (!end || *end) continue;
+		tm.tm_isdst = -1;
+		c->mtime = (struct timespec){ mktime(&tm), 0 };
+		return true;
+	}
+	report_error(rep, spec, "invalid time", EINVAL);
+	return false;
+}
+
+static bool has_owner(const attr_change* c)
+{
+	return c->uid != (uid_t)-1 || c->gid != (gid_t)-1;
+}
+
+// changes name in dirfd, which st describes. the owner goes first, as a
+// chown clears the setuid and setgid bits. 0 or the errno of the call
+// named by what
+static int change_entry(const attr_change* c, int dirfd, const char* name,
+			const struct stat* st, bool follow, const char** what)
+{
+	int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+	bool chowned = false;
+	if ((c->uid != (uid_t)-1 && c->uid != st->st_uid) ||
+	    (c->gid != (gid_t)-1 && c->gid != st->st_gid))
+	{
+		*what = "failed to chown";
+		if (fchownat(dirfd, name, c->uid, c->gid, flags) != 0)
+			return errno;
+		chowned = true;
+	}
+	// a symlink's own mode means nothing on linux, and can't be set
+	mode_t mode = changed_mode(c, st->st_mode);
+	if (c->n_clauses && !S_ISLNK(st->st_mode) &&
+	    (mode != (st->st_mode & 07777) ||
+	     (chowned && (mode & (S_ISUID | S_ISGID)))))
+	{
+		*what = "failed to chmod";
+		if (fchmodat(dirfd, name, mode, 0) != 0) return errno;
+	}
+	if (c->mtime.tv_nsec != UTIME_OMIT)
+	{
+		struct timespec times[2] = { { 0, UTIME_OMIT }, c->mtime };
+		*what = "failed to touch";
+		if (utimensat(dirfd, name, times, flags) != 0) return errno;
+	}
+	return 0;
+}
+
+static void add_failure(walk* w, char* path, const char* what, int err)
+{
+	pthread_mutex_lock(&w->lock);
+	if (w->failures.len < ATTR_MAX_FAILURES)
+		da_append(w->failures, ((failure){ path, what, err }));
+	else
+	{
+		w->dropped++;
+		w->dropped_err = err;
+		free(path);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void change_tree(void* arg);
+
+static void submit_tree(walk* w, char* path)
+{
+	tree_job* job = malloc(sizeof(*job));
+	if (!job) alloc_failed();
+	*job = (tree_job){ w, path };
+	atomic_fetch_add(&w->outstanding, 1);
+	pool_submit(w->p, change_tree, job);
+}
+
+// changes the entries of one directory, its subdirectories become jobs
+// of their own once changed themselves (like chmod -R, a directory that
+// loses its x can't be gone into anymore)
+static void change_tree(void* arg)
+{
+	tree_job* job = arg;
+	walk* w = job->w;
+	const attr_change* c = w->c;
+	// stats only needed to find directories can be saved on most filesystems
+	bool need_stat = c->n_clauses || has_owner(c);
+
+	int fd = atomic_load(&w->cancel) ? -1
+		: open(job->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	DIR* dir = fd == -1 ? NULL : fdopendir(fd);
+	if (!dir && !atomic_load(&w->cancel))
+		add_failure(w, strdup(job->path), "failed to open", errno);
+	if (!dir && fd != -1) close(fd);
+
+	struct dirent* de;
+	while (dir && !atomic_load(&w->cancel) && (de = readdir(dir)))
+	{
+		const char* name = de->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+		struct stat st;
+		st.st_mode = de->d_type == DT_DIR ? S_IFDIR
+			: de->d_type == DT_LNK ? S_IFLNK : S_IFREG;
+		if ((need_stat || de->d_type == DT_UNKNOWN) &&
+		    fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		{
+			add_failure(w, stralloc("%s/%s", job->path, name),
+				    "failed to stat", errno);
+			continue;
+		}
+		const char* what = NULL;
+		int err = change_entry(c, fd, name, &st, false, &what);
+		if (err)
+			add_failure(w, stralloc("%s/%s", job->path, name), what,
+				    err);
+		atomic_fetch_add(&w->changed, 1);
+		if (S_ISDIR(st.st_mode))
+			submit_tree(w, stralloc("%s/%s", job->path, name));
+	}
+	if (dir) closedir(dir);
+	free(job->path);
+	free(job);
+	atomic_fetch_sub(&w->outstanding, 1);
+}
+
+bool change_attrs(const attr_change* c, const char* const* paths, int n,
+		  reporter* rep)
+{
+	walk w = { .c = c };
+	if (c->recursive && !(w.p = pool_create(0)))
+	{
+		report_error(rep, ".", "failed to start threads", errno);
+		return false;
+	}
+	atomic_init(&w.outstanding, 0);
+	atomic_init(&w.changed, 0);
+	atomic_init(&w.cancel, false);
+	pthread_mutex_init(&w.lock, NULL);
+	da_construct(w.failures, 16);
+
+	bool ok = true;
+	for (int i = 0; i < n && !report_stopped(rep); i++)
+	{
+		struct stat st;
+		if (fstatat(AT_FDCWD, paths[i], &st, 0) != 0)
+		{
+			report_error(rep, paths[i], "failed to stat", errno);
+			ok = false;
+			continue;
+		}
+		const char* what = NULL;
+		int err = change_entry(c, AT_FDCWD, paths[i], &st, true, &what);
+		if (err)
+		{
+			report_error(rep, paths[i], what, err);
+			ok = false;
+		}
+		if (i % ATTR_PROGRESS_STEP == ATTR_PROGRESS_STEP - 1)
+			report_progress(rep, paths[i], i + 1, n);
+		// the link was followed for its target, not into it
+		if (c->recursive && S_ISDIR(st.st_mode) &&
+		    fstatat(AT_FDCWD, paths[i], &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+		    S_ISDIR(st.st_mode))
+			submit_tree(&w, strdup(paths[i]));
+	}
+
+	// progress goes through the caller's thread only, the jobs just count
+	for (int waited = 0; atomic_load(&w.outstanding); waited++)
+	{
+		int ms = waited < POLL_MS ? 1 : POLL_MS;
+		struct timespec ts = { 0, ms * 1000000L };
+		nanosleep(&ts, NULL);
+		if (ms == POLL_MS || waited % POLL_MS == 0)
+			report_progress(rep, "changing",
+					atomic_load(&w.changed), 0);
+		if (report_stopped(rep)) atomic_store(&w.cancel, true);
+	}
+	if (w.p)
+	{
+		pool_wait(w.p);
+		pool_destroy(w.p);
+	}
+
+	for (int i = 0; i < w.failures.len; i++)
+	{
+		failure* f = &w.failures.items[i];
+		report_error(rep, f->path, f->what, f->err);
+		free(f->path);
+	}
+	if (w.dropped)
+	{
+		char* more = stralloc("%d more entries", w.dropped);
+		report_error(rep, more, "failed to change", w.dropped_err);
+		free(more);
+	}
+	if (w.failures.len) ok = false;
+	free(w.failures.items);
+	pthread_mutex_destroy(&w.lock);
+	return ok && !atomic_load(&w.cancel) && !report_stopped(rep);
+}
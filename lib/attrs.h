@@ -0,0 +1,64 @@
+#ifndef ATTRS_H_
+#define ATTRS_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+#include "report.h"
+
+// chmod, chown and touch on a set of paths, optionally on everything
+// below them too. trees are walked on a pool, a job per directory, with
+// every change made relative to the fd of the directory it is in.
+// entries that already have what is asked for aren't touched.
+
+#define MODE_MAX_CLAUSES 16
+// failures past this many are only counted
+#define ATTR_MAX_FAILURES 256
+
+// one clause of a symbolic mode, like u+x or go-w
+typedef struct
+{
+	// the bits the clause applies to, from the u, g, o and a before op
+	mode_t who;
+	char op;
+	mode_t perms;
+	// X, execute only for directories and what some already can execute
+	bool exec_if;
+} mode_clause;
+
+typedef struct
+{
+	// an octal mode is one '=' clause for all bits, none leaves the mode
+	int n_clauses;
+	mode_clause clauses[MODE_MAX_CLAUSES];
+	// -1 leaves the owner or the group as it is
+	uid_t uid;
+	gid_t gid;
+	// tv_nsec is UTIME_OMIT to leave the mtime as it is
+	struct timespec mtime;
+	// down into directories, symlinks are changed but not followed there
+	bool recursive;
+} attr_change;
+
+// a change that leaves everything as it is, for the parsers to fill in
+attr_change no_change(void);
+
+// octal (755) or symbolic (u+x,go-w, a=rX) like chmod, a symbolic mode
+// without u, g, o or a leaves the bits set in the umask alone
+bool parse_mode(attr_change* c, const char* spec, reporter* rep);
+
+// user, user:group or :group, by name or id
+bool parse_owner(attr_change* c, const char* spec, reporter* rep);
+
+// now, @seconds since the epoch or YYYY-MM-DD [HH:MM[:SS]] local time
+bool parse_mtime(attr_change* c, const char* spec, reporter* rep);
+
+// the mode c gives an entry that has mode
+mode_t changed_mode(const attr_change* c, mode_t mode);
+
+// applies c to paths (relative to the cwd), symlinks among them are
+// followed. false if anything failed or the reporter stopped it
+bool change_attrs(const attr_change* c, const char* const* paths, int n,
+		  reporter* rep);
+
+#endif
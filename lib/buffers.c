@@ -0,0 +1,166 @@
+#include "buffers.h"
+
+#include <unistd.h>
+
+#include "da.h"
+
+static void free_marked(buffer* b)
+{
+	for (int i = 0; i < b->marked.len; i++)
+		free(b->marked.items[i]);
+	free(b->marked.items);
+	b->marked.items = NULL;
+	b->marked.len = b->marked.cap = 0;
+	for (int i = 0; i < b->expanded.len; i++)
+		free(b->expanded.items[i]);
+	free(b->expanded.items);
+	b->expanded.items = NULL;
+	b->expanded.len = b->expanded.cap = 0;
+}
+
+static void free_buffer(buffer* b)
+{
+	free_dir(&b->dir);
+	free_marked(b);
+	free(b);
+}
+
+void init_buffers(buffer_list* bl)
+{
+	da_construct(bl->items, 4);
+	bl->clock = 0;
+	bl->budget = BUFFER_BUDGET;
+	bl->virtual = false;
+}
+
+void free_buffers(buffer_list* bl)
+{
+	for (int i = 0; i < bl->items.len; i++)
+		free_buffer(bl->items.items[i]);
+	free(bl->items.items);
+	bl->items.items = NULL;
+	bl->items.len = 0;
+}
+
+buffer* open_buffer(buffer_list* bl, const char* path, reporter* rep)
+{
+	buffer* b = calloc(1, sizeof(*b));
+	if (!b) alloc_failed();
+	b->dir.virtual = bl->virtual;
+	if (!change_dir(&b->dir, path, rep))
+	{
+		free_buffer(b);
+		return NULL;
+	}
+	b->used = ++bl->clock;
+	da_append(bl->items, b);
+	return b;
+}
+
+int buffer_index(const buffer_list* bl, const buffer* b)
+{
+	for (int i = 0; i < bl->items.len; i++)
+		if (bl->items.items[i] == b) return i;
+	return -1;
+}
+
+void close_buffer(buffer_list* bl, buffer* b)
+{
+	int i = buffer_index(bl, b);
+	if (i == -1) return;
+	memmove(bl->items.items + i, bl->items.items + i + 1,
+		sizeof(*bl->items.items) * (bl->items.len - i - 1));
+	bl->items.len--;
+	free_buffer(b);
+}
+
+static int compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void restore_marks(buffer* b)
+{
+	if (!b->marked.len) return;
+	qsort(b->marked.items, b->marked.len, sizeof(*b->marked.items),
+	      compare_names);
+	int len = count_entries(&b->dir);
+	for (int i = 0; i < len; i++)
+	{
+		const char* name = entry_name(&b->dir, i);
+		if (bsearch(&name, b->marked.items, b->marked.len,
+			    sizeof(*b->marked.items), compare_names))
+			mark_entry(&b->dir, i, true);
+	}
+}
+
+bool show_buffer(buffer_list* bl, buffer* b, reporter* rep)
+{
+	if (b->evicted)
+	{
+		// the cursor was on the listing with its expansions
+		int current = b->dir.current;
+		int scroll = b->dir.scroll;
+		if (!load_dir(&b->dir, b->dir.path, rep)) return false;
+		// before the marks, entries below them may be marked
+		expand_names(&b->dir, b->expanded.items, b->expanded.len, rep);
+		if (current + scroll < count_entries(&b->dir))
+		{
+			b->dir.current = current;
+			b->dir.scroll = scroll;
+		}
+		restore_marks(b);
+		free_marked(b);
+		b->evicted = false;
+	}
+	b->used = ++bl->clock;
+	if (chdir(b->dir.path) != 0)
+		report_error(rep, b->dir.path, "failed to enter", errno);
+	return true;
+}
+
+static void evict(buffer* b)
+{
+	selected_entries se = get_selected(&b->dir);
+	da_construct(b->marked, se.marked ? se.entries.len : 1);
+	for (int i = 0; se.marked && i < se.entries.len; i++)
+		da_append(b->marked, strdup(se.entries.items[i]));
+	free(se.entries.items);
+
+	da_construct(b->expanded, expanded_names(&b->dir, NULL));
+	b->expanded.len = expanded_names(&b->dir, b->expanded.items);
+	for (int i = 0; i < b->expanded.len; i++)
+		b->expanded.items[i] = strdup(b->expanded.items[i]);
+
+	unload_dir(&b->dir);
+	b->evicted = true;
+}
+
+void trim_buffers(buffer_list* bl, buffer* const* keep, int n)
+{
+	size_t total = 0;
+	for (int i = 0; i < bl->items.len; i++)
+	{
+		buffer* b = bl->items.items[i];
+		if (!b->evicted) total += dir_memory(&b->dir);
+	}
+
+	while (total > bl->budget)
+	{
+		buffer* oldest = NULL;
+		for (int i = 0; i < bl->items.len; i++)
+		{
+			buffer* b = bl->items.items[i];
+			// a listing of paths (a search, duplicates, an archive) or
+			// of stats can't be reloaded from its path
+			bool kept = b->evicted || b->dir.label || b->dir.detached;
+			for (int k = 0; k < n && !kept; k++)
+				kept = keep[k] == b;
+			if (kept) continue;
+			if (!oldest || b->used < oldest->used) oldest = b;
+		}
+		if (!oldest) return;
+		total -= dir_memory(&oldest->dir);
+		evict(oldest);
+	}
+}
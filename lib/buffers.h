@@ -0,0 +1,53 @@
+#ifndef BUFFERS_H_
+#define BUFFERS_H_
+
+#include <stdbool.h>
+#include "directory.h"
+
+// several directories kept open at once, like emacs buffers. switching
+// to a loaded buffer costs a chdir, idle ones are unloaded once the
+// listings together take more than the budget
+
+#define BUFFER_BUDGET (64 << 20)
+
+typedef struct
+{
+	directory dir;
+	// listing dropped to stay in budget, reloaded when shown again
+	bool evicted;
+	// marks of an evicted listing, by name
+	DA(char*) marked;
+	// and what was expanded in it, in the order of the listing
+	DA(char*) expanded;
+	unsigned long long used;
+} buffer;
+
+typedef struct
+{
+	DA(buffer*) items;
+	unsigned long long clock;
+	size_t budget;
+	// new buffers start out virtual
+	bool virtual;
+} buffer_list;
+
+void init_buffers(buffer_list* bl);
+
+void free_buffers(buffer_list* bl);
+
+// a new buffer at the end of the list with path loaded, NULL on failure
+buffer* open_buffer(buffer_list* bl, const char* path, reporter* rep);
+
+void close_buffer(buffer_list* bl, buffer* b);
+
+int buffer_index(const buffer_list* bl, const buffer* b);
+
+// reloads b if it was evicted and chdirs into it
+bool show_buffer(buffer_list* bl, buffer* b, reporter* rep);
+
+// evicts the least recently shown buffers until the loaded ones fit the
+// budget, the n buffers in keep (the ones on screen) and listings that
+// aren't of a directory's entries are never evicted
+void trim_buffers(buffer_list* bl, buffer* const* keep, int n);
+
+#endif
@@ -0,0 +1,484 @@
+#include "compare.h"
+
+#include <stdatomic.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pool.h"
+#include "fileops.h"
+
+#define POLL_MS 100
+
+typedef struct
+{
+	atomic_llong done;
+	atomic_int finished;
+	atomic_bool cancel;
+} progress;
+
+typedef struct
+{
+	char* path;
+	mode_t mode;
+	long long size;
+	// in seconds, the resolution every filesystem keeps
+	long long mtime;
+} node;
+
+typedef struct
+{
+	char* path;
+	const char* what;
+	int err;
+} failure;
+
+// one side of the comparison, scanned by a job of its own
+typedef struct
+{
+	const char* base;
+	bool recursive;
+	DA(node) nodes;
+	DA(failure) failures;
+	progress* pr;
+} side;
+
+typedef struct
+{
+	const node* left;
+	const node* right;
+	const char* right_base;
+	// filled in by comparing the contents
+	bool differ;
+	int err;
+	progress* pr;
+} pair;
+
+typedef DA(pair) pair_list;
+
+static void fail(side* s, const char* rel, const char* what, int err)
+{
+	failure f = { NULL, what, err };
+	if (!strcmp(s->base, "."))
+		f.path = strdup(rel ? rel : ".");
+	else if (rel)
+		f.path = stralloc("%s/%s", s->base, rel);
+	else
+		f.path = strdup(s->base);
+	da_append(s->failures, f);
+}
+
+static void scan(side* s, const char* rel)
+{
+	char* path = rel ? stralloc("%s/%s", s->base, rel) : strdup(s->base);
+	DIR* dir = opendir(path);
+	free(path);
+	if (!dir)
+	{
+		fail(s, rel, "failed to open", errno);
+		return;
+	}
+
+	struct dirent* dir_entry;
+	while ((dir_entry = readdir(dir)) && !atomic_load(&s->pr->cancel))
+	{
+		const char* name = dir_entry->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+		char* child = rel ? stralloc("%s/%s", rel, name) : strdup(name);
+		struct stat st;
+		if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		{
+			fail(s, child, "failed to stat", errno);
+			free(child);
+			continue;
+		}
+		node n = { child, st.st_mode, st.st_size, st.st_mtim.tv_sec };
+		da_append(s->nodes, n);
+		atomic_fetch_add(&s->pr->done, 1);
+		if (s->recursive && S_ISDIR(st.st_mode)) scan(s, child);
+	}
+	closedir(dir);
+}
+
+static int compare_nodes(const void* a, const void* b)
+{
+	return strcmp(((const node*)a)->path, ((const node*)b)->path);
+}
+
+static void scan_side(void* arg)
+{
+	side* s = arg;
+	scan(s, NULL);
+	// a prefix sorts first, so directories precede their entries
+	qsort(s->nodes.items, s->nodes.len, sizeof(*s->nodes.items),
+	      compare_nodes);
+	atomic_fetch_add(&s->pr->finished, 1);
+}
+
+static void compare_contents(void* arg)
+{
+	pair* p = arg;
+	char* right = stralloc("%s/%s", p->right_base, p->right->path);
+	int fds[2] = {
+		open(p->left->path, O_RDONLY | O_CLOEXEC),
+		open(right, O_RDONLY | O_CLOEXEC),
+	};
+	free(right);
+	// mapped at the size they have now, past the end of a file that got
+	// shorter since the scan is a SIGBUS
+	long long sizes[2] = { -1, -1 };
+	void* data[2] = { MAP_FAILED, MAP_FAILED };
+	for (int i = 0; i < 2; i++)
+	{
+		struct stat st;
+		if (fds[i] == -1 || fstat(fds[i], &st) != 0)
+		{
+			p->err = errno;
+			continue;
+		}
+		sizes[i] = st.st_size;
+		if (!sizes[i]) continue;
+		data[i] = mmap(NULL, sizes[i], PROT_READ, MAP_PRIVATE, fds[i], 0);
+		if (data[i] == MAP_FAILED)
+			p->err = errno;
+		else
+			madvise(data[i], sizes[i], MADV_SEQUENTIAL);
+	}
+	long long size = sizes[0];
+	if (!p->err && sizes[0] != sizes[1]) p->differ = true;
+
+	// in slices, so progress moves and a cancel is noticed
+	long long step = 1 << 24;
+	for (long long at = 0; !p->err && !p->differ && at < size; at += step)
+	{
+		if (atomic_load(&p->pr->cancel))
+		{
+			p->err = ECANCELED;
+			break;
+		}
+		long long n = size - at < step ? size - at : step;
+		p->differ = memcmp((char*)data[0] + at, (char*)data[1] + at, n);
+		atomic_fetch_add(&p->pr->done, n);
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (data[i] != MAP_FAILED) munmap(data[i], sizes[i]);
+		if (fds[i] != -1) close(fds[i]);
+	}
+	atomic_fetch_add(&p->pr->finished, 1);
+}
+
+// progress goes through the caller's thread only, the jobs just count
+static bool wait_jobs(progress* pr, int n, const char* what, long long total,
+		      reporter* rep)
+{
+	for (int waited = 0; atomic_load(&pr->finished) < n; waited++)
+	{
+		int ms = waited < POLL_MS ? 1 : POLL_MS;
+		struct timespec ts = { 0, ms * 1000000L };
+		nanosleep(&ts, NULL);
+		if (ms == POLL_MS || waited % POLL_MS == 0)
+			report_progress(rep, what, atomic_load(&pr->done), total);
+		if (report_stopped(rep)) atomic_store(&pr->cancel, true);
+	}
+	return !atomic_load(&pr->cancel);
+}
+
+static bool needs_contents(const pair* p)
+{
+	return p->left && p->right &&
+		S_ISREG(p->left->mode) && S_ISREG(p->right->mode) &&
+		p->left->size == p->right->size && p->left->size > 0;
+}
+
+static int pair_status(const pair* p, bool contents)
+{
+	if (!p->right) return DIFF_LEFT_ONLY;
+	if (!p->left) return DIFF_RIGHT_ONLY;
+	const node* l = p->left;
+	const node* r = p->right;
+	if ((l->mode & S_IFMT) != (r->mode & S_IFMT)) return DIFF_CHANGED;
+	if (S_ISDIR(l->mode)) return DIFF_SAME;
+
+	bool differ = l->size != r->size;
+	if (!differ && contents && S_ISREG(l->mode))
+		differ = p->differ || p->err;
+	else if (!differ)
+		differ = l->mtime != r->mtime;
+	if (!differ) return DIFF_SAME;
+	if (l->mtime > r->mtime) return DIFF_LEFT_NEWER;
+	if (l->mtime < r->mtime) return DIFF_RIGHT_NEWER;
+	return DIFF_CHANGED;
+}
+
+static void merge(pair_list* pairs, const side* left, const side* right)
+{
+	int i = 0, j = 0;
+	while (i < left->nodes.len || j < right->nodes.len)
+	{
+		const node* l = i < left->nodes.len ? &left->nodes.items[i] : NULL;
+		const node* r = j < right->nodes.len ? &right->nodes.items[j] : NULL;
+		int cmp = !l ? 1 : !r ? -1 : strcmp(l->path, r->path);
+		pair p = { cmp <= 0 ? l : NULL, cmp >= 0 ? r : NULL, right->base,
+			   false, 0, left->pr };
+		da_append(*pairs, p);
+		if (cmp <= 0) i++;
+		if (cmp >= 0) j++;
+	}
+}
+
+// compares the contents of same sized files on a pool, pairs are jobs
+static bool compare_pairs(pair_list* pairs, progress* pr, reporter* rep)
+{
+	atomic_store(&pr->done, 0);
+	atomic_store(&pr->finished, 0);
+	pool* p = pool_create(0);
+	if (!p)
+	{
+		report_error(rep, ".", "failed to start threads", errno);
+		return false;
+	}
+	int n = 0;
+	long long total = 0;
+	for (int i = 0; i < pairs->len; i++)
+	{
+		if (!needs_contents(&pairs->items[i])) continue;
+		pool_submit(p, compare_contents, &pairs->items[i]);
+		total += pairs->items[i].left->size;
+		n++;
+	}
+	bool ok = wait_jobs(pr, n, "comparing", total, rep);
+	pool_wait(p);
+	pool_destroy(p);
+
+	for (int i = 0; i < pairs->len; i++)
+	{
+		const pair* pa = &pairs->items[i];
+		if (pa->err && pa->err != ECANCELED)
+			report_error(rep, pa->left->path, "failed to compare",
+				     pa->err);
+	}
+	return ok;
+}
+
+static void free_side(side* s)
+{
+	for (int i = 0; i < s->nodes.len; i++)
+		free(s->nodes.items[i].path);
+	free(s->nodes.items);
+	for (int i = 0; i < s->failures.len; i++)
+		free(s->failures.items[i].path);
+	free(s->failures.items);
+}
+
+bool compare_dirs(comparison* cmp, const char* right, int flags,
+		  reporter* rep)
+{
+	*cmp = (comparison){0};
+	cmp->right = strdup(right);
+	cmp->flags = flags;
+	da_construct(cmp->paths, 64);
+	da_construct(cmp->status, 64);
+
+	progress pr;
+	atomic_init(&pr.done, 0);
+	atomic_init(&pr.finished, 0);
+	atomic_init(&pr.cancel, false);
+
+	bool recursive = flags & COMPARE_RECURSIVE;
+	side sides[2] = {
+		{ ".", recursive, { NULL, 0, 0 }, { NULL, 0, 0 }, &pr },
+		{ right, recursive, { NULL, 0, 0 }, { NULL, 0, 0 }, &pr },
+	};
+	for (int i = 0; i < 2; i++)
+	{
+		da_construct(sides[i].nodes, 256);
+		da_construct(sides[i].failures, 4);
+	}
+
+	// both sides are likely on different disks, or at least directories
+	pool* p = pool_create(2);
+	bool ok = p;
+	if (!p)
+		report_error(rep, ".", "failed to start threads", errno);
+	else
+	{
+		pool_submit(p, scan_side, &sides[0]);
+		pool_submit(p, scan_side, &sides[1]);
+		ok = wait_jobs(&pr, 2, "scanning", 0, rep);
+		pool_wait(p);
+		pool_destroy(p);
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		for (int k = 0; k < sides[i].failures.len; k++)
+		{
+			const failure* f = &sides[i].failures.items[k];
+			report_error(rep, f->path, f->what, f->err);
+		}
+	}
+
+	pair_list pairs;
+	da_construct(pairs, 256);
+	if (ok) merge(&pairs, &sides[0], &sides[1]);
+	if (ok && (flags & COMPARE_CONTENTS))
+		ok = compare_pairs(&pairs, &pr, rep);
+
+	for (int i = 0; ok && i < pairs.len; i++)
+	{
+		const pair* pa = &pairs.items[i];
+		int status = pair_status(pa, flags & COMPARE_CONTENTS);
+		const node* n = pa->left ? pa->left : pa->right;
+		da_append(cmp->paths, strdup(n->path));
+		da_append(cmp->status, status);
+		if (status == DIFF_LEFT_ONLY || status == DIFF_LEFT_NEWER ||
+		    status == DIFF_CHANGED)
+			cmp->differences++;
+	}
+
+	free(pairs.items);
+	free_side(&sides[0]);
+	free_side(&sides[1]);
+	return ok;
+}
+
+void free_comparison(comparison* cmp)
+{
+	for (int i = 0; i < cmp->paths.len; i++)
+		free(cmp->paths.items[i]);
+	free(cmp->paths.items);
+	free(cmp->status.items);
+	free(cmp->right);
+	*cmp = (comparison){0};
+}
+
+char* compare_path(const comparison* cmp, int i)
+{
+	if (cmp->status.items[i] == DIFF_RIGHT_ONLY)
+		return stralloc("%s/%s", cmp->right, cmp->paths.items[i]);
+	return strdup(cmp->paths.items[i]);
+}
+
+static bool copy_link(const char* src, const char* dst, reporter* rep)
+{
+	char target[PATH_MAX];
+	ssize_t len = readlink(src, target, sizeof(target) - 1);
+	if (len < 0)
+	{
+		report_error(rep, src, "failed to read link", errno);
+		return false;
+	}
+	target[len] = '\0';
+	if (symlink(target, dst) != 0)
+	{
+		report_error(rep, dst, "failed to create link", errno);
+		return false;
+	}
+	return true;
+}
+
+static bool sync_entry(const char* src, const char* dst, bool tree,
+		       reporter* rep);
+
+static bool sync_tree(const char* src, const char* dst, reporter* rep)
+{
+	DIR* dir = opendir(src);
+	if (!dir)
+	{
+		report_error(rep, src, "failed to open", errno);
+		return false;
+	}
+	bool ok = true;
+	struct dirent* dir_entry;
+	while ((dir_entry = readdir(dir)) && !report_stopped(rep))
+	{
+		const char* name = dir_entry->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+		char* from = stralloc("%s/%s", src, name);
+		char* to = stralloc("%s/%s", dst, name);
+		if (!sync_entry(from, to, true, rep)) ok = false;
+		free(from);
+		free(to);
+	}
+	closedir(dir);
+	return ok;
+}
+
+// copies src over dst, with tree a directory brings its entries along
+static bool sync_entry(const char* src, const char* dst, bool tree,
+		       reporter* rep)
+{
+	struct stat st, dst_st;
+	if (lstat(src, &st) != 0)
+	{
+		report_error(rep, src, "failed to stat", errno);
+		return false;
+	}
+	bool exists = lstat(dst, &dst_st) == 0;
+	if (exists && (dst_st.st_mode & S_IFMT) != (st.st_mode & S_IFMT))
+	{
+		report_error(rep, dst, "refusing to replace, type differs", EEXIST);
+		return false;
+	}
+	if (S_ISDIR(st.st_mode))
+	{
+		if (!exists && mkdir(dst, st.st_mode & 07777) != 0)
+		{
+			report_error(rep, dst, "failed to create", errno);
+			return false;
+		}
+		return tree ? sync_tree(src, dst, rep) : true;
+	}
+	if (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode))
+	{
+		report_error(rep, src, "not a regular file", EINVAL);
+		return false;
+	}
+
+	// made next to dst and renamed over it, dst is never half written
+	char* tmp = stralloc("%s.filed-sync", dst);
+	unlink(tmp);
+	bool ok = S_ISLNK(st.st_mode)
+		? copy_link(src, tmp, rep) : copy_file(src, tmp, rep);
+	if (ok)
+	{
+		// an mtime left behind would show up as a difference next time
+		if (S_ISREG(st.st_mode)) chmod(tmp, st.st_mode & 07777);
+		struct timespec times[2] = { st.st_atim, st.st_mtim };
+		utimensat(AT_FDCWD, tmp, times, AT_SYMLINK_NOFOLLOW);
+	}
+	if (ok && rename(tmp, dst) != 0)
+	{
+		report_error(rep, dst, "failed to replace", errno);
+		unlink(tmp);
+		ok = false;
+	}
+	free(tmp);
+	return ok;
+}
+
+bool sync_right(const comparison* cmp, reporter* rep)
+{
+	// a flat comparison lists a directory missing on the right but not
+	// what is inside
+	bool tree = !(cmp->flags & COMPARE_RECURSIVE);
+	bool ok = true;
+	for (int i = 0; i < cmp->paths.len && !report_stopped(rep); i++)
+	{
+		int status = cmp->status.items[i];
+		if (status != DIFF_LEFT_ONLY && status != DIFF_LEFT_NEWER &&
+		    status != DIFF_CHANGED)
+			continue;
+		const char* path = cmp->paths.items[i];
+		char* dst = stralloc("%s/%s", cmp->right, path);
+		if (!sync_entry(path, dst, tree, rep)) ok = false;
+		free(dst);
+		report_progress(rep, path, i + 1, cmp->paths.len);
+	}
+	return ok;
+}
@@ -0,0 +1,51 @@
+#ifndef COMPARE_H_
+#define COMPARE_H_
+
+#include <stdbool.h>
+#include "da.h"
+#include "report.h"
+
+// the cwd (left) against another directory (right), by name, size and
+// mtime or by contents. both sides are scanned at the same time.
+
+#define DIFF_SAME 0
+#define DIFF_LEFT_ONLY 1
+#define DIFF_RIGHT_ONLY 2
+#define DIFF_LEFT_NEWER 3
+#define DIFF_RIGHT_NEWER 4
+// differ with the same mtime, or a file against a directory
+#define DIFF_CHANGED 5
+
+// colors of a comparison listing, one per status
+#define ECOLOR_DIFF 9
+
+#define COMPARE_RECURSIVE 1
+#define COMPARE_CONTENTS 2
+
+typedef struct
+{
+	char* right;
+	int flags;
+	// relative to both sides, sorted so a directory precedes its entries
+	DA(char*) paths;
+	DA(int) status;
+	// entries a sync would copy over
+	int differences;
+} comparison;
+
+// false if it was stopped through the reporter
+bool compare_dirs(comparison* cmp, const char* right, int flags,
+		  reporter* rep);
+
+void free_comparison(comparison* cmp);
+
+// path i as seen from the cwd, entries only on the right live there.
+// the string is allocated
+char* compare_path(const comparison* cmp, int i);
+
+// makes the right side match the left for every entry that is only on
+// the left, newer there or changed. entries newer on the right are left
+// alone
+bool sync_right(const comparison* cmp, reporter* rep);
+
+#endif
@@ -0,0 +1,209 @@
+#include "complete.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "da.h"
+#include "directory.h"
+#include "statq.h"
+
+typedef struct
+{
+	char* path;
+	struct stat st;
+	DA(char) names;
+	// offsets into names, sorted bytewise so a prefix is one range
+	DA(unsigned) sorted;
+	unsigned long long used;
+} name_index;
+
+static name_index cache[COMPLETE_CACHED];
+static unsigned long long index_clock;
+
+static void free_index(name_index* ix)
+{
+	free(ix->path);
+	free(ix->names.items);
+	free(ix->sorted.items);
+	*ix = (name_index){0};
+}
+
+void complete_flush(void)
+{
+	for (int i = 0; i < COMPLETE_CACHED; i++)
+		free_index(&cache[i]);
+}
+
+static int compare_offsets(const void* a, const void* b, void* arg)
+{
+	const char* names = arg;
+	return strcmp(names + *(const unsigned*)a, names + *(const unsigned*)b);
+}
+
+static bool read_names(name_index* ix)
+{
+	DIR* d = opendir(ix->path);
+	if (!d) return false;
+	da_construct(ix->names, 4096);
+	da_construct(ix->sorted, 64);
+
+	struct dirent* dir_entry;
+	while ((dir_entry = readdir(d)))
+	{
+		const char* name = dir_entry->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+		int len = strlen(name) + 1;
+		da_reserve(ix->names, len);
+		memcpy(ix->names.items + ix->names.len, name, len);
+		da_append(ix->sorted, (unsigned)ix->names.len);
+		ix->names.len += len;
+	}
+	closedir(d);
+
+	qsort_r(ix->sorted.items, ix->sorted.len, sizeof(*ix->sorted.items),
+		compare_offsets, ix->names.items);
+	return true;
+}
+
+// the index of dir, rebuilt if the directory changed since
+static name_index* get_index(const char* dir)
+{
+	struct stat st;
+	// a hung mount would block realpath and opendir
+	if (!stat_timed(AT_FDCWD, dir, &st, STAT_DEADLINE_MS)) return NULL;
+	char* path = realpath(dir, NULL);
+	if (!path) return NULL;
+
+	name_index* slot = &cache[0];
+	for (int i = 0; i < COMPLETE_CACHED; i++)
+	{
+		name_index* ix = &cache[i];
+		if (ix->path && !strcmp(ix->path, path))
+		{
+			slot = ix;
+			break;
+		}
+		if (ix->used < slot->used) slot = ix;
+	}
+	slot->used = ++index_clock;
+
+	if (slot->path && !strcmp(slot->path, path) &&
+	    slot->st.st_ino == st.st_ino &&
+	    slot->st.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+	    slot->st.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+	{
+		free(path);
+		return slot;
+	}
+
+	free_index(slot);
+	slot->path = path;
+	slot->st = st;
+	slot->used = index_clock;
+	if (!read_names(slot))
+	{
+		free_index(slot);
+		return NULL;
+	}
+	return slot;
+}
+
+static const char* index_name(const name_index* ix, int i)
+{
+	return ix->names.items + ix->sorted.items[i];
+}
+
+// first name in ix not sorting before prefix, or after all names
+// starting with it when past is set
+static int search(const name_index* ix, const char* prefix, bool past)
+{
+	int plen = strlen(prefix);
+	int lo = 0, hi = ix->sorted.len;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		const char* name = index_name(ix, mid);
+		int cmp = past ? strncmp(name, prefix, plen) : strcmp(name, prefix);
+		if (cmp < 0 || (past && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+completion complete_path(const char* input)
+{
+	completion c = {0};
+	c.text = strdup(input);
+
+	const char* slash = strrchr(input, '/');
+	const char* base = slash ? slash + 1 : input;
+	int dir_len = base - input;
+	char* dir = dir_len ? strndup(input, dir_len) : strdup(".");
+	char* expanded = expand_home(dir);
+	free(dir);
+
+	name_index* ix = get_index(expanded);
+	if (!ix)
+	{
+		free(expanded);
+		return c;
+	}
+
+	int first = search(ix, base, false);
+	int last = search(ix, base, true);
+	// dotfiles only when asked for, like a shell
+	int dots_first = last, dots_last = last;
+	if (base[0] != '.')
+	{
+		dots_first = search(ix, ".", false);
+		dots_last = search(ix, ".", true);
+		if (dots_first < first) dots_first = first;
+		if (dots_last > last) dots_last = last;
+		if (dots_last < dots_first) dots_last = dots_first;
+	}
+	c.matches = last - first - (dots_last - dots_first);
+	for (int i = first; i < last && c.n_shown < COMPLETE_SHOWN; i++)
+	{
+		if (i == dots_first) i = dots_last;
+		if (i < last) c.shown[c.n_shown++] = index_name(ix, i);
+	}
+	if (!c.matches)
+	{
+		free(expanded);
+		return c;
+	}
+
+	// sorted, so what the matches have in common is what the ends share
+	int lowest = first < dots_first ? first : dots_last;
+	int highest = last > dots_last ? last - 1 : dots_first - 1;
+	const char* a = index_name(ix, lowest);
+	const char* b = index_name(ix, highest);
+	int common = 0;
+	while (a[common] && a[common] == b[common])
+		common++;
+
+	free(c.text);
+	c.text = stralloc("%.*s%.*s", dir_len, input, common, a);
+	if (c.matches == 1)
+	{
+		char* full = stralloc("%s/%s", expanded, a);
+		if (is_dir_timed(full))
+		{
+			char* with_slash = stralloc("%s/", c.text);
+			free(c.text);
+			c.text = with_slash;
+		}
+		free(full);
+	}
+	free(expanded);
+	return c;
+}
+
+void free_completion(completion* c)
+{
+	free(c->text);
+	c->text = NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef COMPLETE_H_
+#define COMPLETE_H_
+
+#include <stdbool.h>
+
+// path completion for typed input. the names of each directory completed
+// in are read once into a sorted index, which is reused for as long as
+// the directory's mtime doesn't change
+
+// directories whose index is kept around
+#define COMPLETE_CACHED 16
+// matches handed back for display
+#define COMPLETE_SHOWN 8
+
+typedef struct
+{
+	// the input extended by what all matches have in common, a trailing
+	// slash is added when a single directory matched
+	char* text;
+	int matches;
+	// the first few matching names, valid until the next call
+	const char* shown[COMPLETE_SHOWN];
+	int n_shown;
+} completion;
+
+// input is relative to the process cwd, ~ is expanded for the lookup
+// but kept in the text
+completion complete_path(const char* input);
+
+void free_completion(completion* c);
+
+// drops every cached index
+void complete_flush(void);
+
+#endif
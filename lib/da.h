@@ -16,7 +16,27 @@ static inline void msg(const char* fmt, ...)
 	va_end(args);
 }
 
-#define fatal(...) do { msg (__VA_ARGS__); exit(0); } while (0)
+// the library never exits the process it is part of. what it can't go
+// on without gives up with abort(), anything sized by what it reads is
+// checked and reported instead
+#define alloc_failed() do { msg("out of memory\n"); abort(); } while (0)
+
+__attribute__((format(printf, 1, 2)))
+__attribute__((malloc))
+static inline char* stralloc(const char* fmt, ...)
+{
+	va_list args, copy;
+	va_start(args, fmt);
+	va_copy(copy, args);
+
+	size_t sz = vsnprintf(0, 0, fmt, args);
+	char* buf = malloc(sz + 1);
+	if (!buf) alloc_failed();
+	vsnprintf(buf, sz + 1, fmt, copy);
+	va_end(args);
+	va_end(copy);
+	return buf;
+}
 
 #define DA(contents) struct { \
 	contents* items; \
@@ -28,17 +48,26 @@ static inline void msg(const char* fmt, ...)
 do { \
 	if ((list).len >= (list).cap) { \
 		(list).cap *= 2; \
-		(list).items = realloc((list).items, sizeof(*(list).items) * (list).cap); } \
+		(list).items = realloc((list).items, sizeof(*(list).items) * (list).cap); \
+		if (!(list).items) alloc_failed(); } \
 	(list).items[(list).len] = item; \
 	(list).len++; \
 } while(0)
 
+#define da_reserve(list, n) \
+do { \
+	while ((list).len + (n) > (list).cap) { \
+		(list).cap *= 2; \
+		(list).items = realloc((list).items, sizeof(*(list).items) * (list).cap); } \
+	if (!(list).items) alloc_failed(); \
+} while(0)
+
 #define da_construct(list, sz) \
 do { \
 	(list).cap = sz ? sz : 10; \
 	(list).len = 0; \
 	(list).items = malloc(sizeof(*(list).items) * (list).cap); \
-	if(!(list).items) fatal("failed to malloc: %s", strerror(errno)); \
+	if (!(list).items) alloc_failed(); \
 } while(0)
 
 #define da_swap(list, type, a, b) \
@@ -52,17 +81,4 @@ do { \
 #define strcasecmp stricmp
 #endif
 
-#define da_sort_entry(list) \
-do { \
-	for (int i = 0; i < (list).len - 1; i++) \
-	{ \
-		for (int j = 0; j < (list).len - 1 - i; j++) \
-		{ \
-			if (strcasecmp((list).items[j].name, (list).items[j+1].name) > 0 ) \
-				da_swap(list, entry, j, j + 1); \
-		} \
-	} \
-\
-} while (0);
-
 #endif
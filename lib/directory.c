@@ -0,0 +1,1205 @@
+#include "directory.h"
+
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+#include <ctype.h>
+
+#include "da.h"
+#include "width.h"
+
+#define KILOBYTE 1024.0f
+#define MEGABYTE (KILOBYTE*KILOBYTE)
+#define GIGABYTE (MEGABYTE*KILOBYTE)
+#define TERABYTE (GIGABYTE*KILOBYTE)
+
+#define LOAD_PROGRESS_STEP 65536
+#define ID_BUF_SIZE 4096
+
+static unsigned intlen(int n)
+{
+	int digits = 0;
+	if (n < 0)
+	{
+		n = -n;
+		digits++;
+	}
+	while (n)
+	{
+		n /= 10;
+		digits++;
+	}
+	return digits;
+}
+
+static void free_entry(entry e)
+{
+	free(e.owner);
+	free(e.group);
+	free(e.name);
+	free(e.perms);
+	free(e.date);
+	free(e.link);
+	free(e.note);
+	if (e.pending) stat_release(e.pending);
+}
+
+static void free_entries(directory* dir)
+{
+	for (int i = 0; i < dir->entries.len; i++)
+		free_entry(dir->entries.items[i]);
+	free(dir->entries.items);
+	dir->entries.items = NULL;
+	dir->entries.len = 0;
+	dir->entries.cap = 0;
+	dir->pending = 0;
+}
+
+static void free_index(directory* dir)
+{
+	free(dir->names.items);
+	free(dir->index.items);
+	free(dir->marks);
+	dir->names.items = NULL;
+	dir->index.items = NULL;
+	dir->marks = NULL;
+	dir->names.len = dir->index.len = 0;
+	dir->names.cap = dir->index.cap = 0;
+	dir->virtualized = false;
+	dir->window = 0;
+}
+
+static void free_collapsed(directory* dir)
+{
+	for (int i = 0; i < dir->collapsed.len; i++)
+	{
+		subtree* st = &dir->collapsed.items[i];
+		for (int k = 0; k < st->entries.len; k++)
+			free_entry(st->entries.items[k]);
+		free(st->entries.items);
+		free(st->path);
+	}
+	free(dir->collapsed.items);
+	dir->collapsed.items = NULL;
+	dir->collapsed.len = 0;
+	dir->collapsed.cap = 0;
+}
+
+void unload_dir(directory* dir)
+{
+	free_entries(dir);
+	free_index(dir);
+	free_collapsed(dir);
+}
+
+static size_t str_memory(const char* s)
+{
+	return s ? strlen(s) + 1 : 0;
+}
+
+static size_t entry_memory(const entry* e)
+{
+	return sizeof(*e) + str_memory(e->perms) + str_memory(e->owner) +
+		str_memory(e->group) + str_memory(e->date) +
+		str_memory(e->name) + str_memory(e->link) +
+		str_memory(e->note);
+}
+
+size_t dir_memory(const directory* dir)
+{
+	size_t total = sizeof(*dir->entries.items) *
+		(dir->entries.cap - dir->entries.len);
+	for (int i = 0; i < dir->entries.len; i++)
+		total += entry_memory(&dir->entries.items[i]);
+	for (int i = 0; i < dir->collapsed.len; i++)
+	{
+		const subtree* st = &dir->collapsed.items[i];
+		total += str_memory(st->path);
+		for (int k = 0; k < st->entries.len; k++)
+			total += entry_memory(&st->entries.items[k]);
+	}
+	total += dir->names.cap;
+	total += sizeof(*dir->index.items) * dir->index.cap;
+	if (dir->marks) total += dir->index.len / 8 + 1;
+	return total;
+}
+
+void free_dir(directory* dir)
+{
+	free_entries(dir);
+	free_index(dir);
+	free_collapsed(dir);
+	free(dir->path);
+	free(dir->label);
+	dir->path = NULL;
+	dir->label = NULL;
+}
+
+static char* id_name(const char* name, unsigned id)
+{
+	if (name) return strdup(name);
+	return stralloc("%u", id);
+}
+
+// metadata that hasn't arrived (or never will) is shown as '?'
+static void fill_unknown(entry* e)
+{
+	e->unknown = true;
+	e->perms = strdup("??????????");
+	e->owner = strdup("?");
+	e->group = strdup("?");
+	e->date = strdup("?");
+	e->sz_unit = '?';
+	e->color = ECOLOR_UNKNOWN;
+}
+
+static void fill_entry(entry* e, const struct stat* st, const char* link)
+{
+	e->unknown = false;
+	e->n_links = st->st_nlink;
+	if (st->st_size < KILOBYTE)
+	{
+		e->sz_unit = 'B';
+		e->sz_amount = st->st_size;
+	}
+	else if (st->st_size < MEGABYTE)
+	{
+		e->sz_unit = 'K';
+		e->sz_amount = st->st_size / KILOBYTE;
+	}
+	else if (st->st_size < GIGABYTE)
+	{
+		e->sz_unit = 'M';
+		e->sz_amount = st->st_size / MEGABYTE;
+	}
+	else if (st->st_size < TERABYTE)
+	{
+		e->sz_unit = 'G';
+		e->sz_amount = st->st_size / GIGABYTE;
+	}
+	else
+	{
+		e->sz_unit = 'T';
+		e->sz_amount = st->st_size / TERABYTE;
+	}
+	// ids without a passwd/group entry are shown numerically, like ls.
+	// listings can be loaded on several threads at once, hence the _r
+	char buf[ID_BUF_SIZE];
+	struct passwd pw;
+	struct passwd* owner = NULL;
+	getpwuid_r(st->st_uid, &pw, buf, sizeof(buf), &owner);
+	e->owner = id_name(owner ? owner->pw_name : NULL, st->st_uid);
+	struct group gr;
+	struct group* grp = NULL;
+	getgrgid_r(st->st_gid, &gr, buf, sizeof(buf), &grp);
+	e->group = id_name(grp ? grp->gr_name : NULL, st->st_gid);
+
+	e->color = ECOLOR_FILE;
+	mode_t m = st->st_mode;
+	e->perms = strdup("----------");
+	if (S_ISDIR(m)) e->perms[0] = 'd';
+	else if (S_ISLNK(m)) e->perms[0] = 'l';
+	else if (S_ISCHR(m)) e->perms[0] = 'c';
+	else if (S_ISBLK(m)) e->perms[0] = 'b';
+	else if (S_ISSOCK(m)) e->perms[0] = 's';
+	else if (S_ISFIFO(m)) e->perms[0] = 'p';
+
+	if (m & S_IRUSR) e->perms[1] = 'r';
+	if (m & S_IWUSR) e->perms[2] = 'w';
+	if (m & S_IXUSR) e->perms[3] = 'x';
+	if (m & S_IRGRP) e->perms[4] = 'r';
+	if (m & S_IWGRP) e->perms[5] = 'w';
+	if (m & S_IXGRP) e->perms[6] = 'x';
+	if (m & S_IROTH) e->perms[7] = 'r';
+	if (m & S_IWOTH) e->perms[8] = 'w';
+	if (m & S_IXOTH) e->perms[9] = 'x';
+
+	e->date = malloc(20);
+	struct tm mod_time;
+	localtime_r(&st->st_mtime, &mod_time);
+	strftime(e->date, 20, "%b %d %H:%M", &mod_time);
+
+	if (S_ISLNK(m))
+		e->link = strdup(link ? link : "");
+
+	if(m & S_IXUSR) e->color = ECOLOR_EXE;
+	if(m & S_IXGRP) e->color = ECOLOR_EXE;
+	if(m & S_IXOTH) e->color = ECOLOR_EXE;
+	if(S_ISDIR(m)) e->color = ECOLOR_DIR;
+	if(S_ISLNK(m)) e->color = ECOLOR_LNK;
+}
+
+// swaps the placeholder of an entry for the metadata of its batch slot
+static void free_metadata(entry* e)
+{
+	free(e->perms);
+	free(e->owner);
+	free(e->group);
+	free(e->date);
+	free(e->link);
+	e->perms = e->owner = e->group = e->date = e->link = NULL;
+}
+
+static void fill_from_result(entry* e, const stat_result* r, reporter* rep)
+{
+	free_metadata(e);
+
+	if (r->err)
+	{
+		report_error(rep, e->name, "failed to stat", r->err);
+		fill_unknown(e);
+	}
+	else
+		fill_entry(e, &r->st, r->link);
+}
+
+// also works out the width of the name column of e
+static void update_longest(directory* dir, entry* e)
+{
+	if (intlen(e->n_links) > dir->longest_links)
+		dir->longest_links = intlen(e->n_links);
+
+	unsigned owner_width = display_width(e->owner);
+	if (owner_width > dir->longest_owner)
+		dir->longest_owner = owner_width;
+
+	unsigned group_width = display_width(e->group);
+	if (group_width > dir->longest_group)
+		dir->longest_group = group_width;
+
+	// month names are the locale's
+	unsigned date_width = display_width(e->date);
+	if (date_width > dir->longest_date)
+		dir->longest_date = date_width;
+
+	e->width = SUBTREE_INDENT * e->depth + display_width(shown_name(e));
+	if (e->link) e->width += strlen(" -> ") + display_width(e->link);
+	if (e->width > dir->longest_name)
+		dir->longest_name = e->width;
+}
+
+static bool read_index(DIR* d, directory* dir, reporter* rep)
+{
+	struct dirent* dir_entry;
+	errno = 0;
+	while ((dir_entry = readdir(d)))
+	{
+		int len = strlen(dir_entry->d_name) + 1;
+		if (dir->names.len > INT_MAX - len ||
+		    (dir->limit && dir->index.len >= dir->limit))
+		{
+			report_error(rep, dir->path, "too many entries", EFBIG);
+			return false;
+		}
+		da_reserve(dir->names, len);
+		memcpy(dir->names.items + dir->names.len, dir_entry->d_name, len);
+		index_entry ie = { dir_entry->d_ino, dir->names.len, dir_entry->d_type };
+		da_append(dir->index, ie);
+		dir->names.len += len;
+
+		if (dir->index.len % LOAD_PROGRESS_STEP == 0)
+			report_progress(rep, dir->path, dir->index.len, 0);
+		if (report_stopped(rep)) return false;
+		errno = 0;
+	}
+	if (errno)
+	{
+		report_error(rep, dir->path, "failed to read", errno);
+		return false;
+	}
+	return true;
+}
+
+// stats run STAT_WINDOW batches ahead of the entries being filled in
+#define STAT_WINDOW 16
+
+// appends an entry per name to dir. with keep_missing, names that vanished
+// since readdir stay as unknown so entries line up with the index
+static void stat_entries(directory* dir, int fd, char* const* names, int count,
+			 bool keep_missing, reporter* rep)
+{
+	int batches = (count + STAT_BATCH - 1) / STAT_BATCH;
+	stat_batch** inflight = calloc(batches ? batches : 1, sizeof(*inflight));
+	if (!inflight) alloc_failed();
+	int submitted = 0;
+	// once a batch was never even started the pool is clogged with hung
+	// calls, waiting on the rest would only stack up the deadlines
+	bool clogged = false;
+	// slot s of b holds the metadata of entry base + s
+	stat_batch* b = NULL;
+	int base = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		int batch = i / STAT_BATCH;
+		int batch_end = (batch + 1) * STAT_BATCH;
+		if (batch_end > count) batch_end = count;
+		bool last_slot = i == batch_end - 1;
+		while (submitted < batches && submitted <= batch + STAT_WINDOW)
+		{
+			int first = submitted * STAT_BATCH;
+			inflight[submitted] = stat_submit(fd, names + first,
+							  count - first);
+			submitted++;
+		}
+		if (i % STAT_BATCH == 0)
+		{
+			b = inflight[batch];
+			base = i;
+		}
+		int slot = i - base;
+
+		entry e = {0};
+		if (stat_wait(b, slot, clogged ? 0 : STAT_DEADLINE_MS))
+		{
+			const stat_result* r = stat_get(b, slot);
+			if (r->err == ENOENT && !keep_missing)
+			{
+				// removed since readdir
+				goto next;
+			}
+			e.name = strdup(names[i]);
+			fill_from_result(&e, r, rep);
+		}
+		else
+		{
+			bool started = stat_started(b);
+			if (!started) clogged = true;
+			e.name = strdup(names[i]);
+			fill_unknown(&e);
+			stat_retain(b);
+			e.pending = b;
+			e.slot = slot;
+			dir->pending++;
+
+			// the rest of the batch shouldn't queue up behind the hung call
+			if (started && !last_slot)
+			{
+				stat_batch* tail = stat_submit(fd, names + i + 1,
+							       batch_end - i - 1);
+				stat_release(b);
+				b = tail;
+				base = i + 1;
+			}
+		}
+		update_longest(dir, &e);
+		da_append(dir->entries, e);
+	next:
+		if (last_slot)
+			stat_release(b);
+		if (report_stopped(rep))
+		{
+			if (!last_slot) stat_release(b);
+			for (int j = batch + 1; j < submitted; j++)
+				stat_release(inflight[j]);
+			break;
+		}
+	}
+	free(inflight);
+}
+
+static char** index_names(directory* dir, int first, int count)
+{
+	char** names = malloc(sizeof(*names) * (count ? count : 1));
+	if (!names) alloc_failed();
+	for (int i = 0; i < count; i++)
+		names[i] = dir->names.items + dir->index.items[first + i].name;
+	return names;
+}
+
+static int compare_index(const void* a, const void* b, void* arg)
+{
+	const char* names = arg;
+	const char* x = names + ((const index_entry*)a)->name;
+	const char* y = names + ((const index_entry*)b)->name;
+	int cmp = strcasecmp(x, y);
+	if (cmp) return cmp;
+	return strcmp(x, y);
+}
+
+static int compare_position(const void* a, const void* b, void* arg)
+{
+	const directory* dir = arg;
+	const index_entry* x = &dir->index.items[*(const int*)a];
+	const index_entry* y = &dir->index.items[*(const int*)b];
+	return compare_index(x, y, dir->names.items);
+}
+
+static void load_window(directory* dir, int first)
+{
+	int len = dir->index.len;
+	if (first > len - VIRTUAL_WINDOW) first = len - VIRTUAL_WINDOW;
+	if (first < 0) first = 0;
+	int count = len - first < VIRTUAL_WINDOW ? len - first : VIRTUAL_WINDOW;
+
+	free_entries(dir);
+	da_construct(dir->entries, count);
+	dir->window = first;
+
+	char** names = index_names(dir, first, count);
+	int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	stat_entries(dir, fd, names, count, true, NULL);
+	if (fd != -1) close(fd);
+	free(names);
+
+	for (int i = 0; i < dir->entries.len; i++)
+	{
+		int bit = first + i;
+		dir->entries.items[i].marked = dir->marks[bit / 8] & (1 << bit % 8);
+	}
+}
+
+static atomic_ulong generations;
+
+static unsigned long next_generation(void)
+{
+	return atomic_fetch_add(&generations, 1) + 1;
+}
+
+// swaps the listing of dir for next, keeping the view state
+static void replace_dir(directory* dir, directory* next)
+{
+	next->generation = next_generation();
+	next->current = dir->current;
+	next->scroll = dir->scroll;
+	next->soft = dir->soft;
+	next->virtual = dir->virtual;
+	next->limit = dir->limit;
+	if (next->current + next->scroll >= count_entries(next))
+	{
+		next->scroll = 0;
+		next->current = 0;
+	}
+	if (next->virtualized)
+		load_window(next, next->scroll);
+	free_dir(dir);
+	*dir = *next;
+}
+
+static void expand_like(directory* next, const directory* dir,
+			reporter* rep);
+
+bool load_dir(directory* dir, const char* path, reporter* rep)
+{
+	// a hung mount would block realpath and opendir below
+	struct stat st;
+	if (!stat_timed(AT_FDCWD, path, &st, STAT_DEADLINE_MS))
+	{
+		report_error(rep, path, errno == ETIMEDOUT
+			     ? "not responding" : "failed to stat", errno);
+		return false;
+	}
+
+	directory next = {0};
+	next.path = realpath(path, 0);
+	if (!next.path)
+	{
+		report_error(rep, path, "failed to resolve", errno);
+		return false;
+	}
+
+	DIR* d = opendir(next.path);
+	if (!d)
+	{
+		report_error(rep, next.path, "failed to open", errno);
+		free(next.path);
+		return false;
+	}
+
+	next.limit = dir->limit;
+	next.longest_group = 1;
+	next.longest_owner = 1;
+	next.longest_links = 1;
+	next.longest_date = 1;
+	next.longest_name = 1;
+
+	da_construct(next.names, 4096);
+	da_construct(next.index, 64);
+	bool ok = read_index(d, &next, rep);
+	int len = next.index.len;
+	next.virtualized = dir->virtual || len >= VIRTUAL_THRESHOLD;
+
+	if (ok && next.virtualized)
+	{
+		qsort_r(next.index.items, len, sizeof(*next.index.items),
+			compare_index, next.names.items);
+		next.marks = calloc(len / 8 + 1, 1);
+		if (!next.marks) alloc_failed();
+		for (int i = 0; i < len; i++)
+		{
+			unsigned name_width = display_width(entry_name(&next, i));
+			if (name_width > next.longest_name)
+				next.longest_name = name_width;
+		}
+	}
+	else if (ok)
+	{
+		da_construct(next.entries, len);
+		char** names = index_names(&next, 0, len);
+		stat_entries(&next, dirfd(d), names, len, false, rep);
+		free(names);
+		free_index(&next);
+		sort_entries(&next);
+	}
+	closedir(d);
+
+	if (!ok || report_stopped(rep))
+	{
+		free_dir(&next);
+		return false;
+	}
+	if (!next.virtualized && !dir->virtualized && !dir->label &&
+	    dir->path && !strcmp(dir->path, next.path))
+		expand_like(&next, dir, rep);
+	replace_dir(dir, &next);
+	return true;
+}
+
+// a labelled listing in the cwd, for entries that aren't its own
+static bool start_listing(directory* next, const char* label, int n,
+			  reporter* rep)
+{
+	*next = (directory){0};
+	next->path = getcwd(NULL, 0);
+	if (!next->path)
+	{
+		report_error(rep, ".", "failed to resolve", errno);
+		return false;
+	}
+	next->label = strdup(label);
+	next->longest_group = 1;
+	next->longest_owner = 1;
+	next->longest_links = 1;
+	next->longest_date = 1;
+	next->longest_name = 1;
+	da_construct(next->entries, n);
+	return true;
+}
+
+bool list_paths(directory* dir, const char* label,
+		char* const* paths, int n, reporter* rep)
+{
+	directory next;
+	if (!start_listing(&next, label, n, rep)) return false;
+	stat_entries(&next, AT_FDCWD, paths, n, true, rep);
+	if (report_stopped(rep))
+	{
+		free_dir(&next);
+		return false;
+	}
+	replace_dir(dir, &next);
+	dir->current = 0;
+	dir->scroll = 0;
+	return true;
+}
+
+void append_paths(directory* dir, char* const* paths, char* const* notes,
+		  int n, reporter* rep)
+{
+	int first = dir->entries.len;
+	stat_entries(dir, AT_FDCWD, paths, n, true, rep);
+	for (int i = 0; notes && i < n && first + i < dir->entries.len; i++)
+		if (notes[i]) dir->entries.items[first + i].note = strdup(notes[i]);
+}
+
+bool list_stats(directory* dir, const char* label, char* const* names,
+		const struct stat* st, char* const* links, int n,
+		reporter* rep)
+{
+	directory next;
+	if (!start_listing(&next, label, n, rep)) return false;
+	next.detached = true;
+	for (int i = 0; i < n; i++)
+	{
+		entry e = {0};
+		e.name = strdup(names[i]);
+		fill_entry(&e, &st[i], links[i]);
+		update_longest(&next, &e);
+		da_append(next.entries, e);
+	}
+	sort_entries(&next);
+	replace_dir(dir, &next);
+	dir->current = 0;
+	dir->scroll = 0;
+	return true;
+}
+
+// the index in name order again, marks moving along with their entries
+static void resort_index(directory* dir)
+{
+	int len = dir->index.len;
+	index_entry* sorted = malloc(sizeof(*sorted) * (len ? len : 1));
+	unsigned char* marks = calloc(len / 8 + 1, 1);
+	int* order = malloc(sizeof(*order) * (len ? len : 1));
+	if (!sorted || !marks || !order) alloc_failed();
+	for (int i = 0; i < len; i++)
+		order[i] = i;
+	qsort_r(order, len, sizeof(*order), compare_position, dir);
+	for (int i = 0; i < len; i++)
+	{
+		int from = order[i];
+		sorted[i] = dir->index.items[from];
+		if (dir->marks[from / 8] & (1 << from % 8))
+			marks[i / 8] |= 1 << i % 8;
+	}
+	free(dir->index.items);
+	free(dir->marks);
+	free(order);
+	dir->index.items = sorted;
+	dir->index.cap = len ? len : 1;
+	dir->marks = marks;
+}
+
+// name with from at its start swapped for to, NULL if it isn't below from
+static char* moved_path(const char* name, const char* from, const char* to)
+{
+	size_t len = strlen(from);
+	if (strncmp(name, from, len) || (name[len] && name[len] != '/'))
+		return NULL;
+	return stralloc("%s%s", to, name + len);
+}
+
+// the entries expanded below from, shown or collapsed, follow it to to.
+// the entry at renamed is the one that was from
+static void rename_below(directory* dir, int renamed, const char* from,
+			 const char* to)
+{
+	for (int i = 0; i < dir->entries.len; i++)
+	{
+		entry* e = &dir->entries.items[i];
+		char* moved = e->depth && i != renamed
+			? moved_path(e->name, from, to) : NULL;
+		if (!moved) continue;
+		free(e->name);
+		e->name = moved;
+	}
+	for (int i = 0; i < dir->collapsed.len; i++)
+	{
+		subtree* st = &dir->collapsed.items[i];
+		char* moved = moved_path(st->path, from, to);
+		if (!moved) continue;
+		free(st->path);
+		st->path = moved;
+		for (int k = 0; k < st->entries.len; k++)
+		{
+			entry* e = &st->entries.items[k];
+			moved = moved_path(e->name, from, to);
+			free(e->name);
+			e->name = moved;
+		}
+	}
+}
+
+void rename_entries(directory* dir, const int* which, char* const* names,
+		    int n)
+{
+	for (int k = 0; k < n; k++)
+	{
+		if (!dir->virtualized)
+		{
+			entry* e = &dir->entries.items[which[k]];
+			char* old = e->name;
+			e->name = strdup(names[k]);
+			if (e->perms[0] == 'd')
+				rename_below(dir, which[k], old, names[k]);
+			free(old);
+			update_longest(dir, e);
+			continue;
+		}
+		unsigned name_width = display_width(names[k]);
+		if (name_width > dir->longest_name)
+			dir->longest_name = name_width;
+		// the old name stays behind in the buffer until the next load
+		unsigned offset = dir->names.len;
+		int size = strlen(names[k]) + 1;
+		da_reserve(dir->names, size);
+		memcpy(dir->names.items + offset, names[k], size);
+		dir->names.len += size;
+		dir->index.items[which[k]].name = offset;
+	}
+	if (dir->virtualized)
+	{
+		resort_index(dir);
+		load_window(dir, dir->window);
+	}
+	// a listing of paths keeps the order it was given in
+	else if (!dir->label)
+		sort_entries(dir);
+	dir->generation = next_generation();
+}
+
+// one past the last entry shown below i
+static int subtree_end(const directory* dir, int i)
+{
+	int depth = dir->entries.items[i].depth;
+	int end = i + 1;
+	while (end < dir->entries.len && dir->entries.items[end].depth > depth)
+		end++;
+	return end;
+}
+
+// puts n entries in the listing before position at, it takes them over
+static void insert_entries(directory* dir, int at, const entry* items, int n)
+{
+	da_reserve(dir->entries, n);
+	entry* slot = dir->entries.items + at;
+	memmove(slot + n, slot, sizeof(*slot) * (dir->entries.len - at));
+	memcpy(slot, items, sizeof(*slot) * n);
+	dir->entries.len += n;
+	for (int k = 0; k < n; k++)
+	{
+		if (slot[k].pending) dir->pending++;
+		update_longest(dir, &slot[k]);
+	}
+}
+
+// reads the entries of directory entry e into the entries of sub, named
+// by their path from the listing
+static bool read_subtree(const directory* dir, const entry* e,
+			 directory* sub, reporter* rep)
+{
+	*sub = (directory){0};
+	// a hung mount would block the openat below
+	int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || !stat_timed(fd, e->name, &st, STAT_DEADLINE_MS))
+	{
+		report_error(rep, e->name, errno == ETIMEDOUT
+			     ? "not responding" : "failed to stat", errno);
+		if (fd != -1) close(fd);
+		return false;
+	}
+	int sub_fd = openat(fd, e->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	close(fd);
+	DIR* d = sub_fd == -1 ? NULL : fdopendir(sub_fd);
+	if (!d)
+	{
+		report_error(rep, e->name, "failed to open", errno);
+		if (sub_fd != -1) close(sub_fd);
+		return false;
+	}
+
+	// errors name the directory being read
+	sub->path = (char*)e->name;
+	da_construct(sub->names, 4096);
+	da_construct(sub->index, 64);
+	bool ok = read_index(d, sub, rep);
+	if (ok)
+	{
+		int len = sub->index.len;
+		char** names = index_names(sub, 0, len);
+		int n = 0;
+		for (int i = 0; i < len; i++)
+			if (strcmp(names[i], ".") && strcmp(names[i], ".."))
+				names[n++] = names[i];
+		da_construct(sub->entries, n);
+		stat_entries(sub, dirfd(d), names, n, false, rep);
+		free(names);
+		sort_entries(sub);
+		for (int i = 0; i < sub->entries.len; i++)
+		{
+			entry* child = &sub->entries.items[i];
+			char* path = stralloc("%s/%s", e->name, child->name);
+			free(child->name);
+			child->name = path;
+			child->depth = e->depth + 1;
+		}
+	}
+	closedir(d);
+	free_index(sub);
+	sub->path = NULL;
+	return ok;
+}
+
+bool expand_entry(directory* dir, int i, reporter* rep)
+{
+	if (dir->virtualized || dir->detached)
+	{
+		report_error(rep, entry_name(dir, i), "can't expand in this "
+			     "listing", ENOTSUP);
+		return false;
+	}
+	entry* e = &dir->entries.items[i];
+	if (e->expanded) return true;
+	const char* name = shown_name(e);
+	if (e->perms[0] != 'd' || !strcmp(name, ".") || !strcmp(name, ".."))
+	{
+		report_error(rep, e->name, "can't expand",
+			     e->perms[0] == 'd' ? EINVAL : ENOTDIR);
+		return false;
+	}
+
+	for (int k = 0; k < dir->collapsed.len; k++)
+	{
+		subtree* st = &dir->collapsed.items[k];
+		if (strcmp(st->path, e->name)) continue;
+		insert_entries(dir, i + 1, st->entries.items, st->entries.len);
+		free(st->entries.items);
+		free(st->path);
+		dir->collapsed.items[k] =
+			dir->collapsed.items[--dir->collapsed.len];
+		dir->entries.items[i].expanded = true;
+		return true;
+	}
+
+	directory sub;
+	if (!read_subtree(dir, e, &sub, rep))
+	{
+		free_entries(&sub);
+		return false;
+	}
+	insert_entries(dir, i + 1, sub.entries.items, sub.entries.len);
+	free(sub.entries.items);
+	dir->entries.items[i].expanded = true;
+	return true;
+}
+
+void collapse_entry(directory* dir, int i)
+{
+	if (dir->virtualized || !dir->entries.items[i].expanded) return;
+	int end = subtree_end(dir, i);
+	int n = end - i - 1;
+	subtree st = { strdup(dir->entries.items[i].name), {0} };
+	da_construct(st.entries, n);
+	for (int k = i + 1; k < end; k++)
+	{
+		if (dir->entries.items[k].pending) dir->pending--;
+		da_append(st.entries, dir->entries.items[k]);
+	}
+	entry* rest = dir->entries.items + i + 1;
+	memmove(rest, rest + n, sizeof(*rest) * (dir->entries.len - end));
+	dir->entries.len -= n;
+	dir->entries.items[i].expanded = false;
+	if (!dir->collapsed.items) da_construct(dir->collapsed, 4);
+	da_append(dir->collapsed, st);
+}
+
+int parent_entry(const directory* dir, int i)
+{
+	if (dir->virtualized) return -1;
+	int depth = dir->entries.items[i].depth;
+	while (depth && --i >= 0)
+		if (dir->entries.items[i].depth < depth) return i;
+	return -1;
+}
+
+const char* shown_name(const entry* e)
+{
+	if (!e->depth) return e->name;
+	const char* slash = strrchr(e->name, '/');
+	return slash ? slash + 1 : e->name;
+}
+
+void expand_names(directory* dir, char* const* names, int n,
+		  reporter* rep)
+{
+	int from = 0;
+	for (int i = 0; i < n; i++)
+	{
+		// both are in the order of the listing
+		for (int k = from; k < dir->entries.len; k++)
+		{
+			if (strcmp(dir->entries.items[k].name, names[i]))
+				continue;
+			expand_entry(dir, k, rep);
+			from = k + 1;
+			break;
+		}
+	}
+}
+
+int expanded_names(const directory* dir, char** names)
+{
+	int n = 0;
+	for (int i = 0; i < dir->entries.len; i++)
+	{
+		const entry* e = &dir->entries.items[i];
+		if (!e->expanded) continue;
+		if (names) names[n] = e->name;
+		n++;
+	}
+	return n;
+}
+
+// a reload of the same path shows what was expanded before, reading
+// it again as the cached entries may be stale
+static void expand_like(directory* next, const directory* dir,
+			reporter* rep)
+{
+	int n = expanded_names(dir, NULL);
+	if (!n) return;
+	char** names = malloc(sizeof(*names) * n);
+	if (!names) alloc_failed();
+	expanded_names(dir, names);
+	expand_names(next, names, n, rep);
+	free(names);
+}
+
+void restat_selected(directory* dir)
+{
+	int len = count_entries(dir);
+	bool marked = false;
+	for (int i = 0; i < len && !marked; i++)
+		marked = entry_marked(dir, i);
+	int first = dir->virtualized ? dir->window : 0;
+	int selected = dir->current + dir->scroll;
+	DA(int) which;
+	da_construct(which, 16);
+	for (int k = 0; k < dir->entries.len; k++)
+	{
+		entry* e = &dir->entries.items[k];
+		if (marked ? !e->marked : first + k != selected) continue;
+		// still arriving, it'll be current when it does
+		if (e->pending) continue;
+		da_append(which, k);
+	}
+
+	// with the deadline of a load, what misses it is unknown until
+	// poll_dir sees it answer
+	bool clogged = false;
+	for (int at = 0; at < which.len; at += STAT_BATCH)
+	{
+		int n = which.len - at < STAT_BATCH ? which.len - at : STAT_BATCH;
+		char* names[STAT_BATCH];
+		for (int i = 0; i < n; i++)
+			names[i] = dir->entries.items[which.items[at + i]].name;
+		stat_batch* b = stat_submit(AT_FDCWD, names, n);
+		for (int i = 0; i < n; i++)
+		{
+			entry* e = &dir->entries.items[which.items[at + i]];
+			if (stat_wait(b, i, clogged ? 0 : STAT_DEADLINE_MS))
+				fill_from_result(e, stat_get(b, i), NULL);
+			else
+			{
+				clogged = true;
+				free_metadata(e);
+				fill_unknown(e);
+				stat_retain(b);
+				e->pending = b;
+				e->slot = i;
+				dir->pending++;
+			}
+			update_longest(dir, e);
+		}
+		stat_release(b);
+	}
+	free(which.items);
+}
+
+bool poll_dir(directory* dir)
+{
+	if (!dir->pending) return false;
+
+	bool changed = false;
+	for (int i = 0; i < dir->entries.len; i++)
+	{
+		entry* e = &dir->entries.items[i];
+		if (!e->pending || !stat_ready(e->pending, e->slot)) continue;
+
+		fill_from_result(e, stat_get(e->pending, e->slot), NULL);
+		stat_release(e->pending);
+		e->pending = NULL;
+		update_longest(dir, e);
+		dir->pending--;
+		changed = true;
+	}
+	return changed;
+}
+
+// '/' sorts before everything else, so the entries of an expanded
+// directory come right after it
+static int path_byte(unsigned char c, bool fold)
+{
+	if (c == '/') return 1;
+	return fold ? tolower(c) : c;
+}
+
+static int compare_paths(const char* x, const char* y, bool fold)
+{
+	const unsigned char* a = (const unsigned char*)x;
+	const unsigned char* b = (const unsigned char*)y;
+	while (*a && path_byte(*a, fold) == path_byte(*b, fold))
+	{
+		a++;
+		b++;
+	}
+	return path_byte(*a, fold) - path_byte(*b, fold);
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+	const entry* x = a;
+	const entry* y = b;
+	if (x->depth || y->depth)
+	{
+		int cmp = compare_paths(x->name, y->name, true);
+		if (cmp) return cmp;
+		return compare_paths(x->name, y->name, false);
+	}
+	int cmp = strcasecmp(x->name, y->name);
+	if (cmp) return cmp;
+	return strcmp(x->name, y->name);
+}
+
+void sort_entries(directory* dir)
+{
+	qsort(dir->entries.items, dir->entries.len,
+	      sizeof(*dir->entries.items), compare_entries);
+}
+
+int count_entries(const directory* dir)
+{
+	return dir->virtualized ? dir->index.len : dir->entries.len;
+}
+
+void view_entries(directory* dir, int first, int count)
+{
+	if (!dir->virtualized) return;
+	if (count > VIRTUAL_WINDOW) count = VIRTUAL_WINDOW;
+	if (first >= dir->window &&
+	    first + count <= dir->window + dir->entries.len)
+		return;
+	// centre the range so moving either way doesn't reload right away
+	load_window(dir, first - (VIRTUAL_WINDOW - count) / 2);
+}
+
+entry* get_entry(directory* dir, int i)
+{
+	view_entries(dir, i, 1);
+	return &dir->entries.items[dir->virtualized ? i - dir->window : i];
+}
+
+const char* entry_name(const directory* dir, int i)
+{
+	if (!dir->virtualized) return dir->entries.items[i].name;
+	return dir->names.items + dir->index.items[i].name;
+}
+
+void mark_entry(directory* dir, int i, bool marked)
+{
+	if (!dir->virtualized)
+	{
+		dir->entries.items[i].marked = marked;
+		return;
+	}
+	if (marked)
+		dir->marks[i / 8] |= 1 << i % 8;
+	else
+		dir->marks[i / 8] &= ~(1 << i % 8);
+	if (i >= dir->window && i < dir->window + dir->entries.len)
+		dir->entries.items[i - dir->window].marked = marked;
+}
+
+bool entry_marked(const directory* dir, int i)
+{
+	if (!dir->virtualized) return dir->entries.items[i].marked;
+	return dir->marks[i / 8] & (1 << i % 8);
+}
+
+int find_entry(const directory* dir, const char* needle, int from)
+{
+	int len = count_entries(dir);
+	for (int n = 0; n < len; n++)
+	{
+		int i = (from + n) % len;
+		if (strcasestr(entry_name(dir, i), needle)) return i;
+	}
+	return -1;
+}
+
+static void enter_dir(directory* cwd, bool first, bool same, reporter* rep)
+{
+	if (chdir(cwd->path) != 0)
+		report_error(rep, cwd->path, "failed to enter", errno);
+
+	if (first)
+		cwd->soft = true;
+	if (!same)
+	{
+		cwd->current = count_entries(cwd) > 1 ? 1 : 0;
+		cwd->scroll = 0;
+	}
+}
+
+bool change_dir(directory* cwd, const char* path, reporter* rep)
+{
+	bool first = !cwd->path;
+	bool same = !strcmp(path, ".");
+	if (!load_dir(cwd, path, rep)) return false;
+	enter_dir(cwd, first, same, rep);
+	return true;
+}
+
+void adopt_dir(directory* cwd, directory* loaded, reporter* rep)
+{
+	bool first = !cwd->path;
+	replace_dir(cwd, loaded);
+	enter_dir(cwd, first, false, rep);
+}
+
+selected_entries get_selected(directory* cwd)
+{
+	selected_entries se = {0};
+	da_construct(se.entries, 5);
+
+	int len = count_entries(cwd);
+	for (int i = 0; i < len; i++)
+	{
+		if (!entry_marked(cwd, i)) continue;
+		se.marked = true;
+		da_append(se.entries, entry_name(cwd, i));
+	}
+	if (!se.marked && len)
+		da_append(se.entries, entry_name(cwd, cwd->current + cwd->scroll));
+	return se;
+}
+
+char* expand_home(const char* path)
+{
+	if (path[0] != '~') return strdup(path);
+	const char* home = getenv("HOME");
+
+	// no extra null byte is needed as the tilde gets removed
+	char* fullpath = malloc(strlen(home) + strlen(path));
+	strcpy(fullpath, home);
+	strcat(fullpath, path + 1);
+
+	return fullpath;
+}
+
+bool is_dir(const char* path)
+{
+	struct stat st;
+	if (lstat(path, &st) == -1) return false;
+	return S_ISDIR(st.st_mode);
+}
+
+bool is_dir_timed(const char* path)
+{
+	struct stat st;
+	if (!stat_timed(AT_FDCWD, path, &st, STAT_DEADLINE_MS)) return false;
+	return S_ISDIR(st.st_mode);
+}
+
+bool is_dir_empty(const char* path)
+{
+	DIR* dir = opendir(path);
+	if (!dir) return false;
+	struct dirent* dir_entry;
+	while((dir_entry = readdir(dir)))
+	{
+		if (!strcmp(dir_entry->d_name, ".")) continue;
+		if (!strcmp(dir_entry->d_name, "..")) continue;
+		closedir(dir);
+		return false;
+	}
+	closedir(dir);
+	return true;
+}
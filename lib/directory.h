@@ -0,0 +1,204 @@
+#ifndef DIRECTORY_H_
+#define DIRECTORY_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "da.h"
+#include "report.h"
+#include "statq.h"
+
+#define ECOLOR_FILE 1
+#define ECOLOR_DIR 2
+#define ECOLOR_LNK 3
+#define ECOLOR_EXE 4
+#define ECOLOR_UNKNOWN 8
+
+// listings this large are always virtual
+#define VIRTUAL_THRESHOLD 1000000
+// entries kept with full metadata around the view in virtual mode
+#define VIRTUAL_WINDOW 512
+// columns the entries of an expanded directory are shifted right by
+#define SUBTREE_INDENT 2
+
+typedef struct
+{
+	char* perms;
+	int n_links;
+	char* owner;
+	char* group;
+	float sz_amount;
+	char sz_unit;
+	char* date;
+	char* name;
+	char* link;
+	// columns taken by the name and " -> link"
+	unsigned width;
+	// shown after the name, like the line a search matched
+	char* note;
+	// levels below the top of the listing it was expanded into, names of
+	// entries below the top are paths through the entries above them
+	int depth;
+	// a directory showing its entries beneath it
+	bool expanded;
+	int color;
+	bool marked;
+	// metadata is missing, still in flight if pending is set
+	bool unknown;
+	stat_batch* pending;
+	int slot;
+} entry;
+
+// the entries below a directory entry that was collapsed again
+typedef struct
+{
+	char* path;
+	DA(entry) entries;
+} subtree;
+
+// what a virtual listing keeps per entry, names live in one buffer
+typedef struct
+{
+	unsigned long long ino;
+	unsigned name;
+	unsigned char type;
+} index_entry;
+
+typedef struct
+{
+	char* path;
+	DA(entry) entries;
+	unsigned longest_links;
+	unsigned longest_owner;
+	unsigned longest_group;
+	unsigned longest_date;
+	unsigned longest_name;
+	int y, x;
+	int current;
+	int scroll;
+	bool soft;
+	// entries whose metadata hasn't arrived yet
+	int pending;
+	// requested by the user, large listings are virtualized regardless
+	bool virtual;
+	// in virtual mode entries only holds the window starting at index
+	// `window`, the listing itself is the sorted name index
+	bool virtualized;
+	DA(char) names;
+	DA(index_entry) index;
+	unsigned char* marks;
+	int window;
+	// load_dir gives up past this many entries, 0 for no limit
+	int limit;
+	// what a listing of paths other than path's own entries shows
+	char* label;
+	// the entries aren't files in path (see list_stats)
+	bool detached;
+	// different for every listing loaded, even of the same path
+	unsigned long generation;
+	// kept for expanding them again, dropped with the listing
+	DA(subtree) collapsed;
+} directory;
+
+typedef struct
+{
+	DA(const char*) entries;
+	bool marked;
+} selected_entries;
+
+// reads path into dir without touching the process cwd, dir is only
+// overwritten on success. the view state (current, scroll, soft) is kept
+bool load_dir(directory* dir, const char* path, reporter* rep);
+
+void free_dir(directory* dir);
+
+// a listing of arbitrary paths relative to the cwd, in the given order,
+// instead of the entries of a directory. it's replaced on the next load
+bool list_paths(directory* dir, const char* label,
+		char* const* paths, int n, reporter* rep);
+
+// more paths at the end of a listing from list_paths, notes may be NULL
+void append_paths(directory* dir, char* const* paths, char* const* notes,
+		  int n, reporter* rep);
+
+// a listing of entries that aren't on disk, like the members of an
+// archive, from metadata known beforehand. links holds the targets of
+// symlinks, NULL for the other entries
+bool list_stats(directory* dir, const char* label, char* const* names,
+		const struct stat* st, char* const* links, int n,
+		reporter* rep);
+
+// reads the metadata of what get_selected returns again, for when only
+// that changed. a virtual listing only has the part in its window
+void restat_selected(directory* dir);
+
+// shows the entries of directory entry i indented beneath it, like
+// dired-subtree. they're read the first time and kept when collapsed,
+// along with whatever was expanded below them. loading the same path
+// again expands the same entries. not for virtual or detached listings
+bool expand_entry(directory* dir, int i, reporter* rep);
+
+void collapse_entry(directory* dir, int i);
+
+// the names of the expanded entries in the order of the listing, into
+// names unless it is NULL. how many there are
+int expanded_names(const directory* dir, char** names);
+
+// expands the entries named like expanded_names gave them
+void expand_names(directory* dir, char* const* names, int n,
+		  reporter* rep);
+
+// the entry i was expanded from, -1 for the top of the listing
+int parent_entry(const directory* dir, int i);
+
+// the name drawn for e, without the path through the entries above it
+const char* shown_name(const entry* e);
+
+// drops the listing but keeps the path and view state, load_dir with
+// the same path brings it back
+void unload_dir(directory* dir);
+
+// rough heap size of the listing
+size_t dir_memory(const directory* dir);
+
+// fills in metadata that arrived after its deadline, true if any did
+bool poll_dir(directory* dir);
+
+// entries must be accessed through these, a virtual listing only has
+// metadata for the window around the last viewed range
+int count_entries(const directory* dir);
+entry* get_entry(directory* dir, int i);
+const char* entry_name(const directory* dir, int i);
+// makes sure [first, first + count) can be accessed without reloading
+void view_entries(directory* dir, int first, int count);
+void mark_entry(directory* dir, int i, bool marked);
+bool entry_marked(const directory* dir, int i);
+
+// next entry from `from` on (wrapping) whose name contains needle
+// case insensitively, -1 if there is none
+int find_entry(const directory* dir, const char* needle, int from);
+
+void sort_entries(directory* dir);
+
+// gives the entries at which (positions in the listing) new names after
+// they were renamed on disk, and sorts the listing again. the rest of
+// the listing, metadata and marks included, stays as it is
+void rename_entries(directory* dir, const int* which, char* const* names,
+		    int n);
+
+// load_dir and chdir into it, relative names in the listing stay valid
+bool change_dir(directory* cwd, const char* path, reporter* rep);
+
+// change_dir to a listing loaded beforehand, loaded is taken over
+void adopt_dir(directory* cwd, directory* loaded, reporter* rep);
+
+selected_entries get_selected(directory* cwd);
+
+char* expand_home(const char* path);
+
+bool is_dir(const char* path);
+// the same with a deadline, for what the ui checks on the way to a listing
+bool is_dir_timed(const char* path);
+
+bool is_dir_empty(const char* path);
+
+#endif
@@ -0,0 +1,547 @@
+#include "dupes.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "pool.h"
+
+#define WALK_PROGRESS_STEP 4096
+#define HASH_POLL_MS 100
+
+typedef struct
+{
+	char* path;
+	long long size;
+	struct timespec mtime;
+	dev_t dev;
+	ino_t ino;
+	uint64_t hash[2];
+	int err;
+} file;
+
+typedef DA(file) file_list;
+
+typedef struct
+{
+	file* f;
+	bool full;
+	atomic_llong* hashed;
+	atomic_int* finished;
+	const atomic_bool* cancel;
+} hash_job;
+
+static const uint64_t P1 = 0x9e3779b185ebca87ull;
+static const uint64_t P2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t P3 = 0x165667b19e3779f9ull;
+
+static uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+// two independent 64 bit lanes, a collision in both is not a concern
+static void hash_bytes(uint64_t h[2], const unsigned char* data, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, data + i, 8);
+		h[0] = rotl(h[0] ^ (w * P1), 31) * P2;
+		h[1] = rotl(h[1] ^ (w * P3), 27) * P1 + P2;
+	}
+	for (; i < n; i++)
+	{
+		h[0] = rotl(h[0] ^ (data[i] * P3), 11) * P1;
+		h[1] = rotl(h[1] ^ (data[i] * P2), 13) * P3;
+	}
+}
+
+static void hash_file(void* arg)
+{
+	hash_job* job = arg;
+	file* f = job->f;
+	uint64_t h[2] = { P1 ^ f->size, P2 + f->size };
+
+	int fd = atomic_load(job->cancel)
+		? -1 : open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		f->err = atomic_load(job->cancel) ? ECANCELED : errno;
+	else if (!job->full)
+	{
+		// the ends are enough to tell most files of one size apart
+		unsigned char buf[2 * DUPES_PARTIAL];
+		ssize_t head = pread(fd, buf, DUPES_PARTIAL, 0);
+		ssize_t tail = 0;
+		if (head >= 0)
+		{
+			// the file may have changed size since the walk
+			off_t tail_at = f->size - DUPES_PARTIAL;
+			if (tail_at < head) tail_at = head;
+			if (tail_at < f->size)
+				tail = pread(fd, buf + head, f->size - tail_at, tail_at);
+		}
+		if (head < 0 || tail < 0)
+			f->err = errno;
+		else
+		{
+			hash_bytes(h, buf, head + tail);
+			atomic_fetch_add(job->hashed, head + tail);
+		}
+	}
+	else
+	{
+		// mapped at the size it has now, past the end of a file that
+		// got shorter since the walk is a SIGBUS
+		struct stat st;
+		long long size = fstat(fd, &st) == 0 ? st.st_size : -1;
+		void* data = size > 0
+			? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+		if (size == -1 || data == MAP_FAILED)
+			f->err = errno;
+		else if (size != f->size)
+			f->err = ESTALE;
+		if (data && data != MAP_FAILED)
+		{
+			madvise(data, size, MADV_SEQUENTIAL);
+			// in slices, so progress moves and a cancel is noticed
+			long long step = 1 << 24;
+			for (long long at = 0; !f->err && at < size; at += step)
+			{
+				if (atomic_load(job->cancel))
+				{
+					f->err = ECANCELED;
+					break;
+				}
+				long long n = size - at < step ? size - at : step;
+				hash_bytes(h, (unsigned char*)data + at, n);
+				atomic_fetch_add(job->hashed, n);
+			}
+			munmap(data, size);
+		}
+	}
+	if (fd != -1) close(fd);
+	f->hash[0] = mix(h[0]);
+	f->hash[1] = mix(h[1]);
+	atomic_fetch_add(job->finished, 1);
+}
+
+static void walk(file_list* files, const char* path, reporter* rep)
+{
+	struct stat st;
+	if (lstat(path, &st) != 0)
+	{
+		report_error(rep, path, "failed to stat", errno);
+		return;
+	}
+	if (S_ISREG(st.st_mode))
+	{
+		// empty files are all alike, that's not worth reporting
+		if (!st.st_size) return;
+		file f = { strdup(path), st.st_size, st.st_mtim, st.st_dev,
+			   st.st_ino, { 0, 0 }, 0 };
+		da_append(*files, f);
+		if (files->len % WALK_PROGRESS_STEP == 0)
+			report_progress(rep, path, files->len, 0);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) return;
+
+	DIR* dir = opendir(path);
+	if (!dir)
+	{
+		report_error(rep, path, "failed to open", errno);
+		return;
+	}
+	struct dirent* dir_entry;
+	while ((dir_entry = readdir(dir)) && !report_stopped(rep))
+	{
+		const char* name = dir_entry->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+		char* child = strcmp(path, ".")
+			? stralloc("%s/%s", path, name) : strdup(name);
+		walk(files, child, rep);
+		free(child);
+	}
+	closedir(dir);
+}
+
+static int compare_files(const void* a, const void* b)
+{
+	const file* x = a;
+	const file* y = b;
+	if (x->size != y->size) return x->size < y->size ? -1 : 1;
+	if (x->hash[0] != y->hash[0]) return x->hash[0] < y->hash[0] ? -1 : 1;
+	if (x->hash[1] != y->hash[1]) return x->hash[1] < y->hash[1] ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+static bool same_group(const file* x, const file* y)
+{
+	return x->size == y->size &&
+		x->hash[0] == y->hash[0] &&
+		x->hash[1] == y->hash[1];
+}
+
+// drops the files that failed and those not sharing size and hash with
+// another one, the rest is sorted into groups
+static void narrow(file_list* files)
+{
+	qsort(files->items, files->len, sizeof(*files->items), compare_files);
+	int out = 0;
+	for (int i = 0; i < files->len; i++)
+	{
+		file* f = &files->items[i];
+		bool prev = i > 0 && same_group(f - 1, f) && !f[-1].err;
+		bool next = i + 1 < files->len && same_group(f, f + 1) && !f[1].err;
+		if (f->err || (!prev && !next))
+		{
+			free(f->path);
+			continue;
+		}
+		files->items[out++] = *f;
+	}
+	files->len = out;
+}
+
+// hardlinks to one inode don't take up space twice, one path is enough
+static void drop_links(file_list* files)
+{
+	for (int i = 0; i < files->len; i++)
+	{
+		file* f = &files->items[i];
+		f->hash[0] = f->dev;
+		f->hash[1] = f->ino;
+	}
+	qsort(files->items, files->len, sizeof(*files->items), compare_files);
+	int out = 0;
+	for (int i = 0; i < files->len; i++)
+	{
+		file* f = &files->items[i];
+		if (out && same_group(&files->items[out - 1], f))
+		{
+			free(f->path);
+			continue;
+		}
+		files->items[out++] = *f;
+	}
+	files->len = out;
+	for (int i = 0; i < files->len; i++)
+		files->items[i].hash[0] = files->items[i].hash[1] = 0;
+}
+
+// hashes every candidate on a pool, reporting progress in bytes
+static bool hash_candidates(file_list* files, bool full, reporter* rep)
+{
+	int n = 0;
+	long long total = 0;
+	for (int i = 0; i < files->len; i++)
+	{
+		file* f = &files->items[i];
+		// small files were read whole by the partial pass already
+		if (full && f->size <= 2 * DUPES_PARTIAL) continue;
+		n++;
+		total += full ? f->size : 2 * DUPES_PARTIAL;
+	}
+	if (!n) return true;
+	pool* p = pool_create(0);
+	if (!p)
+	{
+		report_error(rep, ".", "failed to start threads", errno);
+		return false;
+	}
+
+	hash_job* jobs = calloc(n, sizeof(*jobs));
+	if (!jobs)
+	{
+		report_error(rep, ".", "failed to hash", ENOMEM);
+		pool_destroy(p);
+		return false;
+	}
+	atomic_llong hashed;
+	atomic_int finished;
+	atomic_bool cancel;
+	atomic_init(&hashed, 0);
+	atomic_init(&finished, 0);
+	atomic_init(&cancel, false);
+
+	int j = 0;
+	for (int i = 0; i < files->len; i++)
+	{
+		file* f = &files->items[i];
+		if (full && f->size <= 2 * DUPES_PARTIAL) continue;
+		jobs[j] = (hash_job){ f, full, &hashed, &finished, &cancel };
+		pool_submit(p, hash_file, &jobs[j]);
+		j++;
+	}
+
+	// progress goes through the caller's thread only. short sleeps at
+	// first, most sets of candidates are done within a few ms
+	const char* what = full ? "hashing" : "comparing";
+	for (int waited = 0; atomic_load(&finished) < n; waited++)
+	{
+		int ms = waited < HASH_POLL_MS ? 1 : HASH_POLL_MS;
+		struct timespec ts = { 0, ms * 1000000L };
+		nanosleep(&ts, NULL);
+		if (ms == HASH_POLL_MS || waited % HASH_POLL_MS == 0)
+			report_progress(rep, what, atomic_load(&hashed), total);
+		if (report_stopped(rep)) atomic_store(&cancel, true);
+	}
+	pool_wait(p);
+	pool_destroy(p);
+	free(jobs);
+
+	for (int i = 0; i < files->len; i++)
+	{
+		file* f = &files->items[i];
+		if (f->err == ESTALE)
+			report_error(rep, f->path, "changed since the scan", f->err);
+		else if (f->err && f->err != ECANCELED)
+			report_error(rep, f->path, "failed to read", f->err);
+	}
+	return !atomic_load(&cancel);
+}
+
+static int compare_indices(const void* a, const void* b, void* arg)
+{
+	char** paths = arg;
+	return strcmp(paths[*(const int*)a], paths[*(const int*)b]);
+}
+
+bool find_dupes(dupes* d, const char* const* roots, int n, reporter* rep)
+{
+	*d = (dupes){0};
+	da_construct(d->paths, 16);
+	da_construct(d->group, 16);
+	da_construct(d->scanned, 16);
+	da_construct(d->by_path, 16);
+
+	file_list files;
+	da_construct(files, 1024);
+	for (int i = 0; i < n && !report_stopped(rep); i++)
+		walk(&files, roots[i], rep);
+
+	drop_links(&files);
+
+	bool ok = !report_stopped(rep);
+	// size, then the ends, then everything
+	if (ok) narrow(&files);
+	if (ok) ok = hash_candidates(&files, false, rep);
+	if (ok) narrow(&files);
+	if (ok) ok = hash_candidates(&files, true, rep);
+	if (ok) narrow(&files);
+
+	for (int i = 0; ok && i < files.len; i++)
+	{
+		file* f = &files.items[i];
+		bool first = i == 0 || !same_group(&files.items[i - 1], f);
+		if (first)
+			d->groups++;
+		else
+			d->wasted += f->size;
+		da_append(d->paths, f->path);
+		da_append(d->group, d->groups - 1);
+		dupe_stamp stamp = { f->size, f->mtime };
+		da_append(d->scanned, stamp);
+		f->path = NULL;
+	}
+
+	da_reserve(d->by_path, d->paths.len);
+	for (int i = 0; i < d->paths.len; i++)
+		d->by_path.items[i] = i;
+	d->by_path.len = d->paths.len;
+	qsort_r(d->by_path.items, d->by_path.len, sizeof(*d->by_path.items),
+		compare_indices, d->paths.items);
+
+	for (int i = 0; i < files.len; i++)
+		free(files.items[i].path);
+	free(files.items);
+	return ok;
+}
+
+void free_dupes(dupes* d)
+{
+	for (int i = 0; i < d->paths.len; i++)
+		free(d->paths.items[i]);
+	free(d->paths.items);
+	free(d->group.items);
+	free(d->scanned.items);
+	free(d->by_path.items);
+	*d = (dupes){0};
+}
+
+// the index of the copy kept in the group of the one at i
+static int kept_copy(const dupes* d, int i)
+{
+	while (i > 0 && d->group.items[i - 1] == d->group.items[i]) i--;
+	return i;
+}
+
+static int dupe_index(const dupes* d, const char* path)
+{
+	int low = 0;
+	int high = d->by_path.len;
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		int i = d->by_path.items[mid];
+		int cmp = strcmp(d->paths.items[i], path);
+		if (!cmp) return i;
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return -1;
+}
+
+const char* dupe_original(const dupes* d, const char* path)
+{
+	int i = dupe_index(d, path);
+	if (i == -1 || kept_copy(d, i) == i) return NULL;
+	return d->paths.items[kept_copy(d, i)];
+}
+
+static bool unchanged(int fd, const dupe_stamp* scanned)
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 && st.st_size == scanned->size &&
+		st.st_mtim.tv_sec == scanned->mtime.tv_sec &&
+		st.st_mtim.tv_nsec == scanned->mtime.tv_nsec;
+}
+
+// true if the copy at i still holds the bytes of the kept one, as both
+// were when scanned. the hash grouping them could collide
+static bool same_contents(const dupes* d, int i, reporter* rep)
+{
+	int ids[2] = { kept_copy(d, i), i };
+	int fds[2] = { -1, -1 };
+	bool ok = true;
+	for (int k = 0; ok && k < 2; k++)
+	{
+		const char* path = d->paths.items[ids[k]];
+		fds[k] = open(path, O_RDONLY | O_CLOEXEC);
+		if (fds[k] == -1)
+		{
+			report_error(rep, path, "failed to open for reading", errno);
+			ok = false;
+		}
+		else if (!unchanged(fds[k], &d->scanned.items[ids[k]]))
+		{
+			report_error(rep, path, "changed since the scan", ESTALE);
+			ok = false;
+		}
+	}
+
+	char* buf = ok ? malloc(2 * DUPES_COMPARE_CHUNK) : NULL;
+	if (ok && !buf)
+	{
+		report_error(rep, d->paths.items[i], "failed to compare", ENOMEM);
+		ok = false;
+	}
+	long long size = d->scanned.items[i].size;
+	for (long long at = 0; ok && at < size; at += DUPES_COMPARE_CHUNK)
+	{
+		size_t n = size - at < DUPES_COMPARE_CHUNK
+			? size - at : DUPES_COMPARE_CHUNK;
+		ssize_t got[2] = { pread(fds[0], buf, n, at),
+				   pread(fds[1], buf + n, n, at) };
+		if (got[0] < 0 || got[1] < 0)
+		{
+			report_error(rep, d->paths.items[got[0] < 0 ? ids[0] : ids[1]],
+				     "failed to read", errno);
+			ok = false;
+		}
+		else if (got[0] != (ssize_t)n || got[1] != (ssize_t)n ||
+			 memcmp(buf, buf + n, n))
+		{
+			report_error(rep, d->paths.items[i],
+				     "differs from the kept copy", EINVAL);
+			ok = false;
+		}
+	}
+	free(buf);
+	for (int k = 0; k < 2; k++)
+		if (fds[k] != -1) close(fds[k]);
+	return ok;
+}
+
+static bool clone_file(const char* src, const char* dst, reporter* rep)
+{
+	int in = open(src, O_RDONLY | O_CLOEXEC);
+	if (in == -1)
+	{
+		report_error(rep, src, "failed to open for reading", errno);
+		return false;
+	}
+	int out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (out == -1)
+	{
+		report_error(rep, dst, "failed to open for writing", errno);
+		close(in);
+		return false;
+	}
+	bool ok = ioctl(out, FICLONE, in) == 0;
+	if (!ok) report_error(rep, dst, "failed to reflink", errno);
+	close(in);
+	close(out);
+	if (!ok) unlink(dst);
+	return ok;
+}
+
+bool link_dupe(const dupes* d, const char* path, bool reflink, reporter* rep)
+{
+	const char* original = dupe_original(d, path);
+	if (!original)
+	{
+		report_error(rep, path, "not a redundant copy", EINVAL);
+		return false;
+	}
+	if (!same_contents(d, dupe_index(d, path), rep)) return false;
+
+	// made next to path and renamed over it, path is never missing
+	char* tmp = stralloc("%s.filed-link", path);
+	bool ok;
+	if (reflink)
+		ok = clone_file(original, tmp, rep);
+	else
+	{
+		ok = link(original, tmp) == 0;
+		if (!ok) report_error(rep, path, "failed to link", errno);
+	}
+
+	struct stat st;
+	if (ok && reflink && stat(path, &st) == 0)
+	{
+		// a clone starts out with default metadata
+		chmod(tmp, st.st_mode & 07777);
+		struct timespec times[2] = { st.st_atim, st.st_mtim };
+		utimensat(AT_FDCWD, tmp, times, 0);
+	}
+	if (ok && rename(tmp, path) != 0)
+	{
+		report_error(rep, path, "failed to replace", errno);
+		unlink(tmp);
+		ok = false;
+	}
+	free(tmp);
+	return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef DUPES_H_
+#define DUPES_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include "da.h"
+#include "report.h"
+
+// duplicate files under a set of roots. files are grouped by size, then
+// by a hash of their first and last DUPES_PARTIAL bytes, and only the
+// files still sharing a group get hashed in full. hashing runs on a
+// pool with one thread per cpu.
+
+#define DUPES_PARTIAL 4096
+// read at once from each file when checking a copy before linking it
+#define DUPES_COMPARE_CHUNK (1 << 17)
+
+// a file as the scan saw it, linking refuses a file that changed since
+typedef struct
+{
+	long long size;
+	struct timespec mtime;
+} dupe_stamp;
+
+typedef struct
+{
+	// relative to the cwd, the files of a group are next to each other
+	// and the first of each group is the copy to keep
+	DA(char*) paths;
+	DA(int) group;
+	DA(dupe_stamp) scanned;
+	// indices into paths in the order of the paths, for looking them up
+	DA(int) by_path;
+	int groups;
+	// bytes taken up by the copies that aren't kept
+	long long wasted;
+} dupes;
+
+// roots are files or directories, directories are walked without
+// following symlinks. false if it was stopped through the reporter
+bool find_dupes(dupes* d, const char* const* roots, int n, reporter* rep);
+
+void free_dupes(dupes* d);
+
+// the copy kept in the group of path, NULL if path isn't a duplicate
+const char* dupe_original(const dupes* d, const char* path);
+
+// replaces path with a hardlink to (or with reflink a copy on write
+// clone of) the kept copy of its group, once both are checked to be
+// unchanged since the scan and to hold the same bytes
+bool link_dupe(const dupes* d, const char* path, bool reflink, reporter* rep);
+
+#endif
@@ -0,0 +1,179 @@
+#include "fileops.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <libgen.h>
+
+#define READ_SIZE 256
+#define PROGRESS_STEP (1 << 20)
+
+static bool file_exists(const char* file)
+{
+	struct stat st;
+	return (stat(file, &st) == 0);
+}
+
+static bool copy_file_dir(const char* src, const char* dst, reporter* rep)
+{
+	char* src_cpy = strdup(src);
+	char* name = basename(src_cpy);
+	char* dst_full = stralloc("%s/%s", dst, name);
+
+	bool ret = copy_file(src, dst_full, rep);
+	free(dst_full);
+	free(src_cpy);
+	return ret;
+}
+
+bool copy_file(const char* src, const char* dst, reporter* rep)
+{
+	if (is_dir(dst)) return copy_file_dir(src, dst, rep);
+	if (file_exists(dst))
+	{
+		report_error(rep, dst, "refusing to overwrite", EEXIST);
+		return false;
+	}
+
+	FILE* fp_src = fopen(src, "r");
+	if (!fp_src)
+	{
+		report_error(rep, src, "failed to open for reading", errno);
+		return false;
+	}
+	FILE* fp_dst = fopen(dst, "w");
+	if (!fp_dst)
+	{
+		report_error(rep, dst, "failed to open for writing", errno);
+		fclose(fp_src);
+		return false;
+	}
+
+	struct stat st;
+	long long total = fstat(fileno(fp_src), &st) == 0 ? st.st_size : 0;
+	long long done = 0;
+	long long next_report = PROGRESS_STEP;
+	bool ok = true;
+
+	char buf[READ_SIZE] = {0};
+	size_t sz = 0;
+	while ((sz = fread(buf, 1, READ_SIZE, fp_src)))
+	{
+		if (fwrite(buf, 1, sz, fp_dst) != sz)
+		{
+			report_error(rep, dst, "failed to write", errno);
+			ok = false;
+			break;
+		}
+		done += sz;
+		if (done < next_report) continue;
+		next_report += PROGRESS_STEP;
+		report_progress(rep, src, done, total);
+		if (report_stopped(rep))
+		{
+			ok = false;
+			break;
+		}
+	}
+	if (ok && ferror(fp_src))
+	{
+		report_error(rep, src, "failed to read", errno);
+		ok = false;
+	}
+	fclose(fp_src);
+	if (fclose(fp_dst) != 0 && ok)
+	{
+		report_error(rep, dst, "failed to write", errno);
+		ok = false;
+	}
+	// don't leave a truncated copy behind
+	if (!ok) remove(dst);
+	return ok;
+}
+
+bool move_file(const char* src, const char* dst, reporter* rep)
+{
+	if (!copy_file(src, dst, rep)) return false;
+	if (remove(src) != 0)
+	{
+		report_error(rep, src, "failed to remove", errno);
+		return false;
+	}
+	return true;
+}
+
+bool remove_recursive(const char* path, reporter* rep)
+{
+	if (!is_dir(path) || is_dir_empty(path))
+	{
+		if (remove(path) == 0) return true;
+		report_error(rep, path, "failed to remove", errno);
+		return false;
+	}
+
+	DIR* dir = opendir(path);
+	if (!dir)
+	{
+		report_error(rep, path, "failed to open", errno);
+		return false;
+	}
+	bool ok = true;
+	struct dirent* dir_entry;
+
+	while((dir_entry = readdir(dir)))
+	{
+		if (!strcmp(dir_entry->d_name, ".")) continue;
+		if (!strcmp(dir_entry->d_name, "..")) continue;
+
+		char* fullpath = stralloc("%s/%s", path, dir_entry->d_name);
+		if (!remove_recursive(fullpath, rep)) ok = false;
+		free(fullpath);
+		if (report_stopped(rep)) break;
+	}
+	closedir(dir);
+	if (!ok) return false;
+	if (remove(path) == 0) return true;
+	report_error(rep, path, "failed to remove", errno);
+	return false;
+}
+
+bool copy_selected(const selected_entries* se, const char* dst, reporter* rep)
+{
+	bool ok = true;
+	for (int i = 0; i < se->entries.len && !report_stopped(rep); i++)
+	{
+		if (!copy_file(se->entries.items[i], dst, rep)) ok = false;
+		report_progress(rep, se->entries.items[i], i + 1, se->entries.len);
+	}
+	return ok;
+}
+
+bool move_selected(const selected_entries* se, const char* dst, reporter* rep)
+{
+	bool ok = true;
+	for (int i = 0; i < se->entries.len && !report_stopped(rep); i++)
+	{
+		if (!move_file(se->entries.items[i], dst, rep)) ok = false;
+		report_progress(rep, se->entries.items[i], i + 1, se->entries.len);
+	}
+	return ok;
+}
+
+bool remove_selected(const selected_entries* se, reporter* rep)
+{
+	bool ok = true;
+	for (int i = 0; i < se->entries.len && !report_stopped(rep); i++)
+	{
+		const char* name = se->entries.items[i];
+		if (!strcmp(name, ".") ||
+		    !strcmp(name, ".."))
+		{
+			report_error(rep, name, "refusing to delete", EINVAL);
+			ok = false;
+			continue;
+		}
+		if (!remove_recursive(name, rep)) ok = false;
+		report_progress(rep, name, i + 1, se->entries.len);
+	}
+	return ok;
+}
@@ -0,0 +1,17 @@
+#ifndef FILEOPS_H_
+#define FILEOPS_H_
+
+#include "directory.h"
+
+// dst may be an existing directory, src is then copied into it
+bool copy_file(const char* src, const char* dst, reporter* rep);
+bool move_file(const char* src, const char* dst, reporter* rep);
+
+bool remove_recursive(const char* path, reporter* rep);
+
+// apply to every selected entry, returns false if any of them failed
+bool copy_selected(const selected_entries* se, const char* dst, reporter* rep);
+bool move_selected(const selected_entries* se, const char* dst, reporter* rep);
+bool remove_selected(const selected_entries* se, reporter* rep);
+
+#endif
@@ -0,0 +1,299 @@
+#include "frecency.h"
+
+#include <stdbool.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "da.h"
+
+#define HOUR (60 * 60)
+#define DAY (24 * HOUR)
+#define WEEK (7 * DAY)
+
+typedef struct
+{
+	char* path;
+	double visits;
+	long long last;
+	double score;
+} record;
+
+static DA(record) records;
+static bool loaded;
+// of the file when it was read, a change means another instance wrote
+static struct stat loaded_st;
+
+static char* db_path(void)
+{
+	const char* state = getenv("XDG_STATE_HOME");
+	if (state && state[0]) return stralloc("%s/filed/dirs", state);
+	const char* home = getenv("HOME");
+	if (!home) return NULL;
+	return stralloc("%s/.local/state/filed/dirs", home);
+}
+
+static void make_parents(char* path)
+{
+	for (char* p = path + 1; *p; p++)
+	{
+		if (*p != '/') continue;
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+}
+
+static void free_records(void)
+{
+	for (int i = 0; i < records.len; i++)
+		free(records.items[i].path);
+	free(records.items);
+	records.items = NULL;
+	records.len = records.cap = 0;
+	loaded = false;
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+	return strcmp(((const record*)a)->path, ((const record*)b)->path);
+}
+
+static int compare_scores(const void* a, const void* b)
+{
+	double x = ((const record*)a)->score;
+	double y = ((const record*)b)->score;
+	return (x < y) - (x > y);
+}
+
+// lines are "visits\tlast visit\tpath", a visit appends one with 1 visit
+static void parse(const char* data, size_t size)
+{
+	const char* end = data + size;
+	const char* line = data;
+	while (line < end)
+	{
+		const char* nl = memchr(line, '\n', end - line);
+		if (!nl) break;
+		const char* tab1 = memchr(line, '\t', nl - line);
+		const char* tab2 = tab1
+			? memchr(tab1 + 1, '\t', nl - tab1 - 1) : NULL;
+		if (tab2 && tab2 + 1 < nl)
+		{
+			record r = {0};
+			r.visits = strtod(line, NULL);
+			r.last = strtoll(tab1 + 1, NULL, 10);
+			r.path = strndup(tab2 + 1, nl - tab2 - 1);
+			if (r.visits > 0) da_append(records, r);
+			else free(r.path);
+		}
+		line = nl + 1;
+	}
+
+	// merge the visits appended since the last compaction
+	if (!records.len) return;
+	qsort(records.items, records.len, sizeof(*records.items), compare_paths);
+	int out = 0;
+	for (int i = 1; i < records.len; i++)
+	{
+		record* r = &records.items[i];
+		record* last = &records.items[out];
+		if (strcmp(r->path, last->path))
+		{
+			records.items[++out] = *r;
+			continue;
+		}
+		last->visits += r->visits;
+		if (r->last > last->last) last->last = r->last;
+		free(r->path);
+	}
+	records.len = out + 1;
+}
+
+static void load(void)
+{
+	char* path = db_path();
+	if (!path) return;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+
+	struct stat st = {0};
+	if (fd != -1 && fstat(fd, &st) == 0 && loaded &&
+	    st.st_ino == loaded_st.st_ino && st.st_size == loaded_st.st_size &&
+	    st.st_mtim.tv_sec == loaded_st.st_mtim.tv_sec &&
+	    st.st_mtim.tv_nsec == loaded_st.st_mtim.tv_nsec)
+	{
+		close(fd);
+		return;
+	}
+
+	free_records();
+	da_construct(records, 64);
+	loaded = true;
+	loaded_st = st;
+	if (fd == -1) return;
+	if (st.st_size > 0)
+	{
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED)
+		{
+			parse(data, st.st_size);
+			munmap(data, st.st_size);
+		}
+	}
+	close(fd);
+}
+
+static double frecency(const record* r, long long now)
+{
+	long long age = now - r->last;
+	if (age < HOUR) return r->visits * 4;
+	if (age < DAY) return r->visits * 2;
+	if (age < WEEK) return r->visits / 2;
+	return r->visits / 4;
+}
+
+// rewrites the log as one line per directory, dropping the lowest ranked
+// past FRECENCY_MAX_DIRS or FRECENCY_COMPACT_SIZE. called with the log
+// locked, so no visit is appended in between
+static void compact(const char* path)
+{
+	load();
+	long long now = time(NULL);
+	for (int i = 0; i < records.len; i++)
+		records.items[i].score = frecency(&records.items[i], now);
+	qsort(records.items, records.len, sizeof(*records.items), compare_scores);
+	if (records.len > FRECENCY_MAX_DIRS)
+	{
+		for (int i = FRECENCY_MAX_DIRS; i < records.len; i++)
+			free(records.items[i].path);
+		records.len = FRECENCY_MAX_DIRS;
+	}
+
+	char* tmp = stralloc("%s.XXXXXX", path);
+	int fd = mkstemp(tmp);
+	FILE* fp = fd == -1 ? NULL : fdopen(fd, "w");
+	if (!fp)
+	{
+		if (fd != -1) close(fd);
+		free(tmp);
+		return;
+	}
+	long long size = 0;
+	for (int i = 0; i < records.len; i++)
+	{
+		const record* r = &records.items[i];
+		size += snprintf(NULL, 0, "%g\t%lld\t%s\n",
+				 r->visits, r->last, r->path);
+		if (size > FRECENCY_COMPACT_SIZE) break;
+		fprintf(fp, "%g\t%lld\t%s\n", r->visits, r->last, r->path);
+	}
+	if (fclose(fp) == 0)
+		rename(tmp, path);
+	else
+		unlink(tmp);
+	free(tmp);
+	// read again on the next lookup
+	loaded = false;
+}
+
+// the log opened for appending with an exclusive lock, -1 if it can't be
+// opened. a compaction renames a new log over the old one, a lock taken
+// on a log that was replaced meanwhile is taken again on the new one
+static int open_locked(char* path)
+{
+	while (true)
+	{
+		int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+			      0600);
+		if (fd == -1 && errno == ENOENT)
+		{
+			make_parents(path);
+			fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+				  0600);
+		}
+		if (fd == -1) return -1;
+		// without locks the visits still are single appends
+		if (flock(fd, LOCK_EX) != 0) return fd;
+		struct stat held, named;
+		if (fstat(fd, &held) == 0 && stat(path, &named) == 0 &&
+		    held.st_dev == named.st_dev && held.st_ino == named.st_ino)
+			return fd;
+		close(fd);
+	}
+}
+
+void frecency_visit(const char* dir)
+{
+	if (strchr(dir, '\n')) return;
+	char* path = db_path();
+	if (!path) return;
+
+	int fd = open_locked(path);
+	if (fd == -1)
+	{
+		free(path);
+		return;
+	}
+
+	// one write, so visits from several instances don't interleave
+	char* line = stralloc("1\t%lld\t%s\n", (long long)time(NULL), dir);
+	bool ok = write(fd, line, strlen(line)) == (ssize_t)strlen(line);
+	free(line);
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (ok && size > FRECENCY_LOG_SIZE) compact(path);
+	// releases the lock
+	close(fd);
+	free(path);
+}
+
+// 0 if query isn't a subsequence of path (ignoring case), higher when
+// it is found in one piece or in the last component
+static int fuzzy(const char* path, const char* query)
+{
+	if (!query[0]) return 1;
+	const char* base = strrchr(path, '/');
+	base = base && base[1] ? base + 1 : path;
+	if (strcasestr(base, query)) return 8;
+	if (strcasestr(path, query)) return 4;
+
+	const char* p = path;
+	for (const char* q = query; *q; q++)
+	{
+		int c = tolower((unsigned char)*q);
+		while (*p && tolower((unsigned char)*p) != c)
+			p++;
+		if (!*p) return 0;
+		p++;
+	}
+	return 1;
+}
+
+int frecency_rank(const char* query, const char** out, int max)
+{
+	load();
+	long long now = time(NULL);
+	for (int i = 0; i < records.len; i++)
+	{
+		record* r = &records.items[i];
+		r->score = fuzzy(r->path, query) * frecency(r, now);
+	}
+	qsort(records.items, records.len, sizeof(*records.items), compare_scores);
+
+	int n = 0;
+	for (int i = 0; i < records.len && n < max; i++)
+	{
+		if (records.items[i].score <= 0) break;
+		out[n++] = records.items[i].path;
+	}
+	return n;
+}
+
+void frecency_close(void)
+{
+	free_records();
+}
@@ -0,0 +1,25 @@
+#ifndef FRECENCY_H_
+#define FRECENCY_H_
+
+// directories ranked by how often and how recently they were visited,
+// kept across sessions in $XDG_STATE_HOME/filed/dirs. visits are
+// appended to the file, which is compacted once it grows past
+// FRECENCY_LOG_SIZE. instances share it under an flock. nothing is read
+// until the first lookup.
+
+#define FRECENCY_LOG_SIZE (128 << 10)
+// what a compaction leaves at most, so the next one is a while away
+// even when long paths fill it
+#define FRECENCY_COMPACT_SIZE (FRECENCY_LOG_SIZE / 2)
+// directories kept when compacting, the lowest ranked go first
+#define FRECENCY_MAX_DIRS 1000
+
+void frecency_visit(const char* path);
+
+// the best ranked directories matching query as a fuzzy subsequence,
+// the strings are valid until the next call
+int frecency_rank(const char* query, const char** out, int max);
+
+void frecency_close(void);
+
+#endif
@@ -0,0 +1,703 @@
+#include "gitobj.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// git itself stops at 4095, anything deeper is a broken pack
+#define MAX_DELTA_DEPTH 4096
+
+#define OBJ_OFS_DELTA 6
+#define OBJ_REF_DELTA 7
+
+typedef struct
+{
+	const unsigned char* idx;
+	size_t idx_size;
+	const unsigned char* data;
+	size_t data_size;
+	uint32_t count;
+} pack;
+
+struct git_odb
+{
+	char* objects;
+	DA(pack) packs;
+};
+
+static uint32_t rol(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const unsigned char* p)
+{
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+			(uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (int i = 16; i < 80; i++)
+		w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+	for (int i = 0; i < 80; i++)
+	{
+		uint32_t f, k;
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		uint32_t t = rol(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rol(b, 30);
+		b = a;
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+void sha1_init(sha1_ctx* c)
+{
+	c->h[0] = 0x67452301;
+	c->h[1] = 0xefcdab89;
+	c->h[2] = 0x98badcfe;
+	c->h[3] = 0x10325476;
+	c->h[4] = 0xc3d2e1f0;
+	c->len = 0;
+}
+
+void sha1_update(sha1_ctx* c, const void* data, size_t n)
+{
+	const unsigned char* p = data;
+	size_t used = c->len % 64;
+	c->len += n;
+	if (used)
+	{
+		size_t take = 64 - used < n ? 64 - used : n;
+		memcpy(c->block + used, p, take);
+		p += take;
+		n -= take;
+		if (used + take < 64) return;
+		sha1_block(c->h, c->block);
+	}
+	for (; n >= 64; p += 64, n -= 64)
+		sha1_block(c->h, p);
+	memcpy(c->block, p, n);
+}
+
+void sha1_final(sha1_ctx* c, unsigned char out[GIT_SHA_SIZE])
+{
+	uint64_t bits = c->len * 8;
+	unsigned char pad[64] = { 0x80 };
+	size_t used = c->len % 64;
+	sha1_update(c, pad, used < 56 ? 56 - used : 120 - used);
+	unsigned char be[8];
+	for (int i = 0; i < 8; i++)
+		be[i] = bits >> (56 - 8 * i);
+	sha1_update(c, be, 8);
+	for (int i = 0; i < 5; i++)
+	{
+		out[4 * i] = c->h[i] >> 24;
+		out[4 * i + 1] = c->h[i] >> 16;
+		out[4 * i + 2] = c->h[i] >> 8;
+		out[4 * i + 3] = c->h[i];
+	}
+}
+
+static uint32_t be32(const unsigned char* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3];
+}
+
+static bool parse_hex(const char* s, unsigned char sha[GIT_SHA_SIZE])
+{
+	for (int i = 0; i < GIT_SHA_SIZE; i++)
+	{
+		unsigned byte;
+		if (!isxdigit((unsigned char)s[2 * i]) ||
+		    !isxdigit((unsigned char)s[2 * i + 1]) ||
+		    sscanf(s + 2 * i, "%2x", &byte) != 1)
+			return false;
+		sha[i] = byte;
+	}
+	return true;
+}
+
+static char* read_text(const char* path)
+{
+	FILE* fp = fopen(path, "re");
+	if (!fp) return NULL;
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len = getline(&line, &cap, fp);
+	fclose(fp);
+	if (len < 0)
+	{
+		free(line);
+		return NULL;
+	}
+	while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+		line[--len] = '\0';
+	return line;
+}
+
+// linked work trees share objects and refs with the main repository
+static char* common_dir(const char* gitdir)
+{
+	char* file = stralloc("%s/commondir", gitdir);
+	char* common = read_text(file);
+	free(file);
+	if (!common) return strdup(gitdir);
+	if (common[0] == '/') return common;
+	char* joined = stralloc("%s/%s", gitdir, common);
+	free(common);
+	return joined;
+}
+
+// inflates all of src, into exactly size bytes unless size is 0
+static unsigned char* inflate_all(const unsigned char* src, size_t src_len,
+				  size_t size, size_t* out_len)
+{
+	// one byte spare for the terminator and one so that inflate can
+	// tell the stream ended exactly at size
+	size_t cap = size ? size + 2 : src_len * 4 + 64;
+	// sized by what the repository says, too much for memory is like
+	// any other broken object
+	unsigned char* out = malloc(cap);
+	if (!out) return NULL;
+	z_stream z = {0};
+	if (inflateInit(&z) != Z_OK)
+	{
+		free(out);
+		return NULL;
+	}
+	z.next_in = (unsigned char*)src;
+	z.avail_in = src_len > UINT32_MAX ? UINT32_MAX : src_len;
+	int ret;
+	do
+	{
+		if (z.total_out + 1 >= cap)
+		{
+			if (size) break;
+			unsigned char* grown = realloc(out, cap * 2);
+			if (!grown)
+			{
+				ret = Z_MEM_ERROR;
+				break;
+			}
+			out = grown;
+			cap *= 2;
+		}
+		z.next_out = out + z.total_out;
+		z.avail_out = cap - 1 - z.total_out;
+		ret = inflate(&z, Z_NO_FLUSH);
+	} while (ret == Z_OK);
+	size_t len = z.total_out;
+	inflateEnd(&z);
+	if (ret != Z_STREAM_END || (size && len != size))
+	{
+		free(out);
+		return NULL;
+	}
+	out[len] = '\0';
+	if (out_len) *out_len = len;
+	return out;
+}
+
+static void open_pack(git_odb* odb, const char* idx_path)
+{
+	char* pack_path = stralloc("%.*s.pack", (int)strlen(idx_path) - 4, idx_path);
+	int fds[2] = {
+		open(idx_path, O_RDONLY | O_CLOEXEC),
+		open(pack_path, O_RDONLY | O_CLOEXEC),
+	};
+	free(pack_path);
+	void* maps[2] = { MAP_FAILED, MAP_FAILED };
+	size_t sizes[2] = { 0, 0 };
+	for (int i = 0; i < 2; i++)
+	{
+		struct stat st;
+		if (fds[i] == -1 || fstat(fds[i], &st) != 0 || !st.st_size)
+			continue;
+		sizes[i] = st.st_size;
+		maps[i] = mmap(NULL, sizes[i], PROT_READ, MAP_PRIVATE, fds[i], 0);
+	}
+	for (int i = 0; i < 2; i++)
+		if (fds[i] != -1) close(fds[i]);
+
+	pack p = { maps[0], sizes[0], maps[1], sizes[1], 0 };
+	// only version 2 indexes, written by every git since 1.5.2
+	bool ok = maps[0] != MAP_FAILED && maps[1] != MAP_FAILED &&
+		sizes[0] >= 8 + 256 * 4 && be32(p.idx) == 0xff744f63 &&
+		be32(p.idx + 4) == 2 && sizes[1] >= 32 && !memcmp(p.data, "PACK", 4);
+	if (ok)
+	{
+		p.count = be32(p.idx + 8 + 255 * 4);
+		ok = sizes[0] >= 8 + 256 * 4 + (size_t)p.count * 28;
+	}
+	if (ok)
+	{
+		da_append(odb->packs, p);
+		return;
+	}
+	for (int i = 0; i < 2; i++)
+		if (maps[i] != MAP_FAILED) munmap(maps[i], sizes[i]);
+}
+
+git_odb* odb_open(const char* gitdir)
+{
+	char* common = common_dir(gitdir);
+	git_odb* odb = calloc(1, sizeof(*odb));
+	if (!odb) alloc_failed();
+	odb->objects = stralloc("%s/objects", common);
+	free(common);
+	da_construct(odb->packs, 4);
+
+	char* pack_dir = stralloc("%s/pack", odb->objects);
+	DIR* d = opendir(pack_dir);
+	if (d)
+	{
+		struct dirent* dir_entry;
+		while ((dir_entry = readdir(d)))
+		{
+			const char* name = dir_entry->d_name;
+			int len = strlen(name);
+			if (len < 5 || strcmp(name + len - 4, ".idx")) continue;
+			char* path = stralloc("%s/%s", pack_dir, name);
+			open_pack(odb, path);
+			free(path);
+		}
+		closedir(d);
+	}
+	free(pack_dir);
+	return odb;
+}
+
+void odb_close(git_odb* odb)
+{
+	if (!odb) return;
+	for (int i = 0; i < odb->packs.len; i++)
+	{
+		pack* p = &odb->packs.items[i];
+		munmap((void*)p->idx, p->idx_size);
+		munmap((void*)p->data, p->data_size);
+	}
+	free(odb->packs.items);
+	free(odb->objects);
+	free(odb);
+}
+
+static bool find_packed(const pack* p, const unsigned char sha[GIT_SHA_SIZE],
+			size_t* offset)
+{
+	const unsigned char* fanout = p->idx + 8;
+	uint32_t lo = sha[0] ? be32(fanout + (sha[0] - 1) * 4) : 0;
+	uint32_t hi = be32(fanout + sha[0] * 4);
+	const unsigned char* shas = fanout + 256 * 4;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = memcmp(shas + (size_t)mid * GIT_SHA_SIZE, sha,
+				 GIT_SHA_SIZE);
+		if (cmp < 0)
+			lo = mid + 1;
+		else if (cmp > 0)
+			hi = mid;
+		else
+		{
+			const unsigned char* offsets = shas + (size_t)p->count * 24;
+			uint32_t off = be32(offsets + (size_t)mid * 4);
+			if (!(off & 0x80000000))
+			{
+				*offset = off;
+				return true;
+			}
+			// past 2 GiB the offset is an index into a table of 64 bit ones
+			const unsigned char* large = offsets + (size_t)p->count * 4 +
+				(size_t)(off & 0x7fffffff) * 8;
+			if (large + 8 > p->idx + p->idx_size) return false;
+			*offset = (size_t)be32(large) << 32 | be32(large + 4);
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t delta_size(const unsigned char** p, const unsigned char* end)
+{
+	size_t v = 0;
+	int shift = 0;
+	while (*p < end)
+	{
+		unsigned c = *(*p)++;
+		v |= (size_t)(c & 0x7f) << shift;
+		shift += 7;
+		if (!(c & 0x80)) break;
+	}
+	return v;
+}
+
+static unsigned char* apply_delta(const unsigned char* base, size_t base_size,
+				  const unsigned char* delta, size_t delta_len,
+				  size_t* out_size)
+{
+	const unsigned char* p = delta;
+	const unsigned char* end = delta + delta_len;
+	if (delta_size(&p, end) != base_size) return NULL;
+	size_t size = delta_size(&p, end);
+	unsigned char* out = size + 1 ? malloc(size + 1) : NULL;
+	if (!out) return NULL;
+
+	size_t at = 0;
+	while (p < end)
+	{
+		unsigned cmd = *p++;
+		if (cmd & 0x80)
+		{
+			// copy from the base, the set bits say which bytes follow
+			size_t off = 0, n = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				if (!(cmd & (1 << i))) continue;
+				if (p >= end) goto bad;
+				off |= (size_t)*p++ << (8 * i);
+			}
+			for (int i = 0; i < 3; i++)
+			{
+				if (!(cmd & (0x10 << i))) continue;
+				if (p >= end) goto bad;
+				n |= (size_t)*p++ << (8 * i);
+			}
+			if (!n) n = 0x10000;
+			if (off + n > base_size || at + n > size) goto bad;
+			memcpy(out + at, base + off, n);
+			at += n;
+		}
+		else if (cmd)
+		{
+			// literal bytes
+			if (p + cmd > end || at + cmd > size) goto bad;
+			memcpy(out + at, p, cmd);
+			p += cmd;
+			at += cmd;
+		}
+		else
+			goto bad;
+	}
+	if (at != size) goto bad;
+	out[size] = '\0';
+	*out_size = size;
+	return out;
+bad:
+	free(out);
+	return NULL;
+}
+
+static unsigned char* read_packed(git_odb* odb, const pack* p, size_t offset,
+				  int* type, size_t* size, int depth)
+{
+	const unsigned char* at = p->data + offset;
+	// the pack ends in a checksum
+	const unsigned char* end = p->data + p->data_size - GIT_SHA_SIZE;
+	if (depth > MAX_DELTA_DEPTH || offset < 12 || at >= end) return NULL;
+
+	unsigned c = *at++;
+	int t = (c >> 4) & 7;
+	size_t sz = c & 15;
+	int shift = 4;
+	while (c & 0x80)
+	{
+		if (at >= end) return NULL;
+		c = *at++;
+		sz |= (size_t)(c & 0x7f) << shift;
+		shift += 7;
+	}
+
+	unsigned char* base = NULL;
+	size_t base_size = 0;
+	int base_type = 0;
+	if (t == OBJ_OFS_DELTA)
+	{
+		if (at >= end) return NULL;
+		c = *at++;
+		size_t back = c & 0x7f;
+		while (c & 0x80)
+		{
+			if (at >= end) return NULL;
+			c = *at++;
+			back = ((back + 1) << 7) | (c & 0x7f);
+		}
+		if (back >= offset) return NULL;
+		base = read_packed(odb, p, offset - back, &base_type, &base_size,
+				   depth + 1);
+	}
+	else if (t == OBJ_REF_DELTA)
+	{
+		if (at + GIT_SHA_SIZE > end) return NULL;
+		base = odb_read(odb, at, &base_type, &base_size);
+		at += GIT_SHA_SIZE;
+	}
+	else if (t < GIT_COMMIT || t > GIT_TAG)
+		return NULL;
+
+	unsigned char* data = inflate_all(at, end - at, sz, NULL);
+	if (t != OBJ_OFS_DELTA && t != OBJ_REF_DELTA)
+	{
+		*type = t;
+		*size = sz;
+		return data;
+	}
+	unsigned char* out = base && data
+		? apply_delta(base, base_size, data, sz, size) : NULL;
+	free(base);
+	free(data);
+	*type = base_type;
+	return out;
+}
+
+static unsigned char* read_loose(git_odb* odb, const unsigned char sha[GIT_SHA_SIZE],
+				 int* type, size_t* size)
+{
+	char hex[2 * GIT_SHA_SIZE + 1];
+	for (int i = 0; i < GIT_SHA_SIZE; i++)
+		sprintf(hex + 2 * i, "%02x", sha[i]);
+	char* path = stralloc("%s/%.2s/%s", odb->objects, hex, hex + 2);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd == -1) return NULL;
+	struct stat st;
+	void* raw = fstat(fd, &st) == 0 && st.st_size
+		? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (raw == MAP_FAILED) return NULL;
+
+	size_t len;
+	unsigned char* data = inflate_all(raw, st.st_size, 0, &len);
+	munmap(raw, st.st_size);
+	if (!data) return NULL;
+
+	// "<type> <size>\0" then the contents
+	unsigned char* nul = memchr(data, '\0', len);
+	static const char* names[] = { NULL, "commit ", "tree ", "blob ", "tag " };
+	*type = 0;
+	for (int i = GIT_COMMIT; i <= GIT_TAG && nul; i++)
+		if (!strncmp((char*)data, names[i], strlen(names[i])))
+			*type = i;
+	if (!nul || !*type)
+	{
+		free(data);
+		return NULL;
+	}
+	*size = len - (nul + 1 - data);
+	memmove(data, nul + 1, *size + 1);
+	return data;
+}
+
+unsigned char* odb_read(git_odb* odb, const unsigned char sha[GIT_SHA_SIZE],
+			int* type, size_t* size)
+{
+	for (int i = 0; i < odb->packs.len; i++)
+	{
+		size_t offset;
+		const pack* p = &odb->packs.items[i];
+		if (find_packed(p, sha, &offset))
+			return read_packed(odb, p, offset, type, size, 0);
+	}
+	return read_loose(odb, sha, type, size);
+}
+
+static bool resolve_ref(const char* common, const char* ref,
+			unsigned char sha[GIT_SHA_SIZE], int depth)
+{
+	if (depth > 5) return false;
+	char* path = stralloc("%s/%s", common, ref);
+	char* text = read_text(path);
+	free(path);
+	if (text)
+	{
+		bool ok = !strncmp(text, "ref: ", 5)
+			? resolve_ref(common, text + 5, sha, depth + 1)
+			: parse_hex(text, sha);
+		free(text);
+		return ok;
+	}
+
+	// "<sha> <ref>" lines, peeled tags start with '^'
+	path = stralloc("%s/packed-refs", common);
+	FILE* fp = fopen(path, "re");
+	free(path);
+	if (!fp) return false;
+	bool found = false;
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	int ref_len = strlen(ref);
+	while (!found && (len = getline(&line, &cap, fp)) > 0)
+	{
+		if (line[len - 1] == '\n') line[--len] = '\0';
+		if (len != 2 * GIT_SHA_SIZE + 1 + ref_len) continue;
+		if (strcmp(line + 2 * GIT_SHA_SIZE + 1, ref)) continue;
+		found = parse_hex(line, sha);
+	}
+	free(line);
+	fclose(fp);
+	return found;
+}
+
+bool git_head(const char* gitdir, unsigned char sha[GIT_SHA_SIZE])
+{
+	char* path = stralloc("%s/HEAD", gitdir);
+	char* text = read_text(path);
+	free(path);
+	if (!text) return false;
+	bool ok;
+	if (!strncmp(text, "ref: ", 5))
+	{
+		char* common = common_dir(gitdir);
+		// HEAD itself is per work tree, the branches are shared
+		ok = resolve_ref(common, text + 5, sha, 0) ||
+			resolve_ref(gitdir, text + 5, sha, 0);
+		free(common);
+	}
+	else
+		ok = parse_hex(text, sha);
+	free(text);
+	return ok;
+}
+
+typedef struct
+{
+	unsigned mode;
+	const char* name;
+	const unsigned char* sha;
+} tree_entry;
+
+// the next entry of a tree object, "<octal mode> <name>\0<sha>"
+static bool next_tree_entry(const unsigned char** p, const unsigned char* end,
+			    tree_entry* e)
+{
+	const unsigned char* space = memchr(*p, ' ', end - *p);
+	if (!space) return false;
+	const unsigned char* nul = memchr(space, '\0', end - space);
+	if (!nul || nul + 1 + GIT_SHA_SIZE > end) return false;
+	e->mode = strtoul((const char*)*p, NULL, 8);
+	e->name = (const char*)space + 1;
+	e->sha = nul + 1;
+	*p = nul + 1 + GIT_SHA_SIZE;
+	return true;
+}
+
+static void flatten(git_odb* odb, const unsigned char sha[GIT_SHA_SIZE],
+		    const char* base, git_files* out)
+{
+	int type;
+	size_t size;
+	unsigned char* tree = odb_read(odb, sha, &type, &size);
+	if (!tree) return;
+	if (type != GIT_TREE)
+	{
+		free(tree);
+		return;
+	}
+	const unsigned char* p = tree;
+	tree_entry e;
+	while (next_tree_entry(&p, tree + size, &e))
+	{
+		char* path = stralloc("%s%s", base, e.name);
+		if (e.mode == 040000)
+		{
+			char* dir = stralloc("%s/", path);
+			flatten(odb, e.sha, dir, out);
+			free(dir);
+			free(path);
+			continue;
+		}
+		git_file f = { path, e.mode, {0} };
+		memcpy(f.sha, e.sha, GIT_SHA_SIZE);
+		da_append(*out, f);
+	}
+	free(tree);
+}
+
+static int compare_git_files(const void* a, const void* b)
+{
+	return strcmp(((const git_file*)a)->path, ((const git_file*)b)->path);
+}
+
+bool git_tree_files(git_odb* odb, const unsigned char commit[GIT_SHA_SIZE],
+		    const char* prefix, git_files* out)
+{
+	int type;
+	size_t size;
+	unsigned char* obj = odb_read(odb, commit, &type, &size);
+	unsigned char sha[GIT_SHA_SIZE];
+	bool ok = obj && type == GIT_COMMIT && !strncmp((char*)obj, "tree ", 5) &&
+		parse_hex((char*)obj + 5, sha);
+	free(obj);
+	if (!ok) return false;
+
+	// down to the tree of prefix, one component at a time
+	const char* rest = prefix;
+	while (*rest)
+	{
+		const char* slash = strchr(rest, '/');
+		int len = slash ? slash - rest : (int)strlen(rest);
+		obj = odb_read(odb, sha, &type, &size);
+		if (!obj) return false;
+		bool found = false;
+		const unsigned char* p = obj;
+		tree_entry e;
+		while (type == GIT_TREE && !found &&
+		       next_tree_entry(&p, obj + size, &e))
+		{
+			if (e.mode != 040000 || strncmp(e.name, rest, len) ||
+			    e.name[len])
+				continue;
+			memcpy(sha, e.sha, GIT_SHA_SIZE);
+			found = true;
+		}
+		free(obj);
+		// not in HEAD, nothing below it is either
+		if (!found) return true;
+		rest += slash ? len + 1 : len;
+	}
+
+	flatten(odb, sha, prefix, out);
+	qsort(out->items, out->len, sizeof(*out->items), compare_git_files);
+	return true;
+}
+
+void free_git_files(git_files* files)
+{
+	for (int i = 0; i < files->len; i++)
+		free(files->items[i].path);
+	free(files->items);
+	files->items = NULL;
+	files->len = files->cap = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef GITOBJ_H_
+#define GITOBJ_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "da.h"
+
+// just enough of git's object store to read the tree of HEAD: loose
+// objects and packs (index v2), deltas included. objects are inflated
+// with zlib.
+
+#define GIT_SHA_SIZE 20
+
+#define GIT_COMMIT 1
+#define GIT_TREE 2
+#define GIT_BLOB 3
+#define GIT_TAG 4
+
+typedef struct
+{
+	uint32_t h[5];
+	uint64_t len;
+	unsigned char block[64];
+} sha1_ctx;
+
+void sha1_init(sha1_ctx* c);
+void sha1_update(sha1_ctx* c, const void* data, size_t n);
+void sha1_final(sha1_ctx* c, unsigned char out[GIT_SHA_SIZE]);
+
+typedef struct
+{
+	char* path;
+	unsigned mode;
+	unsigned char sha[GIT_SHA_SIZE];
+} git_file;
+
+typedef DA(git_file) git_files;
+
+typedef struct git_odb git_odb;
+
+// the objects of the repository at gitdir, NULL if there are none
+git_odb* odb_open(const char* gitdir);
+void odb_close(git_odb* odb);
+
+// the inflated object, NULL if it is missing or broken
+unsigned char* odb_read(git_odb* odb, const unsigned char sha[GIT_SHA_SIZE],
+			int* type, size_t* size);
+
+// the commit HEAD points at, false on an unborn branch
+bool git_head(const char* gitdir, unsigned char sha[GIT_SHA_SIZE]);
+
+// every file below prefix (empty or ending in '/') in the tree of
+// commit, with their full paths, sorted bytewise like the index
+bool git_tree_files(git_odb* odb, const unsigned char commit[GIT_SHA_SIZE],
+		    const char* prefix, git_files* out);
+
+void free_git_files(git_files* files);
+
+#endif
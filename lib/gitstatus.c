@@ -0,0 +1,967 @@
+#include "gitstatus.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "da.h"
+#include "pool.h"
+#include "gitobj.h"
+
+// entries between checks for closing
+#define CANCEL_STEP 256
+// requests waiting behind the running one, older ones are dropped
+#define GIT_QUEUED 2
+
+#define FLAG_ASSUME_VALID 0x8000
+#define FLAG_EXTENDED 0x4000
+#define FLAG_STAGE 0x3000
+#define EXT_SKIP_WORKTREE 0x4000
+
+#define MODE_TYPE 0170000
+#define MODE_FILE 0100000
+#define MODE_LINK 0120000
+#define MODE_GITLINK 0160000
+
+typedef struct
+{
+	char* path;
+	uint32_t ctime_s, ctime_ns;
+	uint32_t mtime_s, mtime_ns;
+	uint32_t ino, mode, uid, gid, size;
+	unsigned char sha[GIT_SHA_SIZE];
+	uint16_t flags;
+	uint16_t ext;
+} git_entry;
+
+typedef struct
+{
+	char* worktree;
+	char* gitdir;
+	git_odb* odb;
+	// the index as of index_st
+	struct stat index_st;
+	DA(git_entry) index;
+	// the files of HEAD below head_prefix
+	bool has_head;
+	unsigned char head[GIT_SHA_SIZE];
+	char* head_prefix;
+	git_files head_files;
+	unsigned long long used;
+} repo;
+
+typedef struct
+{
+	char* name;
+	char state[3];
+} git_mark;
+
+struct git_listing
+{
+	char* path;
+	// of the listing the marks are for, 0 before any arrived
+	unsigned long generation;
+	// the listing asked for last
+	unsigned long requested;
+	bool in_repo;
+	// from a request dropped before it ran
+	bool dropped;
+	DA(git_mark) marks;
+	unsigned long long used;
+};
+
+typedef struct
+{
+	git_status* gs;
+	char* path;
+	unsigned long generation;
+} request;
+
+typedef struct
+{
+	char* pattern;
+	// the directory of the .gitignore, relative to the work tree
+	char* base;
+	bool negate;
+	bool dir_only;
+	bool anchored;
+} ignore_rule;
+
+typedef DA(ignore_rule) ignore_rules;
+
+struct git_status
+{
+	pthread_mutex_t lock;
+	// one worker, requests run one after the other
+	pool* pool;
+	atomic_bool closing;
+	// only touched by the worker
+	repo repos[GIT_REPOS_CACHED];
+	unsigned long long repo_clock;
+	// under the lock
+	bool running;
+	DA(request*) queue;
+	DA(git_listing*) done;
+	// only touched by the caller
+	git_listing* listings[GIT_LISTINGS_CACHED];
+	unsigned long long listing_clock;
+};
+
+static uint32_t be32(const unsigned char* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const unsigned char* p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static bool stopped(git_status* gs)
+{
+	return atomic_load(&gs->closing);
+}
+
+static void free_index_entries(repo* r)
+{
+	for (int i = 0; i < r->index.len; i++)
+		free(r->index.items[i].path);
+	free(r->index.items);
+	r->index.items = NULL;
+	r->index.len = r->index.cap = 0;
+}
+
+static void free_repo(repo* r)
+{
+	free_index_entries(r);
+	free_git_files(&r->head_files);
+	odb_close(r->odb);
+	free(r->worktree);
+	free(r->gitdir);
+	free(r->head_prefix);
+	*r = (repo){0};
+}
+
+static void free_listing(git_listing* gl)
+{
+	if (!gl) return;
+	for (int i = 0; i < gl->marks.len; i++)
+		free(gl->marks.items[i].name);
+	free(gl->marks.items);
+	free(gl->path);
+	free(gl);
+}
+
+static void free_request(request* req)
+{
+	if (!req) return;
+	free(req->path);
+	free(req);
+}
+
+// versions 2 to 4, v4 paths are stored as a prefix shared with the one
+// before and the rest
+static bool parse_index(repo* r, const unsigned char* data, size_t size)
+{
+	if (size < 12 + GIT_SHA_SIZE || memcmp(data, "DIRC", 4)) return false;
+	uint32_t version = be32(data + 4);
+	uint32_t count = be32(data + 8);
+	if (version < 2 || version > 4) return false;
+
+	const unsigned char* p = data + 12;
+	const unsigned char* end = data + size - GIT_SHA_SIZE;
+	const char* prev = "";
+	da_construct(r->index, count ? count : 1);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (p + 62 > end) return false;
+		git_entry e = {0};
+		e.ctime_s = be32(p);
+		e.ctime_ns = be32(p + 4);
+		e.mtime_s = be32(p + 8);
+		e.mtime_ns = be32(p + 12);
+		e.ino = be32(p + 20);
+		e.mode = be32(p + 24);
+		e.uid = be32(p + 28);
+		e.gid = be32(p + 32);
+		e.size = be32(p + 36);
+		memcpy(e.sha, p + 40, GIT_SHA_SIZE);
+		e.flags = be16(p + 60);
+
+		const unsigned char* name = p + 62;
+		if (e.flags & FLAG_EXTENDED)
+		{
+			if (version < 3 || name + 2 > end) return false;
+			e.ext = be16(name);
+			name += 2;
+		}
+
+		size_t strip = 0;
+		if (version == 4)
+		{
+			unsigned c = name < end ? *name++ : 0;
+			strip = c & 0x7f;
+			while (c & 0x80 && name < end)
+			{
+				c = *name++;
+				strip = ((strip + 1) << 7) | (c & 0x7f);
+			}
+		}
+		if (name >= end) return false;
+		const unsigned char* nul = memchr(name, '\0', end - name);
+		if (!nul) return false;
+		size_t kept = version == 4 ? strlen(prev) : 0;
+		if (strip > kept) return false;
+		kept -= strip;
+		e.path = stralloc("%.*s%s", (int)kept, prev, (const char*)name);
+		da_append(r->index, e);
+		prev = e.path;
+
+		if (version == 4)
+			p = nul + 1;
+		else
+			p += ((nul + 1 - p) + 7) & ~7;
+	}
+	return true;
+}
+
+static void load_index(repo* r)
+{
+	char* path = stralloc("%s/index", r->gitdir);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	struct stat st = {0};
+	if (fd != -1 && fstat(fd, &st) != 0) st = (struct stat){0};
+	if (r->index.items && st.st_ino == r->index_st.st_ino &&
+	    st.st_size == r->index_st.st_size &&
+	    st.st_mtim.tv_sec == r->index_st.st_mtim.tv_sec &&
+	    st.st_mtim.tv_nsec == r->index_st.st_mtim.tv_nsec)
+	{
+		if (fd != -1) close(fd);
+		return;
+	}
+
+	free_index_entries(r);
+	r->index_st = st;
+	void* data = fd != -1 && st.st_size
+		? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (fd != -1) close(fd);
+	if (data != MAP_FAILED)
+	{
+		if (!parse_index(r, data, st.st_size)) free_index_entries(r);
+		munmap(data, st.st_size);
+	}
+	// an empty or broken index still counts as loaded
+	if (!r->index.items) da_construct(r->index, 1);
+}
+
+static void load_head(repo* r, const char* prefix)
+{
+	unsigned char head[GIT_SHA_SIZE];
+	bool has_head = git_head(r->gitdir, head);
+	if (r->head_prefix && !strcmp(r->head_prefix, prefix) &&
+	    has_head == r->has_head &&
+	    (!has_head || !memcmp(head, r->head, GIT_SHA_SIZE)))
+		return;
+
+	free_git_files(&r->head_files);
+	free(r->head_prefix);
+	r->head_prefix = strdup(prefix);
+	r->has_head = has_head;
+	memcpy(r->head, head, GIT_SHA_SIZE);
+	da_construct(r->head_files, 64);
+	if (has_head) git_tree_files(r->odb, head, prefix, &r->head_files);
+}
+
+// the work tree holding path and its git directory
+static bool find_worktree(const char* path, char** worktree, char** gitdir)
+{
+	// inside the git directory itself there's nothing to show
+	if (strstr(path, "/.git/") ||
+	    (strlen(path) >= 5 && !strcmp(path + strlen(path) - 5, "/.git")))
+		return false;
+
+	char* dir = strdup(path);
+	while (true)
+	{
+		char* dotgit = stralloc("%s/.git", strcmp(dir, "/") ? dir : "");
+		struct stat st;
+		if (lstat(dotgit, &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			*worktree = dir;
+			*gitdir = dotgit;
+			return true;
+		}
+		if (lstat(dotgit, &st) == 0 && S_ISREG(st.st_mode))
+		{
+			// a linked work tree or a submodule, "gitdir: <path>"
+			FILE* fp = fopen(dotgit, "re");
+			char* line = NULL;
+			size_t cap = 0;
+			ssize_t len = fp ? getline(&line, &cap, fp) : -1;
+			if (fp) fclose(fp);
+			while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+				line[--len] = '\0';
+			bool ok = len > 8 && !strncmp(line, "gitdir: ", 8);
+			if (ok)
+			{
+				*worktree = dir;
+				*gitdir = line[8] == '/'
+					? strdup(line + 8) : stralloc("%s/%s", dir, line + 8);
+			}
+			free(line);
+			free(dotgit);
+			if (ok) return true;
+			free(dir);
+			return false;
+		}
+		free(dotgit);
+		if (!strcmp(dir, "/")) break;
+		char* slash = strrchr(dir, '/');
+		if (slash == dir)
+			dir[1] = '\0';
+		else
+			*slash = '\0';
+	}
+	free(dir);
+	return false;
+}
+
+static repo* get_repo(git_status* gs, const char* path)
+{
+	char* worktree;
+	char* gitdir;
+	if (!find_worktree(path, &worktree, &gitdir)) return NULL;
+
+	repo* slot = &gs->repos[0];
+	for (int i = 0; i < GIT_REPOS_CACHED; i++)
+	{
+		repo* r = &gs->repos[i];
+		if (r->worktree && !strcmp(r->worktree, worktree))
+		{
+			slot = r;
+			break;
+		}
+		if (r->used < slot->used) slot = r;
+	}
+	slot->used = ++gs->repo_clock;
+	if (slot->worktree && !strcmp(slot->worktree, worktree))
+	{
+		free(worktree);
+		free(gitdir);
+		return slot;
+	}
+	free_repo(slot);
+	slot->worktree = worktree;
+	slot->gitdir = gitdir;
+	slot->odb = odb_open(gitdir);
+	slot->used = gs->repo_clock;
+	return slot;
+}
+
+static void add_rules(ignore_rules* rules, const char* file, const char* base)
+{
+	FILE* fp = fopen(file, "re");
+	if (!fp) return;
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	while ((len = getline(&line, &cap, fp)) > 0)
+	{
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+			       (line[len - 1] == ' ' &&
+				(len < 2 || line[len - 2] != '\\'))))
+			line[--len] = '\0';
+		if (!len || line[0] == '#') continue;
+
+		ignore_rule rule = {0};
+		char* p = line;
+		if (*p == '!')
+		{
+			rule.negate = true;
+			p++;
+		}
+		else if (*p == '\\')
+			p++;
+		int plen = strlen(p);
+		if (plen && p[plen - 1] == '/')
+		{
+			rule.dir_only = true;
+			p[--plen] = '\0';
+		}
+		if (!plen) continue;
+		// a slash anywhere but at the end ties the pattern to base
+		rule.anchored = strchr(p, '/') != NULL;
+		if (*p == '/') p++;
+		rule.pattern = strdup(p);
+		rule.base = strdup(base);
+		da_append(*rules, rule);
+	}
+	free(line);
+	fclose(fp);
+}
+
+// the rules that apply below prefix, later ones take precedence
+static void load_rules(ignore_rules* rules, const repo* r, const char* prefix)
+{
+	char* file = stralloc("%s/info/exclude", r->gitdir);
+	add_rules(rules, file, "");
+	free(file);
+	file = stralloc("%s/.gitignore", r->worktree);
+	add_rules(rules, file, "");
+	free(file);
+	for (const char* slash = strchr(prefix, '/'); slash;
+	     slash = strchr(slash + 1, '/'))
+	{
+		char* base = strndup(prefix, slash - prefix + 1);
+		file = stralloc("%s/%s.gitignore", r->worktree, base);
+		add_rules(rules, file, base);
+		free(file);
+		free(base);
+	}
+}
+
+static void free_rules(ignore_rules* rules)
+{
+	for (int i = 0; i < rules->len; i++)
+	{
+		free(rules->items[i].pattern);
+		free(rules->items[i].base);
+	}
+	free(rules->items);
+}
+
+static bool rule_matches(const ignore_rule* rule, const char* rel, bool dir)
+{
+	int blen = strlen(rule->base);
+	if (strncmp(rel, rule->base, blen)) return false;
+	if (rule->dir_only && !dir) return false;
+	const char* sub = rel + blen;
+	if (rule->anchored)
+	{
+		// fnmatch has no "**", letting '*' cross slashes comes close
+		int flags = strstr(rule->pattern, "**") ? 0 : FNM_PATHNAME;
+		return fnmatch(rule->pattern, sub, flags) == 0;
+	}
+	const char* slash = strrchr(sub, '/');
+	return fnmatch(rule->pattern, slash ? slash + 1 : sub, 0) == 0;
+}
+
+static bool ignored(const ignore_rules* rules, const char* rel, bool dir)
+{
+	bool result = false;
+	for (int i = 0; i < rules->len; i++)
+		if (rule_matches(&rules->items[i], rel, dir))
+			result = !rules->items[i].negate;
+	return result;
+}
+
+// the contents of path hashed as a blob, the way git add would
+static bool hash_worktree(const char* path, const struct stat* st,
+			  unsigned char sha[GIT_SHA_SIZE])
+{
+	sha1_ctx c;
+	sha1_init(&c);
+	char header[32];
+	if (S_ISLNK(st->st_mode))
+	{
+		char target[PATH_MAX];
+		ssize_t len = readlink(path, target, sizeof(target));
+		if (len < 0) return false;
+		sha1_update(&c, header,
+			    sprintf(header, "blob %zd", len) + 1);
+		sha1_update(&c, target, len);
+		sha1_final(&c, sha);
+		return true;
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	sha1_update(&c, header,
+		    sprintf(header, "blob %lld", (long long)st->st_size) + 1);
+	bool ok = true;
+	if (st->st_size)
+	{
+		void* data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			ok = false;
+		else
+		{
+			madvise(data, st->st_size, MADV_SEQUENTIAL);
+			sha1_update(&c, data, st->st_size);
+			munmap(data, st->st_size);
+		}
+	}
+	close(fd);
+	sha1_final(&c, sha);
+	return ok;
+}
+
+// the work tree against the index: stat data first, the contents only
+// when that can't tell, like git's own stat cache
+static char worktree_state(const repo* r, const git_entry* e)
+{
+	if (e->flags & FLAG_ASSUME_VALID || e->ext & EXT_SKIP_WORKTREE)
+		return ' ';
+	if ((e->mode & MODE_TYPE) == MODE_GITLINK) return ' ';
+
+	char* path = stralloc("%s/%s", r->worktree, e->path);
+	struct stat st;
+	char state = ' ';
+	if (lstat(path, &st) != 0)
+	{
+		free(path);
+		return 'D';
+	}
+
+	bool is_link = (e->mode & MODE_TYPE) == MODE_LINK;
+	if (is_link != S_ISLNK(st.st_mode) ||
+	    (!is_link && !S_ISREG(st.st_mode)))
+		state = 'T';
+	else if (!is_link && !(e->mode & 0100) != !(st.st_mode & 0100))
+		state = 'M';
+	else if (e->size != (uint32_t)st.st_size)
+		state = 'M';
+	else
+	{
+		bool same_stat = e->mtime_s == (uint32_t)st.st_mtim.tv_sec &&
+			e->mtime_ns == (uint32_t)st.st_mtim.tv_nsec &&
+			e->ctime_s == (uint32_t)st.st_ctim.tv_sec &&
+			e->ctime_ns == (uint32_t)st.st_ctim.tv_nsec &&
+			e->ino == (uint32_t)st.st_ino &&
+			e->uid == (uint32_t)st.st_uid &&
+			e->gid == (uint32_t)st.st_gid;
+		// written in the same instant as the index, a change right
+		// after wouldn't show in the stat data
+		const struct timespec* written = &r->index_st.st_mtim;
+		bool racy = e->mtime_s > (uint32_t)written->tv_sec ||
+			(e->mtime_s == (uint32_t)written->tv_sec &&
+			 e->mtime_ns >= (uint32_t)written->tv_nsec);
+		unsigned char sha[GIT_SHA_SIZE];
+		if ((!same_stat || racy) &&
+		    (!hash_worktree(path, &st, sha) ||
+		     memcmp(sha, e->sha, GIT_SHA_SIZE)))
+			state = 'M';
+	}
+	free(path);
+	return state;
+}
+
+static int compare_git_file_path(const void* key, const void* item)
+{
+	return strcmp(key, ((const git_file*)item)->path);
+}
+
+static int compare_entry_path(const void* key, const void* item)
+{
+	return strcmp(key, ((const git_entry*)item)->path);
+}
+
+// the index against HEAD
+static char index_state(const repo* r, const git_entry* e)
+{
+	if (e->flags & FLAG_STAGE) return 'U';
+	const git_file* f = bsearch(e->path, r->head_files.items,
+				    r->head_files.len, sizeof(*f),
+				    compare_git_file_path);
+	if (!f) return 'A';
+	if (f->mode != e->mode || memcmp(f->sha, e->sha, GIT_SHA_SIZE))
+		return 'M';
+	return ' ';
+}
+
+static int compare_marks(const void* a, const void* b)
+{
+	return strcmp(((const git_mark*)a)->name, ((const git_mark*)b)->name);
+}
+
+static int compare_mark_name(const void* key, const void* item)
+{
+	return strcmp(key, ((const git_mark*)item)->name);
+}
+
+// the first component of path below prefix, what the listing shows
+static void add_mark(git_listing* gl, const char* path, int plen,
+		     char x, char y)
+{
+	if (x == ' ' && y == ' ') return;
+	const char* rest = path + plen;
+	const char* slash = strchr(rest, '/');
+	git_mark m = { slash ? strndup(rest, slash - rest) : strdup(rest),
+		       { x, y, '\0' } };
+	da_append(gl->marks, m);
+}
+
+// sorts the marks, a directory gets the first change of each kind found
+// below it
+static void merge_marks(git_listing* gl)
+{
+	qsort(gl->marks.items, gl->marks.len, sizeof(*gl->marks.items),
+	      compare_marks);
+	int out = 0;
+	for (int i = 0; i < gl->marks.len; i++)
+	{
+		git_mark* m = &gl->marks.items[i];
+		git_mark* last = out ? &gl->marks.items[out - 1] : NULL;
+		if (!last || strcmp(last->name, m->name))
+		{
+			gl->marks.items[out++] = *m;
+			continue;
+		}
+		for (int k = 0; k < 2; k++)
+			if (last->state[k] == ' ') last->state[k] = m->state[k];
+		free(m->name);
+	}
+	gl->marks.len = out;
+}
+
+static int compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// the entries of the listing that git doesn't track, untracked or ignored
+static void mark_untracked(git_status* gs, git_listing* gl, const char* prefix,
+			   char** tracked, int n_tracked,
+			   const ignore_rules* rules)
+{
+	DIR* d = opendir(gl->path);
+	if (!d) return;
+	// everything below an ignored directory is ignored
+	bool all_ignored = false;
+	for (const char* slash = strchr(prefix, '/'); slash && !all_ignored;
+	     slash = strchr(slash + 1, '/'))
+	{
+		char* dir = strndup(prefix, slash - prefix);
+		all_ignored = ignored(rules, dir, true);
+		free(dir);
+	}
+
+	// the marks of tracked entries are sorted, the rest go after them
+	int sorted = gl->marks.len;
+	struct dirent* dir_entry;
+	for (int n = 0; (dir_entry = readdir(d)); n++)
+	{
+		if (n % CANCEL_STEP == 0 && stopped(gs)) break;
+		const char* name = dir_entry->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..") ||
+		    !strcmp(name, ".git"))
+			continue;
+		if (bsearch(&name, tracked, n_tracked, sizeof(*tracked),
+			    compare_names) ||
+		    bsearch(name, gl->marks.items, sorted,
+			    sizeof(*gl->marks.items), compare_mark_name))
+			continue;
+
+		bool dir = dir_entry->d_type == DT_DIR;
+		if (dir_entry->d_type == DT_UNKNOWN)
+		{
+			struct stat st;
+			dir = fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+				S_ISDIR(st.st_mode);
+		}
+		char* rel = stralloc("%s%s", prefix, name);
+		bool ignore = all_ignored || ignored(rules, rel, dir);
+		free(rel);
+		git_mark m = { strdup(name), { '?', '?', '\0' } };
+		if (ignore) m.state[0] = m.state[1] = '!';
+		da_append(gl->marks, m);
+	}
+	closedir(d);
+}
+
+// the index entries below prefix, a range as the index is sorted
+static int first_below(const repo* r, const char* prefix)
+{
+	int lo = 0, hi = r->index.len;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (strcmp(r->index.items[mid].path, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static git_listing* compute(git_status* gs, const request* req)
+{
+	git_listing* gl = calloc(1, sizeof(*gl));
+	if (!gl) alloc_failed();
+	gl->path = strdup(req->path);
+	gl->generation = req->generation;
+	da_construct(gl->marks, 16);
+
+	repo* r = get_repo(gs, req->path);
+	if (!r) return gl;
+	gl->in_repo = true;
+	const char* below = req->path + strlen(r->worktree);
+	if (*below == '/') below++;
+	char* prefix = *below ? stralloc("%s/", below) : strdup("");
+	int plen = strlen(prefix);
+
+	load_index(r);
+	load_head(r, prefix);
+
+	DA(char*) tracked;
+	da_construct(tracked, 64);
+	for (int i = first_below(r, prefix); i < r->index.len; i++)
+	{
+		const git_entry* e = &r->index.items[i];
+		if (strncmp(e->path, prefix, plen)) break;
+		if (i % CANCEL_STEP == 0 && stopped(gs)) break;
+		// a sparse index keeps whole directories as one entry
+		if ((e->mode & MODE_TYPE) == 0040000) continue;
+
+		const char* rest = e->path + plen;
+		const char* slash = strchr(rest, '/');
+		int len = slash ? slash - rest : (int)strlen(rest);
+		char* last = tracked.len ? tracked.items[tracked.len - 1] : NULL;
+		if (!last || strncmp(last, rest, len) || last[len])
+			da_append(tracked, strndup(rest, len));
+
+		char x = index_state(r, e);
+		char y = x == 'U' ? 'U' : worktree_state(r, e);
+		add_mark(gl, e->path, plen, x, y);
+	}
+	// deleted from the index but still in HEAD
+	for (int i = 0; i < r->head_files.len && !stopped(gs); i++)
+	{
+		const git_file* f = &r->head_files.items[i];
+		if (!bsearch(f->path, r->index.items, r->index.len,
+			     sizeof(*r->index.items), compare_entry_path))
+			add_mark(gl, f->path, plen, 'D', ' ');
+	}
+	merge_marks(gl);
+
+	qsort(tracked.items, tracked.len, sizeof(*tracked.items), compare_names);
+	ignore_rules rules;
+	da_construct(rules, 16);
+	load_rules(&rules, r, prefix);
+	if (!stopped(gs))
+		mark_untracked(gs, gl, prefix, tracked.items, tracked.len, &rules);
+	qsort(gl->marks.items, gl->marks.len, sizeof(*gl->marks.items),
+	      compare_marks);
+
+	free_rules(&rules);
+	for (int i = 0; i < tracked.len; i++)
+		free(tracked.items[i]);
+	free(tracked.items);
+	free(prefix);
+	return gl;
+}
+
+static void run_request(void* arg)
+{
+	request* req = arg;
+	git_status* gs = req->gs;
+	git_listing* gl = compute(gs, req);
+	free_request(req);
+
+	pthread_mutex_lock(&gs->lock);
+	da_append(gs->done, gl);
+	request* next = NULL;
+	if (gs->queue.len && !stopped(gs))
+	{
+		next = gs->queue.items[0];
+		memmove(gs->queue.items, gs->queue.items + 1,
+			sizeof(*gs->queue.items) * --gs->queue.len);
+	}
+	gs->running = next != NULL;
+	if (next) pool_submit(gs->pool, run_request, next);
+	pthread_mutex_unlock(&gs->lock);
+}
+
+git_status* git_status_create(void)
+{
+	git_status* gs = calloc(1, sizeof(*gs));
+	if (!gs) alloc_failed();
+	pthread_mutex_init(&gs->lock, NULL);
+	gs->pool = pool_create(1);
+	atomic_init(&gs->closing, false);
+	da_construct(gs->queue, GIT_QUEUED + 1);
+	da_construct(gs->done, 4);
+	return gs;
+}
+
+void git_status_destroy(git_status* gs)
+{
+	// the running request stops at its next check, the rest never run
+	atomic_store(&gs->closing, true);
+	pool_destroy(gs->pool);
+	for (int i = 0; i < gs->queue.len; i++)
+		free_request(gs->queue.items[i]);
+	free(gs->queue.items);
+	for (int i = 0; i < gs->done.len; i++)
+		free_listing(gs->done.items[i]);
+	free(gs->done.items);
+	for (int i = 0; i < GIT_LISTINGS_CACHED; i++)
+		free_listing(gs->listings[i]);
+	for (int i = 0; i < GIT_REPOS_CACHED; i++)
+		free_repo(&gs->repos[i]);
+	pthread_mutex_destroy(&gs->lock);
+	free(gs);
+}
+
+static git_listing** find_listing(git_status* gs, const char* path)
+{
+	for (int i = 0; i < GIT_LISTINGS_CACHED; i++)
+		if (gs->listings[i] && !strcmp(gs->listings[i]->path, path))
+			return &gs->listings[i];
+	return NULL;
+}
+
+// a slot for path, the least recently shown listing makes room
+static git_listing** new_listing(git_status* gs, const char* path)
+{
+	git_listing** slot = &gs->listings[0];
+	for (int i = 0; i < GIT_LISTINGS_CACHED; i++)
+	{
+		git_listing** gl = &gs->listings[i];
+		if (!*gl)
+		{
+			slot = gl;
+			break;
+		}
+		if ((*gl)->used < (*slot)->used) slot = gl;
+	}
+	free_listing(*slot);
+	*slot = calloc(1, sizeof(**slot));
+	if (!*slot) alloc_failed();
+	(*slot)->path = strdup(path);
+	da_construct((*slot)->marks, 1);
+	return slot;
+}
+
+static void submit(git_status* gs, const char* path, unsigned long generation)
+{
+	// without a thread to compute it on the column stays empty
+	if (!gs->pool) return;
+	request* req = malloc(sizeof(*req));
+	if (!req) alloc_failed();
+	*req = (request){ gs, strdup(path), generation };
+
+	pthread_mutex_lock(&gs->lock);
+	if (!gs->running)
+	{
+		gs->running = true;
+		pool_submit(gs->pool, run_request, req);
+		pthread_mutex_unlock(&gs->lock);
+		return;
+	}
+	// a newer listing of the same path makes the queued one pointless
+	for (int i = 0; i < gs->queue.len; i++)
+	{
+		if (strcmp(gs->queue.items[i]->path, req->path)) continue;
+		free_request(gs->queue.items[i]);
+		gs->queue.items[i] = req;
+		req = NULL;
+		break;
+	}
+	if (req) da_append(gs->queue, req);
+	// only the latest few listings shown are still worth computing
+	if (gs->queue.len > GIT_QUEUED)
+	{
+		request* oldest = gs->queue.items[0];
+		memmove(gs->queue.items, gs->queue.items + 1,
+			sizeof(*gs->queue.items) * --gs->queue.len);
+		git_listing* gl = calloc(1, sizeof(*gl));
+		if (!gl) alloc_failed();
+		gl->path = oldest->path;
+		gl->generation = oldest->generation;
+		gl->dropped = true;
+		oldest->path = NULL;
+		free_request(oldest);
+		da_append(gs->done, gl);
+	}
+	pthread_mutex_unlock(&gs->lock);
+}
+
+// the listing of path, asked again when the listing it's shown in is
+// read again
+static const git_listing* listing_at(git_status* gs, const char* path,
+				     unsigned long generation)
+{
+	git_listing** slot = find_listing(gs, path);
+	if (!slot) slot = new_listing(gs, path);
+	git_listing* gl = *slot;
+	gl->used = ++gs->listing_clock;
+	if (gl->requested != generation)
+	{
+		gl->requested = generation;
+		submit(gs, path, generation);
+	}
+	return gl->generation && gl->in_repo ? gl : NULL;
+}
+
+const git_listing* git_listing_of(git_status* gs, const directory* dir)
+{
+	if (dir->label || dir->virtualized || !dir->path) return NULL;
+	return listing_at(gs, dir->path, dir->generation);
+}
+
+const git_listing* git_listing_below(git_status* gs, const directory* dir,
+				     const char* name)
+{
+	if (dir->label || dir->virtualized || !dir->path) return NULL;
+	const char* slash = strrchr(name, '/');
+	if (!slash) return git_listing_of(gs, dir);
+	char* path = stralloc("%s/%.*s", dir->path, (int)(slash - name), name);
+	const git_listing* gl = listing_at(gs, path, dir->generation);
+	free(path);
+	return gl;
+}
+
+const char* git_state(const git_listing* gl, const char* name)
+{
+	const git_mark* m = bsearch(name, gl->marks.items, gl->marks.len,
+				    sizeof(*gl->marks.items), compare_mark_name);
+	return m ? m->state : NULL;
+}
+
+bool git_status_poll(git_status* gs)
+{
+	pthread_mutex_lock(&gs->lock);
+	bool any = gs->done.len > 0;
+	for (int i = 0; i < gs->done.len; i++)
+	{
+		git_listing* result = gs->done.items[i];
+		git_listing** slot = find_listing(gs, result->path);
+		if (result->dropped)
+		{
+			// asked again whenever it's shown next
+			if (slot && (*slot)->requested == result->generation)
+				(*slot)->requested = 0;
+			free_listing(result);
+			continue;
+		}
+		if (!slot)
+		{
+			slot = new_listing(gs, result->path);
+			result->requested = result->generation;
+		}
+		else
+			result->requested = (*slot)->requested;
+		result->used = (*slot)->used;
+		free_listing(*slot);
+		*slot = result;
+	}
+	gs->done.len = 0;
+	pthread_mutex_unlock(&gs->lock);
+	return any;
+}
+
+bool git_status_busy(git_status* gs)
+{
+	pthread_mutex_lock(&gs->lock);
+	bool busy = gs->running || gs->done.len;
+	pthread_mutex_unlock(&gs->lock);
+	return busy;
+}
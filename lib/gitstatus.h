@@ -0,0 +1,44 @@
+#ifndef GITSTATUS_H_
+#define GITSTATUS_H_
+
+#include <stdbool.h>
+#include "directory.h"
+
+// the git state of the entries of a listing, computed in the background
+// the way git status does: the index is compared against the stat data
+// of the work tree (hashing only what changed or is racily clean) and
+// against the tree of HEAD. the parsed index and HEAD are cached per
+// repository until the index changes.
+
+// repositories whose index and HEAD stay parsed
+#define GIT_REPOS_CACHED 4
+// listings whose state is kept, the least recently shown goes first.
+// each expanded directory on screen takes one
+#define GIT_LISTINGS_CACHED 64
+
+typedef struct git_status git_status;
+typedef struct git_listing git_listing;
+
+git_status* git_status_create(void);
+void git_status_destroy(git_status* gs);
+
+// the state of the entries of dir. until the state of this listing is
+// ready the last known one of its path is returned, NULL if there is
+// none yet or dir isn't in a work tree
+const git_listing* git_listing_of(git_status* gs, const directory* dir);
+
+// the same for the directory holding the entry name of dir, which is
+// below it when expanded, its entries are looked up by shown_name()
+const git_listing* git_listing_below(git_status* gs, const directory* dir,
+				     const char* name);
+
+// two letters like the short format of git status ("M ", " M", "??",
+// "!!"...), NULL for an entry that is tracked and unchanged
+const char* git_state(const git_listing* gl, const char* name);
+
+// takes in what finished in the background, true if anything did
+bool git_status_poll(git_status* gs);
+
+bool git_status_busy(git_status* gs);
+
+#endif
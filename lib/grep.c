@@ -0,0 +1,530 @@
+#include "grep.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pool.h"
+
+// the most regexec is given at once
+#define GREP_REGEX_WINDOW (1 << 30)
+
+struct grep_search
+{
+	char* pattern;
+	int flags;
+	// what every match contains, the whole pattern unless it's a regex
+	char* literal;
+	int literal_len;
+	// the byte of literal looked for with memchr, and where it sits
+	unsigned char rare;
+	int rare_at;
+	// the directory the paths are relative to
+	int base;
+	pool* p;
+	// jobs submitted and not finished, a directory's jobs are counted
+	// before it finishes so this only reaches 0 at the very end
+	atomic_int outstanding;
+	atomic_bool cancel;
+	atomic_llong searched;
+	atomic_llong failed;
+	pthread_mutex_t lock;
+	grep_hits hits;
+};
+
+typedef struct
+{
+	grep_search* gs;
+	char* path;
+} dir_job;
+
+typedef struct
+{
+	grep_search* gs;
+	int n;
+	char* paths[GREP_BATCH];
+} file_batch;
+
+// roughly how often a byte turns up in text and code, higher is more
+static int commonness(unsigned char c)
+{
+	if (c == ' ' || c == 'e' || c == 't') return 4;
+	if (c && strchr("aoinsrhldcu", c)) return 3;
+	if (isalnum(c) || (c && strchr("_.,;:()=-\"'/", c))) return 2;
+	return 1;
+}
+
+static bool quantifier(char c)
+{
+	return c == '*' || c == '+' || c == '?' || c == '{';
+}
+
+// the longest run of plain characters every match of an extended regex
+// has to contain, NULL if there is none that is certain. patterns with
+// alternation or groups aren't looked into
+static char* required_literal(const char* pattern)
+{
+	if (strpbrk(pattern, "|()")) return NULL;
+	size_t len = strlen(pattern);
+	char* best = calloc(len + 1, 1);
+	char* run = calloc(len + 1, 1);
+	if (!best || !run) alloc_failed();
+	int best_len = 0;
+	int run_len = 0;
+	for (const char* p = pattern; *p; p++)
+	{
+		char c = *p;
+		bool literal = true;
+		if (c == '\\')
+		{
+			// escaped specials are plain, other escapes are classes
+			literal = p[1] && strchr(".[]*+?{}^$\\", p[1]);
+			if (p[1]) c = *++p;
+		}
+		else if (c == '[')
+		{
+			literal = false;
+			const char* end = p + 1;
+			if (*end == '^') end++;
+			if (*end == ']') end++;
+			// [:digit:], [=e=] and [.-.] close with a ']' of their own
+			while (*end && *end != ']')
+			{
+				if (end[0] != '[' || !end[1] || !strchr(":=.", end[1]))
+				{
+					end++;
+					continue;
+				}
+				char close[3] = { end[1], ']', '\0' };
+				const char* found = strstr(end + 2, close);
+				end = found ? found + 2 : end + strlen(end);
+			}
+			if (!*end) break;
+			p = end;
+		}
+		else if (c == '{')
+		{
+			literal = false;
+			const char* end = strchr(p, '}');
+			if (!end) break;
+			p = end;
+		}
+		else if (c == '.' || c == '^' || c == '$' || quantifier(c))
+			literal = false;
+
+		// a character that may be left out ends the run before it, one
+		// that may repeat the run after it
+		bool optional = p[1] == '*' || p[1] == '?' || p[1] == '{';
+		if (literal && !optional) run[run_len++] = c;
+		if (!literal || optional || p[1] == '+')
+		{
+			if (run_len > best_len)
+			{
+				memcpy(best, run, run_len);
+				best_len = run_len;
+				best[best_len] = '\0';
+			}
+			run_len = 0;
+		}
+	}
+	if (run_len > best_len)
+	{
+		memcpy(best, run, run_len);
+		best[run_len] = '\0';
+		best_len = run_len;
+	}
+	free(run);
+	if (best_len) return best;
+	free(best);
+	return NULL;
+}
+
+// the first place at or after from the literal is at, -1 if nowhere
+static long long find_literal(const grep_search* gs, const char* text,
+			      size_t size, size_t from)
+{
+	size_t pos = from + gs->rare_at;
+	while (pos < size)
+	{
+		const char* at = memchr(text + pos, gs->rare, size - pos);
+		if (!at) return -1;
+		size_t start = at - text - gs->rare_at;
+		if (start + gs->literal_len <= size &&
+		    !memcmp(text + start, gs->literal, gs->literal_len))
+			return start;
+		pos = at - text + 1;
+	}
+	return -1;
+}
+
+// regexec on [start, end) of text, in windows ending at a line end as
+// match offsets are only ints
+static long long find_regex(const regex_t* re, const char* text,
+			    size_t start, size_t end)
+{
+	while (start < end)
+	{
+		size_t stop = end - start > GREP_REGEX_WINDOW
+			? start + GREP_REGEX_WINDOW : end;
+		const char* nl = stop < end
+			? memrchr(text + start, '\n', stop - start) : NULL;
+		if (nl) stop = nl - text + 1;
+		regmatch_t m = { 0, stop - start };
+		if (regexec(re, text + start, 1, &m, REG_STARTEND) == 0)
+			return start + m.rm_so;
+		start = stop;
+	}
+	return -1;
+}
+
+// where the first match starts, -1 if there is none. re is NULL for a
+// literal search
+static long long find_match(const grep_search* gs, const regex_t* re,
+			    const char* text, size_t size)
+{
+	if (!gs->literal_len) return find_regex(re, text, 0, size);
+	long long at;
+	size_t from = 0;
+	while (from < size && (at = find_literal(gs, text, size, from)) >= 0)
+	{
+		if (!re) return at;
+		// the regex only has to be tried on the lines with the literal
+		const char* start = memrchr(text, '\n', at);
+		const char* end = memchr(text + at, '\n', size - at);
+		size_t line = start ? start - text + 1 : 0;
+		size_t line_end = end ? (size_t)(end - text) : size;
+		long long match = find_regex(re, text, line, line_end);
+		if (match >= 0) return match;
+		from = line_end + 1;
+	}
+	return -1;
+}
+
+static void fill_hit(grep_hit* hit, const char* path, const char* text,
+		     size_t size, size_t at)
+{
+	hit->path = strdup(path);
+	hit->line = 1;
+	const char* line = text;
+	for (const char* nl; (nl = memchr(line, '\n', text + at - line));
+	     line = nl + 1)
+		hit->line++;
+	const char* end = memchr(text + at, '\n', size - at);
+	if (!end) end = text + size;
+	while (line < end && isspace((unsigned char)*line))
+		line++;
+
+	int len = end - line;
+	if (len > GREP_PREVIEW_MAX)
+	{
+		// not in the middle of a UTF-8 sequence
+		len = GREP_PREVIEW_MAX;
+		while (len && ((unsigned char)line[len] & 0xc0) == 0x80)
+			len--;
+	}
+	hit->text = malloc(len + 1);
+	if (!hit->text) alloc_failed();
+	for (int i = 0; i < len; i++)
+	{
+		unsigned char c = line[i];
+		hit->text[i] = c < 0x20 || c == 0x7f ? ' ' : c;
+	}
+	hit->text[len] = '\0';
+}
+
+// buf holds GREP_MMAP_MIN bytes, files smaller than that are read into it
+static bool search_file(grep_search* gs, const regex_t* re, const char* path,
+			char* buf, grep_hit* hit)
+{
+	int fd = openat(gs->base, path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) != 0)
+	{
+		atomic_fetch_add(&gs->failed, 1);
+		if (fd != -1) close(fd);
+		return false;
+	}
+	size_t size = S_ISREG(st.st_mode) ? st.st_size : 0;
+	bool mapped = size >= GREP_MMAP_MIN;
+	void* data = NULL;
+	if (mapped)
+	{
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) data = NULL;
+		else madvise(data, size, MADV_SEQUENTIAL);
+	}
+	else if (size)
+	{
+		ssize_t got = read(fd, buf, size);
+		// it may have shrunk since the fstat
+		data = got > 0 ? buf : NULL;
+		size = got > 0 ? (size_t)got : 0;
+	}
+	close(fd);
+	atomic_fetch_add(&gs->searched, 1);
+	if (size && !data)
+		atomic_fetch_add(&gs->failed, 1);
+	if (!data) return false;
+
+	const char* text = data;
+	size_t check = size < GREP_BINARY_CHECK ? size : GREP_BINARY_CHECK;
+	long long at = memchr(text, '\0', check)
+		? -1 : find_match(gs, re, text, size);
+	if (at >= 0) fill_hit(hit, path, text, size, at);
+	if (mapped) munmap(data, size);
+	return at >= 0;
+}
+
+static void search_batch(void* arg)
+{
+	file_batch* b = arg;
+	grep_search* gs = b->gs;
+	// regexec locks the pattern it runs, every job gets a copy
+	regex_t re;
+	bool compiled = !atomic_load(&gs->cancel) && (gs->flags & GREP_REGEX) &&
+		regcomp(&re, gs->pattern, REG_EXTENDED | REG_NEWLINE) == 0;
+
+	char* buf = malloc(GREP_MMAP_MIN);
+	if (!buf) alloc_failed();
+	grep_hit found[GREP_BATCH];
+	int n = 0;
+	for (int i = 0; i < b->n; i++)
+	{
+		bool wanted = !atomic_load(&gs->cancel) &&
+			(compiled || !(gs->flags & GREP_REGEX));
+		if (wanted &&
+		    search_file(gs, compiled ? &re : NULL, b->paths[i], buf,
+				&found[n]))
+			n++;
+		free(b->paths[i]);
+	}
+	if (compiled) regfree(&re);
+	free(buf);
+
+	pthread_mutex_lock(&gs->lock);
+	for (int i = 0; i < n; i++)
+		da_append(gs->hits, found[i]);
+	pthread_mutex_unlock(&gs->lock);
+	free(b);
+	atomic_fetch_sub(&gs->outstanding, 1);
+}
+
+static void submit_batch(grep_search* gs, file_batch* b)
+{
+	atomic_fetch_add(&gs->outstanding, 1);
+	pool_submit(gs->p, search_batch, b);
+}
+
+static file_batch* new_batch(grep_search* gs)
+{
+	file_batch* b = malloc(sizeof(*b));
+	if (!b) alloc_failed();
+	b->gs = gs;
+	b->n = 0;
+	return b;
+}
+
+static void search_dir(void* arg);
+
+static void submit_dir(grep_search* gs, char* path)
+{
+	dir_job* job = malloc(sizeof(*job));
+	if (!job) alloc_failed();
+	*job = (dir_job){ gs, path };
+	atomic_fetch_add(&gs->outstanding, 1);
+	pool_submit(gs->p, search_dir, job);
+}
+
+static void search_dir(void* arg)
+{
+	dir_job* job = arg;
+	grep_search* gs = job->gs;
+	int fd = atomic_load(&gs->cancel) ? -1
+		: openat(gs->base, job->path,
+			 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR* dir = fd == -1 ? NULL : fdopendir(fd);
+	if (!dir && fd != -1) close(fd);
+	if (!dir && !atomic_load(&gs->cancel))
+		atomic_fetch_add(&gs->failed, 1);
+
+	file_batch* b = new_batch(gs);
+	struct dirent* de;
+	while (dir && !atomic_load(&gs->cancel) && (de = readdir(dir)))
+	{
+		const char* name = de->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+		int type = de->d_type;
+		struct stat st;
+		if (type == DT_UNKNOWN &&
+		    fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+			type = S_ISDIR(st.st_mode) ? DT_DIR
+				: S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		if (type != DT_DIR && type != DT_REG) continue;
+		if (type == DT_DIR && !strcmp(name, ".git")) continue;
+
+		char* path = strcmp(job->path, ".")
+			? stralloc("%s/%s", job->path, name) : strdup(name);
+		if (type == DT_DIR)
+		{
+			submit_dir(gs, path);
+			continue;
+		}
+		b->paths[b->n++] = path;
+		if (b->n == GREP_BATCH)
+		{
+			submit_batch(gs, b);
+			b = new_batch(gs);
+		}
+	}
+	if (b->n)
+		submit_batch(gs, b);
+	else
+		free(b);
+	if (dir) closedir(dir);
+	free(job->path);
+	free(job);
+	atomic_fetch_sub(&gs->outstanding, 1);
+}
+
+grep_search* grep_start(const char* pattern, int flags,
+			const char* const* roots, int n, reporter* rep)
+{
+	if (!*pattern)
+	{
+		report_error(rep, pattern, "nothing to search for", EINVAL);
+		return NULL;
+	}
+	if (flags & GREP_REGEX)
+	{
+		regex_t re;
+		int err = regcomp(&re, pattern, REG_EXTENDED | REG_NEWLINE);
+		if (err)
+		{
+			char what[256];
+			regerror(err, &re, what, sizeof(what));
+			report_error(rep, pattern, what, EINVAL);
+			return NULL;
+		}
+		regfree(&re);
+	}
+	int base = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (base == -1)
+	{
+		report_error(rep, ".", "failed to open", errno);
+		return NULL;
+	}
+	pool* p = pool_create(0);
+	if (!p)
+	{
+		report_error(rep, ".", "failed to start threads", errno);
+		close(base);
+		return NULL;
+	}
+
+	grep_search* gs = calloc(1, sizeof(*gs));
+	if (!gs) alloc_failed();
+	gs->pattern = strdup(pattern);
+	gs->flags = flags;
+	gs->literal = flags & GREP_REGEX
+		? required_literal(pattern) : strdup(pattern);
+	gs->literal_len = gs->literal ? strlen(gs->literal) : 0;
+	for (int i = 0; i < gs->literal_len; i++)
+	{
+		unsigned char c = gs->literal[i];
+		if (i && commonness(c) >= commonness(gs->rare)) continue;
+		gs->rare = c;
+		gs->rare_at = i;
+	}
+	gs->base = base;
+	atomic_init(&gs->outstanding, 0);
+	atomic_init(&gs->cancel, false);
+	atomic_init(&gs->searched, 0);
+	atomic_init(&gs->failed, 0);
+	pthread_mutex_init(&gs->lock, NULL);
+	da_construct(gs->hits, 64);
+	gs->p = p;
+
+	file_batch* b = new_batch(gs);
+	for (int i = 0; i < n; i++)
+	{
+		struct stat st;
+		if (fstatat(base, roots[i], &st, 0) != 0)
+		{
+			report_error(rep, roots[i], "failed to stat", errno);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode))
+			submit_dir(gs, strdup(roots[i]));
+		else if (S_ISREG(st.st_mode))
+			b->paths[b->n++] = strdup(roots[i]);
+		if (b->n == GREP_BATCH)
+		{
+			submit_batch(gs, b);
+			b = new_batch(gs);
+		}
+	}
+	if (b->n)
+		submit_batch(gs, b);
+	else
+		free(b);
+	return gs;
+}
+
+void grep_destroy(grep_search* gs)
+{
+	if (!gs) return;
+	// what is still queued returns right away
+	atomic_store(&gs->cancel, true);
+	pool_destroy(gs->p);
+	free_hits(&gs->hits);
+	pthread_mutex_destroy(&gs->lock);
+	close(gs->base);
+	free(gs->pattern);
+	free(gs->literal);
+	free(gs);
+}
+
+bool grep_poll(grep_search* gs, grep_hits* hits)
+{
+	pthread_mutex_lock(&gs->lock);
+	bool any = gs->hits.len > 0;
+	for (int i = 0; i < gs->hits.len; i++)
+		da_append(*hits, gs->hits.items[i]);
+	gs->hits.len = 0;
+	pthread_mutex_unlock(&gs->lock);
+	return any;
+}
+
+bool grep_busy(grep_search* gs)
+{
+	if (atomic_load(&gs->outstanding)) return true;
+	pthread_mutex_lock(&gs->lock);
+	bool busy = gs->hits.len > 0;
+	pthread_mutex_unlock(&gs->lock);
+	return busy;
+}
+
+void grep_counts(grep_search* gs, long long* searched, long long* failed)
+{
+	*searched = atomic_load(&gs->searched);
+	*failed = atomic_load(&gs->failed);
+}
+
+void free_hits(grep_hits* hits)
+{
+	for (int i = 0; i < hits->len; i++)
+	{
+		free(hits->items[i].path);
+		free(hits->items[i].text);
+	}
+	free(hits->items);
+	hits->items = NULL;
+	hits->len = 0;
+	hits->cap = 0;
+}
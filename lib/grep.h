@@ -0,0 +1,60 @@
+#ifndef GREP_H_
+#define GREP_H_
+
+#include <stdbool.h>
+#include "da.h"
+#include "report.h"
+
+// searches file contents in the background, like grep -rl. directories
+// are read by jobs of their own on a pool, the files they hold searched
+// in batches, large ones mmap'd whole and small ones read in one go. a
+// literal (or the part of a regex every match has to contain) is looked
+// for with memchr on its rarest byte first, only files that have it get
+// a regexec. files with a NUL byte in their first block are taken for
+// binaries and skipped, as are .git directories and symlinks below the
+// roots.
+
+#define GREP_REGEX 1
+
+// checked for NUL bytes, like grep does
+#define GREP_BINARY_CHECK 8192
+// smaller files are read, mapping them costs more than the copy
+#define GREP_MMAP_MIN (64 << 10)
+// files searched by one job
+#define GREP_BATCH 32
+// previews are cut to this many bytes
+#define GREP_PREVIEW_MAX 160
+
+typedef struct
+{
+	char* path;
+	// the first match, its line with control characters blanked out
+	int line;
+	char* text;
+} grep_hit;
+
+typedef DA(grep_hit) grep_hits;
+
+typedef struct grep_search grep_search;
+
+// starts searching the files under roots (relative to the cwd, which
+// the search doesn't depend on once started). NULL, with the reason
+// reported, if the regex doesn't compile
+grep_search* grep_start(const char* pattern, int flags,
+			const char* const* roots, int n, reporter* rep);
+
+// stops the search, waiting only for the files being searched right now
+void grep_destroy(grep_search* gs);
+
+// appends the hits found since the last call to hits, true if any were
+bool grep_poll(grep_search* gs, grep_hits* hits);
+
+// true until every hit has been polled
+bool grep_busy(grep_search* gs);
+
+// files searched so far and the ones that couldn't be read
+void grep_counts(grep_search* gs, long long* searched, long long* failed);
+
+void free_hits(grep_hits* hits);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef LIBFILED_H_
+#define LIBFILED_H_
+
+// the filed engine without any curses, for batch jobs and tooling
+
+#include "da.h"
+#include "report.h"
+#include "directory.h"
+#include "fileops.h"
+#include "prefetch.h"
+#include "buffers.h"
+#include "complete.h"
+#include "frecency.h"
+#include "dupes.h"
+#include "compare.h"
+#include "gitstatus.h"
+#include "archive.h"
+#include "renames.h"
+#include "attrs.h"
+#include "width.h"
+#include "grep.h"
+#include "pack.h"
+
+#endif
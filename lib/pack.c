@@ -0,0 +1,920 @@
+#include "pack.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+#include "da.h"
+#include "archive.h"
+#include "pool.h"
+
+extern char** environ;
+
+#define TAR_BLOCK 512
+// what a plain or zstd tar is written in at once
+#define WRITE_CHUNK (1 << 17)
+#define GZIP_LEVEL 6
+#define GZIP_HEADER_SIZE 10
+// the longest name (and link name) a ustar header holds
+#define TAR_NAME_MAX 100
+
+#define STAGE_COUNTING 0
+#define STAGE_PACKING 1
+#define STAGE_READING 2
+#define STAGE_EXTRACTING 3
+
+static const char* stages[] =
+{
+	"counting", "packing", "reading", "extracting",
+};
+
+// a piece of the tar deflated on the pool, see PACK_BLOCK
+typedef struct
+{
+	pack_job* j;
+	char* in;
+	int in_len;
+	// the end of the block before it
+	char* dict;
+	int dict_len;
+	char* out;
+	int out_cap;
+	int out_len;
+	unsigned long crc;
+	bool last;
+	// submitted and not deflated yet, guarded by the job's lock
+	bool busy;
+	bool failed;
+} gz_block;
+
+// the first file seen of those with more than one link, the others
+// become hard links to it
+typedef struct
+{
+	dev_t dev;
+	ino_t ino;
+	char* path;
+} first_link;
+
+struct pack_job
+{
+	// what is packed into (or unpacked from) and where to
+	char* src;
+	char* dst;
+	char** roots;
+	int n;
+	// the directory roots and dst are relative to when packing
+	int base;
+	int format;
+	// the archive, and where the tar goes: the archive or zstd's stdin
+	int out;
+	struct stat out_st;
+	int fd;
+	pid_t child;
+	// what isn't written yet, chunk bytes at most. for a .tar.gz it's
+	// the block being filled
+	char* buffer;
+	int buffered;
+	int chunk;
+	long long written;
+
+	pool* p;
+	gz_block* blocks;
+	int n_blocks;
+	int filling;
+	// the block written out next, and how many were submitted after it
+	int oldest;
+	int queued;
+	unsigned long crc;
+	unsigned long long in_total;
+
+	DA(first_link) links;
+	// a write failed, nothing more goes out
+	bool broken;
+
+	pthread_t thread;
+	bool started;
+	atomic_bool cancel;
+	atomic_bool running;
+	atomic_int stage;
+	atomic_llong done;
+	atomic_llong total;
+
+	// guards the blocks and the errors
+	pthread_mutex_t lock;
+	pthread_cond_t deflated;
+	int failed;
+	char* error_path;
+	char* error_what;
+	int error_err;
+};
+
+static void fail(pack_job* j, const char* path, const char* what, int err)
+{
+	pthread_mutex_lock(&j->lock);
+	if (!j->failed++)
+	{
+		j->error_path = strdup(path);
+		j->error_what = strdup(what);
+		j->error_err = err;
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+static bool stopped(pack_job* j)
+{
+	return j->broken || atomic_load(&j->cancel);
+}
+
+static bool write_all(int fd, const void* buf, long long n)
+{
+	const char* p = buf;
+	while (n > 0)
+	{
+		ssize_t put = write(fd, p, n);
+		if (put < 0 && errno == EINTR) continue;
+		if (put < 0) return false;
+		p += put;
+		n -= put;
+	}
+	return true;
+}
+
+static void write_out(pack_job* j, const void* buf, long long n)
+{
+	if (j->broken) return;
+	if (write_all(j->fd, buf, n)) return;
+	fail(j, j->dst, "failed to write", errno);
+	j->broken = true;
+}
+
+static void deflate_block(void* arg)
+{
+	gz_block* b = arg;
+	pack_job* j = b->j;
+	z_stream z = {0};
+	bool ok = !atomic_load(&j->cancel) &&
+		deflateInit2(&z, GZIP_LEVEL, Z_DEFLATED, -MAX_WBITS, 8,
+			     Z_DEFAULT_STRATEGY) == Z_OK;
+	bool initialized = ok;
+	if (ok && b->dict_len)
+		deflateSetDictionary(&z, (const Bytef*)b->dict, b->dict_len);
+	if (ok)
+	{
+		z.next_in = (Bytef*)b->in;
+		z.avail_in = b->in_len;
+		z.next_out = (Bytef*)b->out;
+		z.avail_out = b->out_cap;
+		// a sync flush ends the block on a byte boundary, so the next
+		// one can simply follow it
+		int r = deflate(&z, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+		ok = b->last ? r == Z_STREAM_END
+			: r == Z_OK && !z.avail_in && z.avail_out;
+		b->out_len = z.total_out;
+	}
+	if (initialized) deflateEnd(&z);
+	b->crc = crc32(0, (const Bytef*)b->in, b->in_len);
+
+	pthread_mutex_lock(&j->lock);
+	b->busy = false;
+	b->failed = !ok;
+	pthread_cond_broadcast(&j->deflated);
+	pthread_mutex_unlock(&j->lock);
+}
+
+// waits for the oldest block submitted and writes it out
+static void write_oldest(pack_job* j)
+{
+	gz_block* b = &j->blocks[j->oldest];
+	pthread_mutex_lock(&j->lock);
+	while (b->busy)
+		pthread_cond_wait(&j->deflated, &j->lock);
+	pthread_mutex_unlock(&j->lock);
+	if (b->failed && !j->broken)
+	{
+		if (!atomic_load(&j->cancel))
+			fail(j, j->dst, "failed to compress", EIO);
+		j->broken = true;
+	}
+	write_out(j, b->out, b->out_len);
+	j->crc = crc32_combine(j->crc, b->crc, b->in_len);
+	j->in_total += b->in_len;
+	j->oldest = (j->oldest + 1) % j->n_blocks;
+	j->queued--;
+}
+
+// hands the block being filled to the pool and starts the next one
+static void submit_block(pack_job* j, bool last)
+{
+	gz_block* b = &j->blocks[j->filling];
+	b->in_len = j->buffered;
+	b->last = last;
+	b->busy = true;
+	j->queued++;
+	pool_submit(j->p, deflate_block, b);
+	if (last) return;
+
+	j->filling = (j->filling + 1) % j->n_blocks;
+	if (j->queued == j->n_blocks) write_oldest(j);
+	gz_block* next = &j->blocks[j->filling];
+	next->dict_len = b->in_len < PACK_DICT ? b->in_len : PACK_DICT;
+	memcpy(next->dict, b->in + b->in_len - next->dict_len, next->dict_len);
+	j->buffer = next->in;
+	j->buffered = 0;
+}
+
+static void flush_chunk(pack_job* j)
+{
+	if (j->p)
+		submit_block(j, false);
+	else
+	{
+		write_out(j, j->buffer, j->buffered);
+		j->buffered = 0;
+	}
+}
+
+// everything the tar consists of goes through here
+static void put(pack_job* j, const void* data, long long len)
+{
+	const char* at = data;
+	while (len > 0 && !j->broken)
+	{
+		long long room = j->chunk - j->buffered;
+		long long n = len < room ? len : room;
+		memcpy(j->buffer + j->buffered, at, n);
+		j->buffered += n;
+		j->written += n;
+		at += n;
+		len -= n;
+		if (j->buffered == j->chunk) flush_chunk(j);
+	}
+}
+
+static void put_zeros(pack_job* j, long long len)
+{
+	while (len > 0 && !j->broken)
+	{
+		long long room = j->chunk - j->buffered;
+		long long n = len < room ? len : room;
+		memset(j->buffer + j->buffered, 0, n);
+		j->buffered += n;
+		j->written += n;
+		len -= n;
+		if (j->buffered == j->chunk) flush_chunk(j);
+	}
+}
+
+// up to left bytes of fd read right into the buffer, how many weren't.
+// -1 in err for a file that shrank
+static long long put_file(pack_job* j, int fd, long long left, int* err)
+{
+	*err = 0;
+	while (left > 0 && !stopped(j))
+	{
+		long long room = j->chunk - j->buffered;
+		ssize_t got = read(fd, j->buffer + j->buffered,
+				   left < room ? left : room);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0)
+		{
+			*err = got < 0 ? errno : -1;
+			break;
+		}
+		j->buffered += got;
+		j->written += got;
+		left -= got;
+		atomic_fetch_add(&j->done, got);
+		if (j->buffered == j->chunk) flush_chunk(j);
+	}
+	return left;
+}
+
+// the tar ends in two zero blocks, padded to a whole record
+static void finish_tar(pack_job* j)
+{
+	put_zeros(j, 2 * TAR_BLOCK);
+	put_zeros(j, (PACK_RECORD - j->written % PACK_RECORD) % PACK_RECORD);
+}
+
+// writes what is left and the trailer, waits for zstd to finish
+static void close_output(pack_job* j)
+{
+	if (j->p)
+	{
+		if (!j->broken) submit_block(j, true);
+		while (j->queued)
+			write_oldest(j);
+		unsigned char trailer[8];
+		unsigned long long n = j->in_total;
+		for (int i = 0; i < 4; i++)
+		{
+			trailer[i] = j->crc >> (8 * i);
+			trailer[4 + i] = n >> (8 * i);
+		}
+		if (!stopped(j)) write_out(j, trailer, sizeof(trailer));
+	}
+	else if (!stopped(j) && j->buffered)
+		write_out(j, j->buffer, j->buffered);
+
+	if (j->child)
+	{
+		// zstd finishes with what it got once its input ends
+		close(j->fd);
+		int status;
+		waitpid(j->child, &status, 0);
+		if (!stopped(j) && (!WIFEXITED(status) || WEXITSTATUS(status)))
+		{
+			fail(j, j->dst, "zstd failed", EIO);
+			j->broken = true;
+		}
+	}
+	if (close(j->out) != 0 && !stopped(j))
+	{
+		fail(j, j->dst, "failed to write", errno);
+		j->broken = true;
+	}
+}
+
+// octal and NUL terminated, false if value doesn't fit
+static bool tar_octal(char* field, int len, long long value)
+{
+	if (value < 0 || value >> (3 * (len - 1))) return false;
+	for (int i = len - 2; i >= 0; i--, value >>= 3)
+		field[i] = '0' + (value & 7);
+	field[len - 1] = '\0';
+	return true;
+}
+
+typedef DA(char) pax_text;
+
+// records are "<length> <key>=<value>\n", the length counting itself
+static void pax_record(pax_text* pax, const char* key, const char* value)
+{
+	int len = strlen(key) + strlen(value) + 3;
+	int digits = snprintf(NULL, 0, "%d", len);
+	if (snprintf(NULL, 0, "%d", len + digits) > digits) digits++;
+	char* record = stralloc("%d %s=%s\n", len + digits, key, value);
+	da_reserve(*pax, len + digits);
+	memcpy(pax->items + pax->len, record, len + digits);
+	pax->len += len + digits;
+	free(record);
+}
+
+// a numeric field, or a pax record for what doesn't fit in it
+static void tar_field(char* field, int len, long long value, pax_text* pax,
+		      const char* key)
+{
+	if (tar_octal(field, len, value)) return;
+	tar_octal(field, len, 0);
+	char number[32];
+	snprintf(number, sizeof(number), "%lld", value);
+	pax_record(pax, key, number);
+}
+
+static void seal_header(char* h)
+{
+	memset(h + 148, ' ', 8);
+	unsigned sum = 0;
+	for (int i = 0; i < TAR_BLOCK; i++)
+		sum += (unsigned char)h[i];
+	tar_octal(h + 148, 7, sum);
+}
+
+static void fill_header(char* h, const char* name, unsigned mode,
+			long long size, long long mtime, char type)
+{
+	memset(h, 0, TAR_BLOCK);
+	strncpy(h, name, TAR_NAME_MAX);
+	tar_octal(h + 100, 8, mode & 07777);
+	tar_octal(h + 108, 8, 0);
+	tar_octal(h + 116, 8, 0);
+	tar_octal(h + 124, 12, size);
+	tar_octal(h + 136, 12, mtime > 0 ? mtime : 0);
+	h[156] = type;
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+}
+
+// the header of name, preceded by a pax header for what ustar can't hold
+static void put_header(pack_job* j, const char* name, const struct stat* st,
+		       char type, const char* link)
+{
+	pax_text pax;
+	da_construct(pax, 256);
+	char h[TAR_BLOCK];
+	long long size = type == '0' ? st->st_size : 0;
+	fill_header(h, name, st->st_mode, 0, 0, type);
+	if (strlen(name) > TAR_NAME_MAX) pax_record(&pax, "path", name);
+	if (link)
+	{
+		strncpy(h + 157, link, TAR_NAME_MAX);
+		if (strlen(link) > TAR_NAME_MAX)
+			pax_record(&pax, "linkpath", link);
+	}
+	tar_field(h + 108, 8, st->st_uid, &pax, "uid");
+	tar_field(h + 116, 8, st->st_gid, &pax, "gid");
+	tar_field(h + 124, 12, size, &pax, "size");
+	tar_field(h + 136, 12, st->st_mtime, &pax, "mtime");
+	if (type == '3' || type == '4')
+	{
+		tar_octal(h + 329, 8, major(st->st_rdev));
+		tar_octal(h + 337, 8, minor(st->st_rdev));
+	}
+	seal_header(h);
+
+	if (pax.len)
+	{
+		const char* base = strrchr(name, '/');
+		char* pax_name = stralloc("PaxHeader/%s", base ? base + 1 : name);
+		char x[TAR_BLOCK];
+		fill_header(x, pax_name, 0644, pax.len, st->st_mtime, 'x');
+		seal_header(x);
+		free(pax_name);
+		put(j, x, TAR_BLOCK);
+		put(j, pax.items, pax.len);
+		put_zeros(j, (TAR_BLOCK - pax.len % TAR_BLOCK) % TAR_BLOCK);
+	}
+	put(j, h, TAR_BLOCK);
+	free(pax.items);
+}
+
+// the path already packed for another link to the same file, if any
+static const char* packed_link(pack_job* j, const struct stat* st,
+			       const char* path)
+{
+	if (st->st_nlink < 2) return NULL;
+	for (int i = 0; i < j->links.len; i++)
+		if (j->links.items[i].dev == st->st_dev &&
+		    j->links.items[i].ino == st->st_ino)
+			return j->links.items[i].path;
+	first_link first = { st->st_dev, st->st_ino, strdup(path) };
+	da_append(j->links, first);
+	return NULL;
+}
+
+static void pack_file(pack_job* j, int dir, const char* name,
+		      const char* path, struct stat* st)
+{
+	const char* target = packed_link(j, st, path);
+	if (target)
+	{
+		put_header(j, path, st, '1', target);
+		return;
+	}
+	int fd = openat(dir, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, st) != 0)
+	{
+		fail(j, path, "failed to open", errno);
+		if (fd != -1) close(fd);
+		return;
+	}
+	put_header(j, path, st, '0', NULL);
+	int err;
+	long long left = put_file(j, fd, st->st_size, &err);
+	close(fd);
+	if (stopped(j)) return;
+	// the header promised this much, what is missing becomes zeros
+	if (left)
+	{
+		if (err == -1)
+			fail(j, path, "file shrank while packing", EIO);
+		else
+			fail(j, path, "failed to read", err);
+		put_zeros(j, left);
+		atomic_fetch_add(&j->done, left);
+	}
+	put_zeros(j, (TAR_BLOCK - st->st_size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+static int compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void pack_path(pack_job* j, int dir, const char* name,
+		      const char* path, bool counting);
+
+// the entries of a directory go in sorted, the same tree always makes
+// the same archive
+static void pack_dir(pack_job* j, int dir, const char* name,
+		     const char* path, bool counting)
+{
+	int fd = openat(dir, name,
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	DIR* d = fd == -1 ? NULL : fdopendir(fd);
+	if (!d)
+	{
+		if (!counting) fail(j, path, "failed to open", errno);
+		if (fd != -1) close(fd);
+		return;
+	}
+	DA(char*) names;
+	da_construct(names, 32);
+	struct dirent* de;
+	while ((de = readdir(d)))
+		if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+			da_append(names, strdup(de->d_name));
+	qsort(names.items, names.len, sizeof(*names.items), compare_names);
+	for (int i = 0; i < names.len; i++)
+	{
+		char* below = stralloc("%s/%s", path, names.items[i]);
+		if (!stopped(j))
+			pack_path(j, fd, names.items[i], below, counting);
+		free(below);
+		free(names.items[i]);
+	}
+	free(names.items);
+	closedir(d);
+}
+
+// packs what name in dir is as path, or only adds up the sizes of the
+// files it holds
+static void pack_path(pack_job* j, int dir, const char* name,
+		      const char* path, bool counting)
+{
+	struct stat st;
+	if (fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+	{
+		if (!counting) fail(j, path, "failed to stat", errno);
+		return;
+	}
+	// the archive can be in what is packed
+	if (st.st_dev == j->out_st.st_dev && st.st_ino == j->out_st.st_ino)
+		return;
+	if (counting)
+	{
+		if (S_ISREG(st.st_mode)) atomic_fetch_add(&j->total, st.st_size);
+		if (S_ISDIR(st.st_mode)) pack_dir(j, dir, name, path, true);
+		return;
+	}
+	if (S_ISDIR(st.st_mode))
+	{
+		char* slashed = stralloc("%s/", path);
+		put_header(j, slashed, &st, '5', NULL);
+		free(slashed);
+		pack_dir(j, dir, name, path, false);
+	}
+	else if (S_ISREG(st.st_mode))
+		pack_file(j, dir, name, path, &st);
+	else if (S_ISLNK(st.st_mode))
+	{
+		char target[PATH_MAX];
+		ssize_t len = readlinkat(dir, name, target, sizeof(target) - 1);
+		if (len < 0)
+		{
+			fail(j, path, "failed to read link", errno);
+			return;
+		}
+		target[len] = '\0';
+		put_header(j, path, &st, '2', target);
+	}
+	else if (S_ISFIFO(st.st_mode))
+		put_header(j, path, &st, '6', NULL);
+	else if (S_ISCHR(st.st_mode))
+		put_header(j, path, &st, '3', NULL);
+	else if (S_ISBLK(st.st_mode))
+		put_header(j, path, &st, '4', NULL);
+	// sockets are left out, like tar does
+}
+
+// the job's thread writes to zstd, which may exit early
+static void ignore_sigpipe(void)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+static void* pack_main(void* arg)
+{
+	pack_job* j = arg;
+	ignore_sigpipe();
+	for (int i = 0; i < j->n && !stopped(j); i++)
+		pack_path(j, j->base, j->roots[i], j->roots[i], true);
+	atomic_store(&j->stage, STAGE_PACKING);
+	if (j->p)
+	{
+		unsigned char header[GZIP_HEADER_SIZE] =
+			{ 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+		write_out(j, header, sizeof(header));
+	}
+	for (int i = 0; i < j->n && !stopped(j); i++)
+		pack_path(j, j->base, j->roots[i], j->roots[i], false);
+	if (!stopped(j)) finish_tar(j);
+	close_output(j);
+	// don't leave half an archive behind
+	if (stopped(j)) unlinkat(j->base, j->dst, 0);
+	atomic_store(&j->running, false);
+	return NULL;
+}
+
+static pack_job* new_job(void)
+{
+	pack_job* j = calloc(1, sizeof(*j));
+	if (!j) alloc_failed();
+	j->base = -1;
+	j->out = -1;
+	j->fd = -1;
+	atomic_init(&j->cancel, false);
+	atomic_init(&j->running, true);
+	atomic_init(&j->stage, STAGE_COUNTING);
+	atomic_init(&j->done, 0);
+	atomic_init(&j->total, 0);
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->deflated, NULL);
+	return j;
+}
+
+static bool run_job(pack_job* j, void* (*fn)(void*), reporter* rep)
+{
+	int err = pthread_create(&j->thread, NULL, fn, j);
+	if (err)
+	{
+		report_error(rep, j->dst, "failed to start a thread", err);
+		return false;
+	}
+	j->started = true;
+	return true;
+}
+
+// pipes what goes into fd through zstd -T0 into out, which compresses
+// on as many threads as there are cpus
+static bool spawn_zstd(pack_job* j, reporter* rep)
+{
+	int pipe_fds[2];
+	if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+	{
+		report_error(rep, j->dst, "failed to create pipe", errno);
+		return false;
+	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipe_fds[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, j->out, STDOUT_FILENO);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+					 "/dev/null", O_WRONLY, 0);
+	char* argv[] = { "zstd", "-T0", "-q", "-c", NULL };
+	int err = posix_spawnp(&j->child, "zstd", &actions, NULL,
+			       argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipe_fds[0]);
+	if (err)
+	{
+		report_error(rep, j->dst, "failed to run zstd", err);
+		close(pipe_fds[1]);
+		j->child = 0;
+		return false;
+	}
+	j->fd = pipe_fds[1];
+	return true;
+}
+
+static bool create_blocks(pack_job* j)
+{
+	j->p = pool_create(0);
+	if (!j->p) return false;
+	j->n_blocks = PACK_DEPTH * pool_threads(j->p);
+	j->blocks = calloc(j->n_blocks, sizeof(*j->blocks));
+	if (!j->blocks) alloc_failed();
+	// the flush at the end of every block takes a few bytes more
+	int cap = compressBound(PACK_BLOCK) + 64;
+	for (int i = 0; i < j->n_blocks; i++)
+	{
+		gz_block* b = &j->blocks[i];
+		b->j = j;
+		b->in = malloc(PACK_BLOCK);
+		b->dict = malloc(PACK_DICT);
+		b->out = malloc(cap);
+		if (!b->in || !b->dict || !b->out) alloc_failed();
+		b->out_cap = cap;
+	}
+	j->crc = crc32(0, NULL, 0);
+	j->buffer = j->blocks[0].in;
+	j->chunk = PACK_BLOCK;
+	return true;
+}
+
+// undoes what pack_start did before its thread could take over
+static void abandon(pack_job* j)
+{
+	if (j->child)
+	{
+		// zstd exits once its input ends
+		close(j->fd);
+		waitpid(j->child, NULL, 0);
+	}
+	if (j->out != -1)
+	{
+		close(j->out);
+		unlinkat(j->base, j->dst, 0);
+	}
+	pack_destroy(j);
+}
+
+pack_job* pack_start(const char* dst, const char* const* roots, int n,
+		     reporter* rep)
+{
+	int format = archive_format(dst);
+	if (format != ARCHIVE_TAR && format != ARCHIVE_TAR_GZ &&
+	    format != ARCHIVE_TAR_ZST)
+	{
+		report_error(rep, dst, "can only pack into .tar, .tar.gz or "
+			     ".tar.zst", EINVAL);
+		return NULL;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		// they would be extracted outside of where they go
+		if (!strcmp(roots[i], "..") || !strncmp(roots[i], "../", 3))
+		{
+			report_error(rep, roots[i], "can't pack", EINVAL);
+			return NULL;
+		}
+	}
+	pack_job* j = new_job();
+	j->dst = strdup(dst);
+	j->format = format;
+	if (format == ARCHIVE_TAR_GZ && !create_blocks(j))
+	{
+		report_error(rep, dst, "failed to start threads", errno);
+		pack_destroy(j);
+		return NULL;
+	}
+	if (format != ARCHIVE_TAR_GZ)
+	{
+		j->buffer = malloc(WRITE_CHUNK);
+		if (!j->buffer) alloc_failed();
+		j->chunk = WRITE_CHUNK;
+	}
+	j->base = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (j->base == -1)
+		report_error(rep, ".", "failed to open", errno);
+	else
+	{
+		j->out = openat(j->base, dst, O_WRONLY | O_CREAT | O_EXCL |
+				O_CLOEXEC, 0644);
+		if (j->out == -1)
+			report_error(rep, dst, errno == EEXIST
+				     ? "refusing to overwrite"
+				     : "failed to create", errno);
+	}
+	if (j->out == -1 || fstat(j->out, &j->out_st) != 0 ||
+	    (format == ARCHIVE_TAR_ZST && !spawn_zstd(j, rep)))
+	{
+		abandon(j);
+		return NULL;
+	}
+	if (format != ARCHIVE_TAR_ZST) j->fd = j->out;
+
+	j->roots = malloc(sizeof(*j->roots) * n);
+	if (!j->roots) alloc_failed();
+	for (int i = 0; i < n; i++)
+		j->roots[i] = strdup(roots[i]);
+	j->n = n;
+	da_construct(j->links, 16);
+	if (!run_job(j, pack_main, rep))
+	{
+		abandon(j);
+		return NULL;
+	}
+	return j;
+}
+
+static bool unpack_error(void* data, const char* path, const char* what,
+			 int err)
+{
+	fail(data, path, what, err);
+	return true;
+}
+
+static bool unpack_progress(void* data, const char* path,
+			    long long done, long long total)
+{
+	(void)path;
+	pack_job* j = data;
+	atomic_store(&j->done, done);
+	atomic_store(&j->total, total);
+	return true;
+}
+
+static void* unpack_main(void* arg)
+{
+	pack_job* j = arg;
+	reporter rep = { unpack_error, unpack_progress, j, false, &j->cancel };
+	archive a;
+	if (open_archive(&a, j->src, &rep))
+	{
+		atomic_store(&j->done, 0);
+		atomic_store(&j->total, 0);
+		atomic_store(&j->stage, STAGE_EXTRACTING);
+		const char* all = ".";
+		extract_members(&a, "", &all, 1, j->dst, &rep);
+		free_archive(&a);
+	}
+	atomic_store(&j->running, false);
+	return NULL;
+}
+
+// the job outlives the cwd it was started in
+static char* absolute(const char* path)
+{
+	if (path[0] == '/') return strdup(path);
+	char* cwd = getcwd(NULL, 0);
+	if (!cwd) return NULL;
+	char* abs = stralloc("%s/%s", cwd, path);
+	free(cwd);
+	return abs;
+}
+
+pack_job* unpack_start(const char* src, const char* dst, reporter* rep)
+{
+	if (!archive_format(src))
+	{
+		report_error(rep, src, "not an archive", EINVAL);
+		return NULL;
+	}
+	if (mkdir(dst, 0755) != 0 && errno != EEXIST)
+	{
+		report_error(rep, dst, "failed to create", errno);
+		return NULL;
+	}
+	pack_job* j = new_job();
+	j->src = absolute(src);
+	j->dst = absolute(dst);
+	if (!j->src || !j->dst)
+	{
+		report_error(rep, ".", "failed to resolve", errno);
+		pack_destroy(j);
+		return NULL;
+	}
+	atomic_store(&j->stage, STAGE_READING);
+	if (!run_job(j, unpack_main, rep))
+	{
+		pack_destroy(j);
+		return NULL;
+	}
+	return j;
+}
+
+void pack_destroy(pack_job* j)
+{
+	if (!j) return;
+	atomic_store(&j->cancel, true);
+	if (j->started) pthread_join(j->thread, NULL);
+	if (j->p) pool_destroy(j->p);
+	for (int i = 0; i < j->n_blocks; i++)
+	{
+		free(j->blocks[i].in);
+		free(j->blocks[i].dict);
+		free(j->blocks[i].out);
+	}
+	if (!j->blocks) free(j->buffer);
+	free(j->blocks);
+	for (int i = 0; i < j->links.len; i++)
+		free(j->links.items[i].path);
+	free(j->links.items);
+	for (int i = 0; i < j->n; i++)
+		free(j->roots[i]);
+	free(j->roots);
+	if (j->base != -1) close(j->base);
+	pthread_mutex_destroy(&j->lock);
+	pthread_cond_destroy(&j->deflated);
+	free(j->error_path);
+	free(j->error_what);
+	free(j->src);
+	free(j->dst);
+	free(j);
+}
+
+bool pack_busy(pack_job* j)
+{
+	return atomic_load(&j->running);
+}
+
+const char* pack_stage(pack_job* j, long long* done, long long* total)
+{
+	*done = atomic_load(&j->done);
+	*total = atomic_load(&j->total);
+	return stages[atomic_load(&j->stage)];
+}
+
+bool pack_result(pack_job* j, reporter* rep, int* failed)
+{
+	pthread_mutex_lock(&j->lock);
+	*failed = j->failed;
+	if (j->failed)
+		report_error(rep, j->error_path, j->error_what, j->error_err);
+	pthread_mutex_unlock(&j->lock);
+	return !*failed;
+}
@@ -0,0 +1,48 @@
+#ifndef PACK_H_
+#define PACK_H_
+
+#include <stdbool.h>
+#include "report.h"
+
+// creates and unpacks archives in the background, one thread per job.
+// a new tar is written straight from the walk of what goes into it:
+// .tar.zst by piping it through zstd -T0, .tar.gz by deflating blocks
+// of it on a pool with the previous block's tail as their dictionary
+// (like pigz does) and writing them out in order as one gzip member.
+// unpacking goes through open_archive and extract_members.
+
+// the uncompressed tar handed to one deflate job
+#define PACK_BLOCK (1 << 18)
+// deflate's window, the dictionary a block starts with
+#define PACK_DICT (1 << 15)
+// blocks in flight per thread of the pool
+#define PACK_DEPTH 2
+// tar writes its output in records of this many bytes
+#define PACK_RECORD 10240
+
+typedef struct pack_job pack_job;
+
+// starts packing roots (relative to the cwd, which the job doesn't depend
+// on once started) into the new archive dst, its format going by its
+// name. NULL, with the reason reported, if dst can't be created
+pack_job* pack_start(const char* dst, const char* const* roots, int n,
+		     reporter* rep);
+
+// starts extracting all of the archive src into the directory dst,
+// which is created if it doesn't exist
+pack_job* unpack_start(const char* src, const char* dst, reporter* rep);
+
+// stops the job if it's still running, removing a half written archive
+void pack_destroy(pack_job* j);
+
+bool pack_busy(pack_job* j);
+
+// what the job is doing right now ("counting", "packing", "reading",
+// "extracting") and how far it got, total is 0 when unknown
+const char* pack_stage(pack_job* j, long long* done, long long* total);
+
+// once the job is done: the first error it ran into is reported to rep,
+// failed is how many there were. true if nothing failed
+bool pack_result(pack_job* j, reporter* rep, int* failed);
+
+#endif
@@ -0,0 +1,208 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "da.h"
+
+#define MAX_REPLACED 32
+
+typedef struct
+{
+	void (*fn)(void* arg);
+	void* arg;
+} job;
+
+typedef struct
+{
+	pool* p;
+	// argument of the job being run, NULL while idle
+	void* arg;
+	bool replaced;
+} worker;
+
+struct pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	DA(job) queue;
+	int head;
+	// owned by the pool so a stuck worker can be looked up safely
+	DA(worker*) workers;
+	int running;
+	int threads;
+	int replaced;
+	bool stopping;
+	// pool_destroy returned with stuck workers left, the last one frees
+	bool abandoned;
+};
+
+static void free_pool(pool* p)
+{
+	for (int i = 0; i < p->workers.len; i++)
+		free(p->workers.items[i]);
+	free(p->workers.items);
+	free(p->queue.items);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->work);
+	pthread_cond_destroy(&p->idle);
+	free(p);
+}
+
+static void* worker_main(void* arg)
+{
+	worker* w = arg;
+	pool* p = w->p;
+
+	pthread_mutex_lock(&p->lock);
+	while (true)
+	{
+		while (p->head == p->queue.len && !p->stopping)
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->head == p->queue.len) break;
+
+		job j = p->queue.items[p->head++];
+		if (p->head == p->queue.len)
+		{
+			p->head = 0;
+			p->queue.len = 0;
+		}
+		p->running++;
+		w->arg = j.arg;
+		pthread_mutex_unlock(&p->lock);
+
+		j.fn(j.arg);
+
+		pthread_mutex_lock(&p->lock);
+		w->arg = NULL;
+		if (w->replaced)
+		{
+			// its slot was already handed to another thread
+			p->replaced--;
+			break;
+		}
+		p->running--;
+		if (!p->running && p->head == p->queue.len)
+			pthread_cond_broadcast(&p->idle);
+	}
+	p->threads--;
+	bool last = p->abandoned && !p->threads;
+	pthread_cond_broadcast(&p->idle);
+	pthread_mutex_unlock(&p->lock);
+
+	if (last) free_pool(p);
+	return NULL;
+}
+
+static bool spawn_worker(pool* p)
+{
+	worker* w = calloc(1, sizeof(*w));
+	if (!w) return false;
+	w->p = p;
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, worker_main, w);
+	if (err)
+	{
+		errno = err;
+		free(w);
+		return false;
+	}
+	pthread_detach(thread);
+	da_append(p->workers, w);
+	p->threads++;
+	return true;
+}
+
+pool* pool_create(int threads)
+{
+	if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0) threads = 1;
+
+	pool* p = calloc(1, sizeof(*p));
+	if (!p) alloc_failed();
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->idle, NULL);
+	da_construct(p->queue, 64);
+	da_construct(p->workers, threads);
+
+	pthread_mutex_lock(&p->lock);
+	for (int i = 0; i < threads; i++)
+		spawn_worker(p);
+	pthread_mutex_unlock(&p->lock);
+	if (!p->threads)
+	{
+		int err = errno;
+		free_pool(p);
+		errno = err;
+		return NULL;
+	}
+	return p;
+}
+
+void pool_submit(pool* p, void (*fn)(void* arg), void* arg)
+{
+	pthread_mutex_lock(&p->lock);
+	da_append(p->queue, ((job){ fn, arg }));
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_wait(pool* p)
+{
+	pthread_mutex_lock(&p->lock);
+	while (p->running || p->head != p->queue.len)
+		pthread_cond_wait(&p->idle, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_destroy(pool* p)
+{
+	if (!p) return;
+	pthread_mutex_lock(&p->lock);
+	p->stopping = true;
+	pthread_cond_broadcast(&p->work);
+	// the last thread out frees the pool, stuck ones included
+	while (p->threads > p->replaced)
+		pthread_cond_wait(&p->idle, &p->lock);
+	bool last = !p->threads;
+	p->abandoned = !last;
+	pthread_mutex_unlock(&p->lock);
+
+	if (last) free_pool(p);
+}
+
+int pool_threads(pool* p)
+{
+	pthread_mutex_lock(&p->lock);
+	int threads = p->threads - p->replaced;
+	pthread_mutex_unlock(&p->lock);
+	return threads;
+}
+
+bool pool_replace(pool* p, void* arg)
+{
+	bool ok = false;
+	pthread_mutex_lock(&p->lock);
+	for (int i = 0; i < p->workers.len; i++)
+	{
+		worker* w = p->workers.items[i];
+		if (w->arg != arg) continue;
+		if (w->replaced)
+			ok = true;
+		else if (p->replaced < MAX_REPLACED && spawn_worker(p))
+		{
+			w->replaced = true;
+			p->replaced++;
+			p->running--;
+			if (!p->running && p->head == p->queue.len)
+				pthread_cond_broadcast(&p->idle);
+			ok = true;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&p->lock);
+	return ok;
+}
@@ -0,0 +1,30 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdbool.h>
+
+// a fixed size set of worker threads eating a fifo of jobs.
+// a worker stuck in a job (e.g. a syscall on a dead mount) can be
+// replaced, it then exits on its own whenever the job returns.
+typedef struct pool pool;
+
+// threads <= 0 uses one per cpu. NULL, with errno set, if not a single
+// thread could be started
+pool* pool_create(int threads);
+
+void pool_submit(pool* p, void (*fn)(void* arg), void* arg);
+
+// blocks until every submitted job has finished, replaced workers excluded
+void pool_wait(pool* p);
+
+// pending jobs are still run, replaced workers are not waited for. NULL
+// is ignored
+void pool_destroy(pool* p);
+
+int pool_threads(pool* p);
+
+// start a fresh thread in place of the worker stuck in the job running
+// arg, false if that job isn't running or too many workers are stuck
+bool pool_replace(pool* p, void* arg);
+
+#endif
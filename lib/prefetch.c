@@ -0,0 +1,273 @@
+#include "prefetch.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "da.h"
+#include "pool.h"
+#include "statq.h"
+
+typedef struct
+{
+	prefetch* pf;
+	// cwd->path joined with the requested name, the cache key
+	char* path;
+	atomic_bool cancel;
+	// the rest is only touched under the prefetch lock
+	bool done;
+	bool ok;
+	// dropped while still loading, the worker frees it when done
+	bool orphaned;
+	unsigned long long finished;
+	long long finished_ms;
+	// of the directory itself, to tell whether the listing went stale
+	struct stat st;
+	directory dir;
+} job;
+
+struct prefetch
+{
+	pthread_mutex_t lock;
+	pool* pool;
+	DA(job*) jobs;
+	unsigned long long finished;
+	// one for the owner and one per job still loading
+	atomic_int refs;
+};
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// the files in it may have changed since, that doesn't show on the
+// directory itself
+static bool expired(const job* j)
+{
+	return now_ms() - j->finished_ms > PREFETCH_MAX_AGE_MS;
+}
+
+static void free_job(job* j)
+{
+	free_dir(&j->dir);
+	free(j->path);
+	free(j);
+}
+
+static void release_prefetch(prefetch* pf)
+{
+	if (atomic_fetch_sub(&pf->refs, 1) != 1) return;
+	free(pf->jobs.items);
+	pthread_mutex_destroy(&pf->lock);
+	free(pf);
+}
+
+static void remove_job(prefetch* pf, int i)
+{
+	pf->jobs.items[i] = pf->jobs.items[pf->jobs.len - 1];
+	pf->jobs.len--;
+}
+
+// called with the lock held
+static void evict(prefetch* pf)
+{
+	while (true)
+	{
+		int cached = 0;
+		int oldest = -1;
+		for (int i = 0; i < pf->jobs.len; i++)
+		{
+			job* j = pf->jobs.items[i];
+			if (!j->done) continue;
+			cached++;
+			if (oldest == -1 ||
+			    j->finished < pf->jobs.items[oldest]->finished)
+				oldest = i;
+		}
+		if (cached <= PREFETCH_CACHED) return;
+		free_job(pf->jobs.items[oldest]);
+		remove_job(pf, oldest);
+	}
+}
+
+static void run_job(void* arg)
+{
+	job* j = arg;
+	prefetch* pf = j->pf;
+	stat_background(true);
+
+	reporter rep = { NULL, NULL, NULL, false, &j->cancel };
+	bool ok = !report_stopped(&rep) &&
+		stat_timed(AT_FDCWD, j->path, &j->st, STAT_DEADLINE_MS) &&
+		load_dir(&j->dir, j->path, &rep);
+
+	pthread_mutex_lock(&pf->lock);
+	if (j->orphaned)
+		free_job(j);
+	else
+	{
+		j->done = true;
+		j->ok = ok;
+		j->finished = ++pf->finished;
+		j->finished_ms = now_ms();
+		evict(pf);
+	}
+	pthread_mutex_unlock(&pf->lock);
+	release_prefetch(pf);
+}
+
+static char* prefetch_path(const directory* cwd, const char* name)
+{
+	if (name[0] == '/') return strdup(name);
+	int len = strlen(cwd->path);
+	if (len && cwd->path[len - 1] == '/')
+		return stralloc("%s%s", cwd->path, name);
+	return stralloc("%s/%s", cwd->path, name);
+}
+
+prefetch* prefetch_create(void)
+{
+	prefetch* pf = calloc(1, sizeof(*pf));
+	if (!pf) alloc_failed();
+	pthread_mutex_init(&pf->lock, NULL);
+	pf->pool = pool_create(PREFETCH_CONCURRENT);
+	da_construct(pf->jobs, PREFETCH_CACHED + PREFETCH_CONCURRENT);
+	atomic_init(&pf->refs, 1);
+	return pf;
+}
+
+void prefetch_destroy(prefetch* pf)
+{
+	DA(job*) loading;
+	da_construct(loading, PREFETCH_CONCURRENT);
+
+	pthread_mutex_lock(&pf->lock);
+	for (int i = 0; i < pf->jobs.len; i++)
+	{
+		job* j = pf->jobs.items[i];
+		if (j->done)
+		{
+			free_job(j);
+			continue;
+		}
+		atomic_store(&j->cancel, true);
+		j->orphaned = true;
+		da_append(loading, j);
+	}
+	pf->jobs.len = 0;
+	pthread_mutex_unlock(&pf->lock);
+
+	// a load hung on a dead mount mustn't keep the caller from exiting,
+	// the pointers are only compared so it's fine if a job just finished
+	for (int i = 0; i < loading.len; i++)
+		pool_replace(pf->pool, loading.items[i]);
+	free(loading.items);
+	pool_destroy(pf->pool);
+	release_prefetch(pf);
+}
+
+void prefetch_dirs(prefetch* pf, const directory* cwd,
+		   const char* const* names, int n)
+{
+	// without threads there is nothing to prefetch on
+	if (!cwd->path || !pf->pool) return;
+	char** paths = malloc(sizeof(*paths) * (n ? n : 1));
+	if (!paths) alloc_failed();
+	for (int i = 0; i < n; i++)
+		paths[i] = prefetch_path(cwd, names[i]);
+
+	pthread_mutex_lock(&pf->lock);
+	for (int i = pf->jobs.len - 1; i >= 0; i--)
+	{
+		job* j = pf->jobs.items[i];
+		// loaded again below if it is still wanted
+		if (j->done && expired(j))
+		{
+			free_job(j);
+			remove_job(pf, i);
+			continue;
+		}
+		if (j->done) continue;
+		bool wanted = false;
+		for (int k = 0; k < n && !wanted; k++)
+			wanted = !strcmp(paths[k], j->path);
+		if (wanted) continue;
+		atomic_store(&j->cancel, true);
+		j->orphaned = true;
+		remove_job(pf, i);
+	}
+	for (int k = 0; k < n; k++)
+	{
+		bool known = false;
+		for (int i = 0; i < pf->jobs.len && !known; i++)
+			known = !strcmp(paths[k], pf->jobs.items[i]->path);
+		if (known)
+		{
+			free(paths[k]);
+			continue;
+		}
+
+		job* j = calloc(1, sizeof(*j));
+		if (!j) alloc_failed();
+		j->pf = pf;
+		j->path = paths[k];
+		atomic_init(&j->cancel, false);
+		j->dir.limit = PREFETCH_MAX_ENTRIES;
+		da_append(pf->jobs, j);
+		atomic_fetch_add(&pf->refs, 1);
+		pool_submit(pf->pool, run_job, j);
+	}
+	pthread_mutex_unlock(&pf->lock);
+	free(paths);
+}
+
+static bool same_stat(const struct stat* a, const struct stat* b)
+{
+	return a->st_dev == b->st_dev &&
+		a->st_ino == b->st_ino &&
+		a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+		a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+		a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+bool prefetch_change_dir(prefetch* pf, directory* cwd, const char* path,
+			 reporter* rep)
+{
+	if (!cwd->path) return change_dir(cwd, path, rep);
+	char* key = prefetch_path(cwd, path);
+
+	job* found = NULL;
+	pthread_mutex_lock(&pf->lock);
+	for (int i = 0; i < pf->jobs.len; i++)
+	{
+		job* j = pf->jobs.items[i];
+		if (!j->done || !j->ok || expired(j) || strcmp(j->path, key))
+			continue;
+		found = j;
+		remove_job(pf, i);
+		break;
+	}
+	pthread_mutex_unlock(&pf->lock);
+	free(key);
+
+	if (!found) return change_dir(cwd, path, rep);
+
+	// anything added, removed or renamed since shows in the mtime, other
+	// changes to the files are why it expires
+	struct stat st;
+	bool fresh = stat_timed(AT_FDCWD, found->path, &st, STAT_DEADLINE_MS) &&
+		same_stat(&st, &found->st);
+	if (fresh)
+	{
+		adopt_dir(cwd, &found->dir, rep);
+		found->dir = (directory){0};
+	}
+	free_job(found);
+	return fresh || change_dir(cwd, path, rep);
+}
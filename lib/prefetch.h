@@ -0,0 +1,38 @@
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+#include <stdbool.h>
+#include "directory.h"
+
+// listings loaded in the background before they are asked for, so going
+// into the directory under the cursor (or back up) doesn't wait on disk
+
+// larger directories aren't worth holding on to speculatively
+#define PREFETCH_MAX_ENTRIES 50000
+#define PREFETCH_CONCURRENT 2
+// finished listings kept around, the oldest one is dropped first
+#define PREFETCH_CACHED 8
+// a finished listing is only used this long, then loaded again when it
+// is still wanted. the sizes and dates in it go stale without the
+// directory's own mtime changing
+#define PREFETCH_MAX_AGE_MS 2000
+
+typedef struct prefetch prefetch;
+
+prefetch* prefetch_create(void);
+
+// cancels what is still loading, a load stuck on a dead mount is left
+// to finish on its own
+void prefetch_destroy(prefetch* pf);
+
+// the listings wanted right now, names are relative to cwd. loads of
+// anything else are cancelled, finished ones stay cached until they
+// expire
+void prefetch_dirs(prefetch* pf, const directory* cwd,
+		   const char* const* names, int n);
+
+// change_dir, using the cached listing of path if it is still current
+bool prefetch_change_dir(prefetch* pf, directory* cwd, const char* path,
+			 reporter* rep);
+
+#endif
@@ -0,0 +1,287 @@
+#include "renames.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define RENAME_PROGRESS_STEP 1024
+#define REGEX_GROUPS 10
+
+typedef struct
+{
+	const char* name;
+	int step;
+} named_step;
+
+static int compare_named(const void* a, const void* b)
+{
+	return strcmp(((const named_step*)a)->name, ((const named_step*)b)->name);
+}
+
+static bool valid_name(const char* name)
+{
+	size_t len = strlen(name);
+	return len && strcmp(name, ".") && strcmp(name, "..") &&
+		name[len - 1] != '/';
+}
+
+static bool exists(const char* path)
+{
+	struct stat st;
+	return fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+// a name nothing has, next to the entry it stands in for
+static char* temp_name(const char* from)
+{
+	const char* slash = strrchr(from, '/');
+	int dir_len = slash ? slash - from + 1 : 0;
+	for (int n = 0;; n++)
+	{
+		char* tmp = stralloc("%.*s.filed-rename.%d.%d", dir_len, from,
+				     (int)getpid(), n);
+		if (!exists(tmp)) return tmp;
+		free(tmp);
+	}
+}
+
+static void add_step(rename_plan* plan, const char* from, const char* to)
+{
+	da_append(plan->from, strdup(from));
+	da_append(plan->to, strdup(to));
+}
+
+bool plan_renames(rename_plan* plan, char* const* from, char* const* to,
+		  int n, reporter* rep)
+{
+	da_construct(plan->from, n + 1);
+	da_construct(plan->to, n + 1);
+
+	// the steps that change anything, by old and by new name
+	named_step* olds = malloc(sizeof(*olds) * (n ? n : 1));
+	named_step* news = malloc(sizeof(*news) * (n ? n : 1));
+	if (!olds || !news) alloc_failed();
+	int steps = 0;
+	bool ok = true;
+	for (int i = 0; i < n && ok; i++)
+	{
+		if (!strcmp(from[i], to[i])) continue;
+		if (!valid_name(from[i]) || !valid_name(to[i]))
+		{
+			report_error(rep, valid_name(from[i]) ? to[i] : from[i],
+				     "invalid name", EINVAL);
+			ok = false;
+		}
+		olds[steps] = (named_step){ from[i], steps };
+		news[steps] = (named_step){ to[i], steps };
+		steps++;
+	}
+	if (!ok)
+	{
+		free(olds);
+		free(news);
+		free_plan(plan);
+		return false;
+	}
+	qsort(olds, steps, sizeof(*olds), compare_named);
+	qsort(news, steps, sizeof(*news), compare_named);
+	for (int i = 1; i < steps && ok; i++)
+		if (!strcmp(news[i].name, news[i - 1].name))
+		{
+			report_error(rep, news[i].name, "more than one entry "
+				     "would be renamed to", EEXIST);
+			ok = false;
+		}
+
+	// the step that has to move out of the way first, -1 for none
+	int* blocker = malloc(sizeof(*blocker) * (steps ? steps : 1));
+	const char** old_of = malloc(sizeof(*old_of) * (steps ? steps : 1));
+	const char** new_of = malloc(sizeof(*new_of) * (steps ? steps : 1));
+	if (!blocker || !old_of || !new_of) alloc_failed();
+	for (int i = 0; i < steps; i++)
+	{
+		old_of[olds[i].step] = olds[i].name;
+		new_of[news[i].step] = news[i].name;
+	}
+	for (int i = 0; i < steps && ok; i++)
+	{
+		named_step key = { new_of[i], 0 };
+		named_step* taken = bsearch(&key, olds, steps, sizeof(*olds),
+					    compare_named);
+		blocker[i] = taken ? taken->step : -1;
+		if (!taken && exists(new_of[i]))
+		{
+			report_error(rep, new_of[i], "already exists", EEXIST);
+			ok = false;
+		}
+	}
+
+	// every step is blocked by at most one other and blocks at most one
+	// other, as new names are unique. so the steps form chains, run from
+	// their free end, and cycles, opened up with a temporary name
+	bool* done = calloc(steps ? steps : 1, sizeof(*done));
+	int* path = malloc(sizeof(*path) * (steps ? steps : 1));
+	if (!done || !path) alloc_failed();
+	for (int i = 0; i < steps && ok; i++)
+	{
+		if (done[i]) continue;
+		int len = 0;
+		int j = i;
+		do
+		{
+			path[len++] = j;
+			j = blocker[j];
+		} while (j != -1 && j != i && !done[j]);
+
+		char* tmp = NULL;
+		if (j == i)
+		{
+			tmp = temp_name(old_of[i]);
+			add_step(plan, old_of[i], tmp);
+		}
+		for (int k = len - 1; k >= 0; k--)
+		{
+			int s = path[k];
+			add_step(plan, s == i && tmp ? tmp : old_of[s], new_of[s]);
+			done[s] = true;
+		}
+		free(tmp);
+	}
+	free(done);
+	free(path);
+	free(blocker);
+	free(old_of);
+	free(new_of);
+	free(olds);
+	free(news);
+	if (!ok) free_plan(plan);
+	return ok;
+}
+
+void free_plan(rename_plan* plan)
+{
+	for (int i = 0; i < plan->from.len; i++)
+	{
+		free(plan->from.items[i]);
+		free(plan->to.items[i]);
+	}
+	free(plan->from.items);
+	free(plan->to.items);
+	*plan = (rename_plan){0};
+}
+
+static int rename_noreplace(const char* from, const char* to)
+{
+	if (renameat2(AT_FDCWD, from, AT_FDCWD, to, RENAME_NOREPLACE) == 0)
+		return 0;
+	// filesystems without the flag, the check can only be racy there
+	if (errno != EINVAL) return -1;
+	if (exists(to))
+	{
+		errno = EEXIST;
+		return -1;
+	}
+	return renameat(AT_FDCWD, from, AT_FDCWD, to);
+}
+
+bool apply_renames(const rename_plan* plan, reporter* rep)
+{
+	int n = plan->from.len;
+	for (int i = 0; i < n; i++)
+	{
+		if (rename_noreplace(plan->from.items[i], plan->to.items[i]) == 0)
+		{
+			if (i % RENAME_PROGRESS_STEP == RENAME_PROGRESS_STEP - 1)
+				report_progress(rep, plan->to.items[i], i + 1, n);
+			continue;
+		}
+		report_error(rep, plan->from.items[i], "failed to rename", errno);
+		// back to how it was, the batch goes through whole or not at all
+		for (int k = i - 1; k >= 0; k--)
+			if (rename_noreplace(plan->to.items[k],
+					     plan->from.items[k]) != 0)
+				report_error(rep, plan->to.items[k],
+					     "failed to undo rename", errno);
+		return false;
+	}
+	return true;
+}
+
+typedef DA(char) text;
+
+static void append_text(text* out, const char* s, int n)
+{
+	da_reserve(*out, n);
+	memcpy(out->items + out->len, s, n);
+	out->len += n;
+}
+
+static char* replace_all(const regex_t* re, const char* name,
+			 const char* replacement)
+{
+	text out;
+	da_construct(out, 64);
+	const char* at = name;
+	regmatch_t m[REGEX_GROUPS];
+	int flags = 0;
+	// no empty match right where the last one ended, like sed
+	bool matched = false;
+	while (*at && regexec(re, at, REGEX_GROUPS, m, flags) == 0)
+	{
+		flags = REG_NOTBOL;
+		if (matched && m[0].rm_eo == 0)
+		{
+			append_text(&out, at++, 1);
+			matched = false;
+			continue;
+		}
+		matched = m[0].rm_eo > m[0].rm_so;
+		append_text(&out, at, m[0].rm_so);
+		for (const char* r = replacement; *r; r++)
+		{
+			if (r[0] == '\\' && r[1] >= '0' && r[1] <= '9')
+			{
+				const regmatch_t* g = &m[r[1] - '0'];
+				if (g->rm_so != -1)
+					append_text(&out, at + g->rm_so,
+						    g->rm_eo - g->rm_so);
+				r++;
+			}
+			else if (r[0] == '\\' && r[1] == '\\')
+			{
+				append_text(&out, "\\", 1);
+				r++;
+			}
+			else
+				append_text(&out, r, 1);
+		}
+		// an empty match would match there again
+		int end = m[0].rm_eo;
+		if (m[0].rm_so == end && at[end]) append_text(&out, at + end++, 1);
+		at += end;
+	}
+	append_text(&out, at, strlen(at) + 1);
+	return out.items;
+}
+
+char** regex_rename(char* const* names, int n, const char* pattern,
+		    const char* replacement, reporter* rep)
+{
+	regex_t re;
+	int err = regcomp(&re, pattern, REG_EXTENDED);
+	if (err)
+	{
+		char what[256];
+		regerror(err, &re, what, sizeof(what));
+		report_error(rep, pattern, what, EINVAL);
+		return NULL;
+	}
+	char** out = malloc(sizeof(*out) * (n ? n : 1));
+	if (!out) alloc_failed();
+	for (int i = 0; i < n; i++)
+		out[i] = replace_all(&re, names[i], replacement);
+	regfree(&re);
+	return out;
+}
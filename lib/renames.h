@@ -0,0 +1,37 @@
+#ifndef RENAMES_H_
+#define RENAMES_H_
+
+#include <stdbool.h>
+#include "da.h"
+#include "report.h"
+
+// a batch of renames relative to the cwd, checked as a whole before
+// anything is touched and ordered so every step's target is free when it
+// runs. chains (a -> b, b -> c) go from their end, cycles (a -> b,
+// b -> a) through a temporary name.
+
+typedef struct
+{
+	DA(char*) from;
+	DA(char*) to;
+} rename_plan;
+
+// false, with the reason reported, if a new name is invalid, taken by
+// an entry that stays or given to two entries. renames to the same name
+// are dropped
+bool plan_renames(rename_plan* plan, char* const* from, char* const* to,
+		  int n, reporter* rep);
+
+void free_plan(rename_plan* plan);
+
+// runs the steps with renameat2(RENAME_NOREPLACE), nothing is ever
+// overwritten. a step that fails undoes the ones before it
+bool apply_renames(const rename_plan* plan, reporter* rep);
+
+// names with every match of pattern (POSIX extended) replaced, \0 to \9
+// in replacement insert the match and its groups. NULL if pattern
+// doesn't compile
+char** regex_rename(char* const* names, int n, const char* pattern,
+		    const char* replacement, reporter* rep);
+
+#endif
@@ -0,0 +1,24 @@
+#include "report.h"
+
+#include <stddef.h>
+
+void report_error(reporter* rep, const char* path, const char* what, int err)
+{
+	if (!rep || !rep->error) return;
+	if (!rep->error(rep->data, path, what, err))
+		rep->stopped = true;
+}
+
+void report_progress(reporter* rep, const char* path,
+		     long long done, long long total)
+{
+	if (!rep || !rep->progress) return;
+	if (!rep->progress(rep->data, path, done, total))
+		rep->stopped = true;
+}
+
+bool report_stopped(const reporter* rep)
+{
+	if (!rep) return false;
+	return rep->stopped || (rep->cancel && atomic_load(rep->cancel));
+}
@@ -0,0 +1,33 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// how the library talks back to its caller, every callback may be NULL.
+// failures are never fatal: the failing call returns false and, when more
+// work is queued (listing, recursive delete, marked files), the error
+// callback decides whether to carry on.
+typedef struct
+{
+	// return false to stop the remaining work
+	bool (*error)(void* data, const char* path, const char* what, int err);
+	// bytes for a single copy, entries for listings and batches.
+	// total is 0 when unknown, return false to cancel
+	bool (*progress)(void* data, const char* path,
+			 long long done, long long total);
+	void* data;
+	// set once a callback asked to stop
+	bool stopped;
+	// may be set by another thread to abandon the work, NULL if unused
+	const atomic_bool* cancel;
+} reporter;
+
+void report_error(reporter* rep, const char* path, const char* what, int err);
+
+void report_progress(reporter* rep, const char* path,
+		     long long done, long long total);
+
+bool report_stopped(const reporter* rep);
+
+#endif
@@ -0,0 +1,206 @@
+#include "statq.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include "da.h"
+#include "pool.h"
+
+// metadata calls mostly wait on the disk or the network, not the cpu
+#define STAT_THREADS 8
+#define STAT_BACKGROUND_THREADS 2
+
+struct stat_batch
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	atomic_int refs;
+	pool* pool;
+	int dirfd;
+	int n;
+	char* names[STAT_BATCH];
+	stat_result results[STAT_BATCH];
+	int done;
+	bool started;
+	bool abandoned;
+	long long call_started;
+};
+
+static pool* stat_pool;
+static pool* background_pool;
+static pthread_once_t stat_pool_once = PTHREAD_ONCE_INIT;
+static _Thread_local bool background;
+
+static void create_stat_pool(void)
+{
+	stat_pool = pool_create(STAT_THREADS);
+	background_pool = pool_create(STAT_BACKGROUND_THREADS);
+}
+
+void stat_background(bool on)
+{
+	background = on;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ll + ts.tv_nsec / 1000000;
+}
+
+static void run_batch(void* arg)
+{
+	stat_batch* b = arg;
+	for (int i = 0; i < b->n; i++)
+	{
+		pthread_mutex_lock(&b->lock);
+		b->started = true;
+		b->call_started = now_ms();
+		pthread_mutex_unlock(&b->lock);
+
+		stat_result r = {0};
+		if (fstatat(b->dirfd, b->names[i], &r.st, AT_SYMLINK_NOFOLLOW) == -1)
+		{
+			r.err = errno;
+		}
+		else if (S_ISLNK(r.st.st_mode))
+		{
+			char buf[PATH_MAX + 1];
+			ssize_t len = readlinkat(b->dirfd, b->names[i], buf, PATH_MAX);
+			if (len == -1)
+				r.err = errno;
+			else
+			{
+				buf[len] = 0;
+				r.link = strdup(buf);
+			}
+		}
+
+		pthread_mutex_lock(&b->lock);
+		b->results[i] = r;
+		b->done = i + 1;
+		pthread_cond_broadcast(&b->cond);
+		pthread_mutex_unlock(&b->lock);
+	}
+	stat_release(b);
+}
+
+stat_batch* stat_submit(int dirfd, char* const* names, int n)
+{
+	pthread_once(&stat_pool_once, create_stat_pool);
+
+	stat_batch* b = calloc(1, sizeof(*b));
+	if (!b) alloc_failed();
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&b->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&b->lock, NULL);
+
+	// the worker may outlive the caller's fd if it hangs
+	b->dirfd = dirfd == AT_FDCWD ? AT_FDCWD : fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+	b->n = n < STAT_BATCH ? n : STAT_BATCH;
+	for (int i = 0; i < b->n; i++)
+		b->names[i] = strdup(names[i]);
+
+	// one reference for the caller, one for the worker
+	atomic_init(&b->refs, 2);
+	b->pool = background ? background_pool : stat_pool;
+	// without threads the calls are made right here, with no deadline
+	if (b->pool)
+		pool_submit(b->pool, run_batch, b);
+	else
+		run_batch(b);
+	return b;
+}
+
+bool stat_wait(stat_batch* b, int i, int deadline_ms)
+{
+	long long wait_started = now_ms();
+	bool stuck = false;
+
+	pthread_mutex_lock(&b->lock);
+	while (b->done <= i && !b->abandoned)
+	{
+		long long limit = b->started
+			? b->call_started + deadline_ms
+			: wait_started + deadline_ms;
+		if (now_ms() >= limit)
+		{
+			b->abandoned = true;
+			stuck = b->started;
+			break;
+		}
+		struct timespec ts;
+		ts.tv_sec = limit / 1000;
+		ts.tv_nsec = (limit % 1000) * 1000000;
+		pthread_cond_timedwait(&b->cond, &b->lock, &ts);
+	}
+	bool ready = b->done > i;
+	pthread_mutex_unlock(&b->lock);
+
+	// keep the pool from running dry while this call hangs
+	if (stuck) pool_replace(b->pool, b);
+	return ready;
+}
+
+bool stat_ready(stat_batch* b, int i)
+{
+	pthread_mutex_lock(&b->lock);
+	bool ready = b->done > i;
+	pthread_mutex_unlock(&b->lock);
+	return ready;
+}
+
+bool stat_started(stat_batch* b)
+{
+	pthread_mutex_lock(&b->lock);
+	bool started = b->started;
+	pthread_mutex_unlock(&b->lock);
+	return started;
+}
+
+const stat_result* stat_get(stat_batch* b, int i)
+{
+	return &b->results[i];
+}
+
+void stat_retain(stat_batch* b)
+{
+	atomic_fetch_add(&b->refs, 1);
+}
+
+void stat_release(stat_batch* b)
+{
+	if (atomic_fetch_sub(&b->refs, 1) != 1) return;
+
+	for (int i = 0; i < b->n; i++)
+	{
+		free(b->names[i]);
+		if (i < b->done) free(b->results[i].link);
+	}
+	if (b->dirfd != AT_FDCWD) close(b->dirfd);
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->cond);
+	free(b);
+}
+
+bool stat_timed(int dirfd, const char* path, struct stat* st, int deadline_ms)
+{
+	char* names[] = { (char*)path };
+	stat_batch* b = stat_submit(dirfd, names, 1);
+	bool ready = stat_wait(b, 0, deadline_ms);
+	int err = ready ? b->results[0].err : ETIMEDOUT;
+	if (ready && !err) *st = b->results[0].st;
+	stat_release(b);
+
+	if (err) errno = err;
+	return !err;
+}
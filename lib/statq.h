@@ -0,0 +1,50 @@
+#ifndef STATQ_H_
+#define STATQ_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+// metadata calls can hang forever on a dead network mount, so they run on
+// a shared pool and every call gets a deadline. a call that misses it is
+// left running, its result can be picked up later with stat_ready.
+
+#define STAT_DEADLINE_MS 200
+#define STAT_BATCH 256
+
+typedef struct stat_batch stat_batch;
+
+typedef struct
+{
+	struct stat st;
+	// target of a symlink, NULL otherwise
+	char* link;
+	// errno of the failed call, 0 on success
+	int err;
+} stat_result;
+
+// lstat (and readlink) up to STAT_BATCH names relative to dirfd
+stat_batch* stat_submit(int dirfd, char* const* names, int n);
+
+// false if slot i didn't answer within the deadline, later slots of an
+// abandoned batch are not waited for. a deadline of 0 only checks
+bool stat_wait(stat_batch* b, int i, int deadline_ms);
+
+bool stat_ready(stat_batch* b, int i);
+
+// false while the batch is still queued behind other work
+bool stat_started(stat_batch* b);
+
+// only valid once slot i is ready
+const stat_result* stat_get(stat_batch* b, int i);
+
+void stat_retain(stat_batch* b);
+void stat_release(stat_batch* b);
+
+// batches submitted from the calling thread run on a few threads of their
+// own, so speculative work never delays what the user is waiting for
+void stat_background(bool on);
+
+// a single lstat with a deadline, errno is ETIMEDOUT if it hung
+bool stat_timed(int dirfd, const char* path, struct stat* st, int deadline_ms);
+
+#endif
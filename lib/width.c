@@ -0,0 +1,87 @@
+#include "width.h"
+
+#include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#define HIGH_BITS 0x8080808080808080ull
+#define LOW_BITS 0x0101010101010101ull
+
+// none of the 8 bytes is outside ASCII or a control character. adding
+// 0x60 to a byte below 0x80 sets its high bit from 0x20 on, adding 1
+// only for 0x7f (DEL), neither carries into the next byte
+static bool plain_ascii(uint64_t x)
+{
+	uint64_t ascii = x & ~HIGH_BITS;
+	uint64_t printable = ascii + LOW_BITS * 0x60;
+	uint64_t del = ascii + LOW_BITS;
+	return !((x | ~printable | del) & HIGH_BITS);
+}
+
+static bool plain_char(unsigned char c)
+{
+	return c >= 0x20 && c < 0x7f;
+}
+
+// the columns of the character at s, n is set to its bytes
+static int char_width(const char* s, mbstate_t* state, int* n)
+{
+	unsigned char c = *s;
+	*n = 1;
+	if (plain_char(c)) return 1;
+	if (c < 0x20 || c == 0x7f) return 2;
+
+	wchar_t wc;
+	size_t len = mbrtowc(&wc, s, MB_LEN_MAX, state);
+	if (len == (size_t)-1 || len == (size_t)-2)
+	{
+		memset(state, 0, sizeof(*state));
+		return 1;
+	}
+	*n = len;
+	int width = wcwidth(wc);
+	return width >= 0 ? width : 1;
+}
+
+int display_width(const char* s)
+{
+	size_t len = strlen(s);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+	{
+		uint64_t x;
+		memcpy(&x, s + i, sizeof(x));
+		if (!plain_ascii(x)) break;
+	}
+	while (i < len && plain_char(s[i]))
+		i++;
+	if (i == len) return len;
+
+	// everything before i was a column per byte
+	int width = i;
+	mbstate_t state = {0};
+	while (s[i])
+	{
+		int n;
+		width += char_width(s + i, &state, &n);
+		i += n;
+	}
+	return width;
+}
+
+int fit_width(const char* s, int cols)
+{
+	mbstate_t state = {0};
+	int width = 0;
+	int i = 0;
+	while (s[i])
+	{
+		int n;
+		width += char_width(s + i, &state, &n);
+		if (width > cols) break;
+		i += n;
+	}
+	return i;
+}
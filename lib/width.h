@@ -0,0 +1,15 @@
+#ifndef WIDTH_H_
+#define WIDTH_H_
+
+// terminal columns taken by names, going by wcwidth in the current
+// locale. names are checked 8 bytes at a time for being plain ASCII,
+// where the width is the length, only the rest is decoded. bytes that
+// aren't valid in the locale count one column each, control characters
+// two (curses shows them as ^X)
+
+int display_width(const char* s);
+
+// the bytes of the longest prefix of s that fits in cols columns
+int fit_width(const char* s, int cols);
+
+#endif
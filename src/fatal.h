@@ -0,0 +1,10 @@
+#ifndef FATAL_H_
+#define FATAL_H_
+
+#include "da.h"
+
+// the ui gives up on what it can't start without, the library never
+// exits (see alloc_failed)
+#define fatal(...) do { msg(__VA_ARGS__); exit(1); } while (0)
+
+#endif
@@ -0,0 +1,112 @@
+#include "gapbuf.h"
+
+#include "fatal.h"
+
+void gap_init(gapbuf* g, int cap)
+{
+	g->cap = cap > 0 ? cap : 16;
+	g->buf = malloc(g->cap);
+	if (!g->buf) fatal("failed to alloc");
+	g->start = 0;
+	g->end = g->cap;
+}
+
+void gap_free(gapbuf* g)
+{
+	free(g->buf);
+	g->buf = NULL;
+}
+
+int gap_len(const gapbuf* g)
+{
+	return g->cap - (g->end - g->start);
+}
+
+static void grow(gapbuf* g, int n)
+{
+	if (g->end - g->start >= n) return;
+	int after = g->cap - g->end;
+	int cap = g->cap;
+	while (cap - gap_len(g) < n)
+		cap *= 2;
+	g->buf = realloc(g->buf, cap);
+	if (!g->buf) fatal("failed to realloc: %s", strerror(errno));
+	memmove(g->buf + cap - after, g->buf + g->end, after);
+	g->end = cap - after;
+	g->cap = cap;
+}
+
+void gap_insert(gapbuf* g, const char* s, int n)
+{
+	grow(g, n);
+	memcpy(g->buf + g->start, s, n);
+	g->start += n;
+}
+
+void gap_move(gapbuf* g, int pos)
+{
+	if (pos < 0) pos = 0;
+	if (pos > gap_len(g)) pos = gap_len(g);
+	if (pos < g->start)
+	{
+		int n = g->start - pos;
+		memmove(g->buf + g->end - n, g->buf + pos, n);
+		g->start -= n;
+		g->end -= n;
+	}
+	else if (pos > g->start)
+	{
+		int n = pos - g->start;
+		memmove(g->buf + g->start, g->buf + g->end, n);
+		g->start += n;
+		g->end += n;
+	}
+}
+
+bool gap_delete_back(gapbuf* g)
+{
+	if (!g->start) return false;
+	g->start--;
+	return true;
+}
+
+bool gap_delete_forward(gapbuf* g)
+{
+	if (g->end == g->cap) return false;
+	g->end++;
+	return true;
+}
+
+void gap_kill_eol(gapbuf* g)
+{
+	g->end = g->cap;
+}
+
+void gap_clear(gapbuf* g)
+{
+	g->start = 0;
+	g->end = g->cap;
+}
+
+const char* gap_before(const gapbuf* g, int* len)
+{
+	*len = g->start;
+	return g->buf;
+}
+
+const char* gap_after(const gapbuf* g, int* len)
+{
+	*len = g->cap - g->end;
+	return g->buf + g->end;
+}
+
+char* gap_string(const gapbuf* g)
+{
+	int after = g->cap - g->end;
+	char* s = malloc(gap_len(g) + 1);
+	if (!s) fatal("failed to alloc");
+	memcpy(s, g->buf, g->start);
+	memcpy(s + g->start, g->buf + g->end, after);
+	s[g->start + after] = '\0';
+	return s;
+}
@@ -0,0 +1,43 @@
+#ifndef GAPBUF_H_
+#define GAPBUF_H_
+
+#include <stdbool.h>
+
+// the text of the minibuffer. the unused space sits at the cursor, so
+// typing and moving around only ever touch the characters in between
+typedef struct
+{
+	char* buf;
+	int cap;
+	// the gap is buf[start, end), the cursor is at start
+	int start;
+	int end;
+} gapbuf;
+
+void gap_init(gapbuf* g, int cap);
+
+void gap_free(gapbuf* g);
+
+int gap_len(const gapbuf* g);
+
+void gap_insert(gapbuf* g, const char* s, int n);
+
+// moves the cursor to pos, clamped to the text
+void gap_move(gapbuf* g, int pos);
+
+// false if there was nothing to delete
+bool gap_delete_back(gapbuf* g);
+bool gap_delete_forward(gapbuf* g);
+
+void gap_kill_eol(gapbuf* g);
+
+void gap_clear(gapbuf* g);
+
+// the text before and after the cursor, not null terminated
+const char* gap_before(const gapbuf* g, int* len);
+const char* gap_after(const gapbuf* g, int* len);
+
+__attribute__((malloc))
+char* gap_string(const gapbuf* g);
+
+#endif
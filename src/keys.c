@@ -0,0 +1,235 @@
+#include "keys.h"
+
+#include <curses.h>
+#include <sys/stat.h>
+
+#include "window.h"
+
+static key_list* recording;
+static key_list queued;
+// the next queued key
+static int replayed;
+static int dropped;
+static bool only_replay;
+
+int read_key(void)
+{
+	if (replayed < queued.len) return queued.items[replayed++];
+	if (only_replay) return control('g');
+	int c = getch();
+	if (recording && c != ERR && c != KEY_RESIZE)
+		da_append(*recording, c);
+	return c;
+}
+
+void record_keys(key_list* keys)
+{
+	if (keys) keys->len = 0;
+	recording = keys;
+}
+
+bool recording_keys(void)
+{
+	return recording;
+}
+
+void queue_keys(const int* keys, int n, int times)
+{
+	if (!queued.items) da_construct(queued, 64);
+	if (replayed == queued.len)
+	{
+		queued.len = 0;
+		replayed = 0;
+	}
+	dropped = 0;
+	for (int t = 0; t < times; t++)
+		for (int i = 0; i < n; i++)
+			da_append(queued, keys[i]);
+}
+
+int dropped_keys(void)
+{
+	return dropped;
+}
+
+bool keys_queued(void)
+{
+	return replayed < queued.len;
+}
+
+void clear_queued_keys(void)
+{
+	dropped += queued.len - replayed;
+	queued.len = 0;
+	replayed = 0;
+}
+
+void replay_only(void)
+{
+	only_replay = true;
+}
+
+bool save_keys(const key_list* keys, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (!f) return false;
+	for (int i = 0; i < keys->len; i++)
+	{
+		const char* name = keyname(keys->items[i]);
+		if (name) fprintf(f, "%s\n", name);
+	}
+	return fclose(f) == 0;
+}
+
+// the key keyname calls name, ERR if none
+static int key_named(const char* name)
+{
+	if (name[0] && !name[1]) return (unsigned char)name[0];
+	for (int c = 0; c <= KEY_MAX; c++)
+	{
+		const char* known = keyname(c);
+		if (known && !strcmp(known, name)) return c;
+	}
+	return ERR;
+}
+
+bool load_keys(key_list* keys, const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (!f) return false;
+	keys->len = 0;
+	char line[64];
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		// a line holding just a space is the space key
+		size_t len = strlen(line);
+		if (len && line[len - 1] == '\n') line[--len] = '\0';
+		if (!len) continue;
+		int c = key_named(line);
+		if (c == ERR) errno = EINVAL;
+		ok = c != ERR;
+		if (ok) da_append(*keys, c);
+	}
+	fclose(f);
+	return ok;
+}
+
+char* macro_path(void)
+{
+	const char* state = getenv("XDG_STATE_HOME");
+	char* path;
+	if (state && state[0])
+		path = stralloc("%s/filed/macro", state);
+	else
+	{
+		const char* home = getenv("HOME");
+		if (!home) return NULL;
+		path = stralloc("%s/.local/state/filed/macro", home);
+	}
+	for (char* p = path + 1; *p; p++)
+	{
+		if (*p != '/') continue;
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+	return path;
+}
+
+void add_latency(latencies* l, int key, long long ns)
+{
+	if (!l->items) da_construct(*l, 16);
+	key_latency* kl = NULL;
+	for (int i = 0; i < l->len && !kl; i++)
+		if (l->items[i].key == key) kl = &l->items[i];
+	if (!kl)
+	{
+		key_latency added = { key, {0} };
+		da_construct(added.ns, 64);
+		da_append(*l, added);
+		kl = &l->items[l->len - 1];
+	}
+	da_append(kl->ns, ns);
+}
+
+static int compare_ns(const void* a, const void* b)
+{
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+static int compare_counts(const void* a, const void* b)
+{
+	int x = ((const key_latency*)a)->ns.len;
+	int y = ((const key_latency*)b)->ns.len;
+	return (x < y) - (x > y);
+}
+
+static void print_json_string(FILE* out, const char* s)
+{
+	fputc('"', out);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\') fputc('\\', out);
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+void report_latencies(latencies* l, FILE* out, const char* version,
+		      const char* keys)
+{
+	// the keys pressed most first
+	qsort(l->items, l->len, sizeof(*l->items), compare_counts);
+	for (int i = 0; i < l->len; i++)
+	{
+		long long* ns = l->items[i].ns.items;
+		int n = l->items[i].ns.len;
+		qsort(ns, n, sizeof(*ns), compare_ns);
+		long long total = 0;
+		for (int j = 0; j < n; j++)
+			total += ns[j];
+		const char* name = keyname(l->items[i].key);
+
+		fprintf(out, "{\"version\":");
+		print_json_string(out, version);
+		fprintf(out, ",\"bench\":\"key\",\"keys\":");
+		print_json_string(out, keys);
+		fprintf(out, ",\"key\":");
+		print_json_string(out, name ? name : "?");
+		fprintf(out, ",\"count\":%d,\"min_ns\":%lld,\"median_ns\":%lld,"
+			"\"mean_ns\":%lld,\"p99_ns\":%lld,\"max_ns\":%lld,"
+			"\"histogram_us\":{",
+			n, ns[0], ns[n / 2], total / n, ns[n * 99 / 100],
+			ns[n - 1]);
+		// samples up to each power of two microseconds
+		long long bound = 1;
+		bool first = true;
+		for (int j = 0; j < n;)
+		{
+			int in = 0;
+			while (j < n && ns[j] <= bound * 1000)
+			{
+				in++;
+				j++;
+			}
+			if (in)
+				fprintf(out, "%s\"%lld\":%d", first ? "" : ",",
+					bound, in);
+			first = first && !in;
+			bound *= 2;
+		}
+		fprintf(out, "}}\n");
+	}
+	fflush(out);
+}
+
+void free_latencies(latencies* l)
+{
+	for (int i = 0; i < l->len; i++)
+		free(l->items[i].ns.items);
+	free(l->items);
+	*l = (latencies){0};
+}
@@ -0,0 +1,59 @@
+#ifndef KEYS_H_
+#define KEYS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "da.h"
+
+// every key the ui reads goes through read_key, so a keyboard macro gets
+// the keys typed into prompts as well as the commands. replaying queues
+// the keys of a macro ahead of the terminal
+
+typedef DA(int) key_list;
+
+// the next queued key, or one from the terminal while none are queued
+int read_key(void);
+
+// keys read from now on are appended to keys, NULL stops recording
+void record_keys(key_list* keys);
+bool recording_keys(void);
+
+// queues keys times times over, after what is already queued
+void queue_keys(const int* keys, int n, int times);
+bool keys_queued(void);
+// drops what is left of a replay, e.g. once a command failed
+void clear_queued_keys(void);
+// keys dropped that way since the last queue_keys
+int dropped_keys(void);
+
+// for replays without a terminal: once the queue runs dry read_key
+// returns C-g, which backs out of any prompt left open
+void replay_only(void);
+
+// macros are saved one key per line, named like curses' keyname does
+bool save_keys(const key_list* keys, const char* path);
+bool load_keys(key_list* keys, const char* path);
+
+// where the last recorded macro is kept, NULL without a home
+char* macro_path(void);
+
+// how long the keys of a replay took to handle, by key
+typedef struct
+{
+	int key;
+	DA(long long) ns;
+} key_latency;
+
+typedef DA(key_latency) latencies;
+
+void add_latency(latencies* l, int key, long long ns);
+
+// one json object per key on out: count, quantiles and a histogram of
+// power of two microsecond buckets
+void report_latencies(latencies* l, FILE* out, const char* version,
+		      const char* keys);
+
+void free_latencies(latencies* l);
+
+#endif
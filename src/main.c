@@ -1,140 +1,1365 @@
 #include "filed.h"
+#include <ctype.h>
 #include <sys/stat.h>
+#include <limits.h>
+#include <time.h>
 
-void refresh_cwd(directory* cwd)
+#include "gapbuf.h"
+
+#define PENDING_POLL_MS 100
+// how long the cursor has to stay put before its directory is prefetched
+#define PREFETCH_DELAY_MS 150
+// the most keys C-x E queues at once
+#define MACRO_MAX_KEYS (1 << 24)
+// the screen keys are replayed on with -p, the size filed-bench draws
+#define REPLAY_LINES 50
+#define REPLAY_COLS 200
+
+#ifndef FILED_VERSION
+#define FILED_VERSION "unknown"
+#endif
+
+void refresh_cwd(WINDOW* wind, directory* cwd)
 {
 	clear();
-	change_dir(cwd, ".");
+	reporter rep = window_reporter(wind);
+	change_dir(cwd, ".", &rep);
+}
+
+// moves the cursor to entry i, scrolling only if it is off screen
+static void goto_entry(directory* cwd, int i)
+{
+	int lines = listing_lines();
+	if (i < cwd->scroll || i >= cwd->scroll + lines)
+	{
+		cwd->scroll = i - lines / 2;
+		if (cwd->scroll < 0) cwd->scroll = 0;
+	}
+	cwd->current = i - cwd->scroll;
+}
+
+static void cursor_up(WINDOW* wind, directory* cwd)
+{
+	if (cwd->current + cwd->scroll <= 0)
+	{
+		info(wind, "reached top of directory");
+	}
+	else if (cwd->current <= 0)
+	{
+		cwd->scroll--;
+	}
+	else cwd->current--;
+}
+
+static void cursor_down(WINDOW* wind, directory* cwd)
+{
+	if (cwd->current + cwd->scroll + 1 >= count_entries(cwd))
+	{
+		info(wind, "reached end of directory");
+	}
+	else if (cwd->current + 1 >= listing_lines())
+	{
+		cwd->scroll++;
+	}
+	else cwd->current++;
+}
+
+// the parent is always wanted, the entry under the cursor once it rests
+static void request_prefetch(prefetch* pf, directory* cwd, bool resting)
+{
+	const char* names[2];
+	int n = 0;
+	if (!cwd->virtual && strcmp(cwd->path, "/")) names[n++] = "..";
+
+	int selected = cwd->current + cwd->scroll;
+	if (resting && !cwd->virtual && !cwd->detached &&
+	    selected < count_entries(cwd))
+	{
+		entry* e = get_entry(cwd, selected);
+		if (e->color == ECOLOR_DIR &&
+		    strcmp(e->name, ".") && strcmp(e->name, ".."))
+			names[n++] = e->name;
+	}
+	prefetch_dirs(pf, cwd, names, n);
+}
+
+static buffer_list buffers;
+// the buffer being worked in, and the one shown next to it in the split
+// layout (otherwise the one shown before it, for C-x o)
+static buffer* cur;
+static buffer* other;
+static bool split;
+static bool top_active = true;
+
+static void draw(WINDOW* wind)
+{
+	if (!split)
+	{
+		draw_screen(wind, &cur->dir);
+		return;
+	}
+	if (top_active)
+		draw_split(wind, &cur->dir, &other->dir, true);
+	else
+		draw_split(wind, &other->dir, &cur->dir, false);
+}
+
+static void trim(void)
+{
+	buffer* keep[] = { cur, other };
+	trim_buffers(&buffers, keep, split ? 2 : 1);
+}
+
+// shows b in the active pane, the buffer it replaces becomes `other`
+// unless the split layout already shows something else there
+static void switch_to(WINDOW* wind, buffer* b)
+{
+	if (b == cur) return;
+	reporter rep = window_reporter(wind);
+	if (!show_buffer(&buffers, b, &rep))
+	{
+		show_buffer(&buffers, cur, &rep);
+		return;
+	}
+	if (b == other)
+	{
+		// both panes stay where they are, the cursor moves over
+		if (split) top_active = !top_active;
+		other = cur;
+	}
+	else if (!split)
+		other = cur;
+	cur = b;
+	clear();
+	info(wind, "buffer %d/%d: %s", buffer_index(&buffers, cur) + 1,
+	     buffers.items.len, cur->dir.path);
+}
+
+static void buffer_command(WINDOW* wind, int c)
+{
+	reporter rep = window_reporter(wind);
+	int i = buffer_index(&buffers, cur);
+	int n = buffers.items.len;
+	switch (c)
+	{
+	case 'o':
+		if (!other)
+			info(wind, "no other buffer");
+		else
+			switch_to(wind, other);
+		break;
+	case KEY_RIGHT:
+		switch_to(wind, buffers.items.items[(i + 1) % n]);
+		break;
+	case KEY_LEFT:
+		switch_to(wind, buffers.items.items[(i + n - 1) % n]);
+		break;
+	case 'd':
+	{
+		char* path = nreadpath(wind, "open in new buffer");
+		if (!path) break;
+		char* expanded = expand_home(path);
+		free(path);
+		buffer* b = open_buffer(&buffers, expanded, &rep);
+		free(expanded);
+		// opening chdirs into the new buffer, switching back is cheap
+		show_buffer(&buffers, cur, &rep);
+		if (b) switch_to(wind, b);
+		break;
+	}
+	case 'k':
+	{
+		if (n == 1)
+		{
+			info(wind, "can't kill the only buffer");
+			break;
+		}
+		buffer* next = other ? other : buffers.items.items[(i + 1) % n];
+		if (!show_buffer(&buffers, next, &rep)) break;
+		close_buffer(&buffers, cur);
+		cur = next;
+		other = NULL;
+		for (int k = 0; k < buffers.items.len && !other; k++)
+			if (buffers.items.items[k] != cur)
+				other = buffers.items.items[k];
+		if (!other) split = false;
+		if (split) show_buffer(&buffers, other, &rep);
+		show_buffer(&buffers, cur, &rep);
+		set_split(split);
+		clear();
+		break;
+	}
+	case '2':
+		if (split) break;
+		if (!other)
+		{
+			other = open_buffer(&buffers, cur->dir.path, &rep);
+			if (!other) break;
+		}
+		else if (!show_buffer(&buffers, other, &rep))
+			break;
+		show_buffer(&buffers, cur, &rep);
+		split = true;
+		top_active = true;
+		set_split(true);
+		clear();
+		break;
+	case '1':
+		split = false;
+		set_split(false);
+		clear();
+		break;
+	default:
+		break;
+	}
+}
+
+// with two listings on screen, copies and moves go to the other one by
+// default
+static char* read_target(WINDOW* wind, const char* what)
+{
+	if (!split) return nreadpath(wind, "%s to", what);
+	char* dst = nreadpath(wind, "%s to (default %s)", what, other->dir.path);
+	if (dst && !dst[0])
+	{
+		free(dst);
+		dst = strdup(other->dir.path);
+	}
+	return dst;
+}
+
+static char* visited;
+
+// every directory shown counts as a visit for jumping back later
+static void record_visit(const char* path)
+{
+	if (visited && !strcmp(visited, path)) return;
+	free(visited);
+	visited = strdup(path);
+	frecency_visit(path);
+}
+
+static dupes duplicates;
+
+// lists the duplicates under the marked entries (or the whole directory)
+// with every copy but the first of each group marked
+static void find_duplicates(WINDOW* wind, directory* cwd)
+{
+	reporter rep = window_reporter(wind);
+	selected_entries se = {0};
+	const char* here = ".";
+	const char* const* roots = &here;
+	int n = 1;
+	if (count_entries(cwd))
+	{
+		se = get_selected(cwd);
+		if (se.marked)
+		{
+			roots = se.entries.items;
+			n = se.entries.len;
+		}
+	}
+	free_dupes(&duplicates);
+	bool done = find_dupes(&duplicates, roots, n, &rep);
+	free(se.entries.items);
+	if (!done) return;
+	if (!duplicates.paths.len)
+	{
+		info(wind, "no duplicates found");
+		return;
+	}
+	if (!list_paths(cwd, "duplicates", duplicates.paths.items,
+			duplicates.paths.len, &rep))
+		return;
+	for (int i = 1; i < count_entries(cwd); i++)
+		if (duplicates.group.items[i] == duplicates.group.items[i - 1])
+			mark_entry(cwd, i, true);
+	clear();
+	info(wind, "%d groups, %.1f MiB reclaimable", duplicates.groups,
+	     duplicates.wasted / (1024.0 * 1024.0));
+}
+
+// replaces the marked copies with links to the first of their group
+static void link_duplicates(WINDOW* wind, directory* cwd)
+{
+	if (!cwd->label || strcmp(cwd->label, "duplicates"))
+	{
+		info(wind, "not a duplicates listing");
+		return;
+	}
+	char how = confirm(wind, "replace marked copies with (h)ardlinks "
+			   "or (r)eflinks?");
+	if (how != 'h' && how != 'r') return;
+
+	reporter rep = window_reporter(wind);
+	int linked = 0, failed = 0;
+	for (int i = 0; i < count_entries(cwd); i++)
+	{
+		entry* e = get_entry(cwd, i);
+		if (!e->marked) continue;
+		if (link_dupe(&duplicates, e->name, how == 'r', &rep))
+			linked++;
+		else
+			failed++;
+	}
+	list_paths(cwd, "duplicates", duplicates.paths.items,
+		   duplicates.paths.len, &rep);
+	clear();
+	if (failed)
+		info(wind, "linked %d copies, %d failed", linked, failed);
+	else
+		info(wind, "linked %d copies", linked);
+}
+
+static comparison compared;
+// the directory compared, the left side
+static char* compared_in;
+
+static bool showing_comparison(directory* cwd)
+{
+	if (!compared_in || !cwd->label || strcmp(cwd->path, compared_in))
+		return false;
+	char* label = stralloc("compared with %s", compared.right);
+	bool same = !strcmp(cwd->label, label);
+	free(label);
+	return same;
+}
+
+static void list_comparison(WINDOW* wind, directory* cwd)
+{
+	reporter rep = window_reporter(wind);
+	int n = compared.paths.len;
+	char** paths = malloc(sizeof(*paths) * (n ? n : 1));
+	if (!paths) fatal("failed to alloc");
+	for (int i = 0; i < n; i++)
+		paths[i] = compare_path(&compared, i);
+	char* label = stralloc("compared with %s", compared.right);
+	bool listed = list_paths(cwd, label, paths, n, &rep);
+	free(label);
+	for (int i = 0; i < n; i++)
+		free(paths[i]);
+	free(paths);
+	if (!listed) return;
+
+	free(compared_in);
+	compared_in = strdup(cwd->path);
+	for (int i = 0; i < count_entries(cwd); i++)
+	{
+		entry* e = get_entry(cwd, i);
+		if (!e->unknown) e->color = ECOLOR_DIFF + compared.status.items[i];
+	}
+	clear();
+}
+
+// lists the cwd against another directory, colored by what differs
+static void compare_with(WINDOW* wind, directory* cwd)
+{
+	char* path = read_target(wind, "compare");
+	if (!path) return;
+	char* right = expand_home(path);
+	free(path);
+	int flags = 0;
+	if (toupper(confirm(wind, "recursive? (y/N)")) == 'Y')
+		flags |= COMPARE_RECURSIVE;
+	if (toupper(confirm(wind, "compare contents? (y/N)")) == 'Y')
+		flags |= COMPARE_CONTENTS;
+
+	reporter rep = window_reporter(wind);
+	free_comparison(&compared);
+	bool done = compare_dirs(&compared, right, flags, &rep);
+	free(right);
+	if (!done) return;
+	list_comparison(wind, cwd);
+	info(wind, "%d differences to sync", compared.differences);
+}
+
+// copies what differs over to the right side, then compares again
+static void sync_comparison(WINDOW* wind, directory* cwd)
+{
+	if (!showing_comparison(cwd))
+	{
+		info(wind, "not a comparison listing");
+		return;
+	}
+	if (!compared.differences)
+	{
+		info(wind, "nothing to sync");
+		return;
+	}
+	char input = confirm(wind, "copy %d differences to '%s'? (y/N)",
+			     compared.differences, compared.right);
+	if (toupper(input) != 'Y') return;
+
+	reporter rep = window_reporter(wind);
+	bool success = sync_right(&compared, &rep);
+	char* right = strdup(compared.right);
+	int flags = compared.flags;
+	free_comparison(&compared);
+	if (compare_dirs(&compared, right, flags, &rep))
+		list_comparison(wind, cwd);
+	free(right);
+	if (split) load_dir(&other->dir, other->dir.path, &rep);
+	if (success) info(wind, "sync successful");
+}
+
+static archive browsed;
+// the listing showing browsed, and the directory within it
+static unsigned long browsed_listing;
+static char* browsed_inner;
+
+static bool showing_archive(directory* cwd)
+{
+	return browsed.path && cwd->generation == browsed_listing;
+}
+
+// the entries of an archive listing aren't files in the cwd
+static bool read_only(WINDOW* wind, directory* cwd)
+{
+	if (!cwd->detached) return false;
+	info(wind, "archive members can only be extracted");
+	return true;
+}
+
+static void select_name(directory* cwd, const char* name)
+{
+	for (int i = 0; i < count_entries(cwd); i++)
+		if (!strcmp(entry_name(cwd, i), name))
+		{
+			goto_entry(cwd, i);
+			return;
+		}
+}
+
+// lists inner (taken over) of the browsed archive, the cursor goes on
+// select if it is given
+static void list_inner(WINDOW* wind, directory* cwd, char* inner,
+		       const char* select)
+{
+	reporter rep = window_reporter(wind);
+	if (!list_archive(cwd, &browsed, inner, &rep))
+	{
+		free(inner);
+		return;
+	}
+	free(browsed_inner);
+	browsed_inner = inner;
+	browsed_listing = cwd->generation;
+	goto_entry(cwd, count_entries(cwd) > 1 ? 1 : 0);
+	if (select) select_name(cwd, select);
+	clear();
+}
+
+// lists the members of an archive in the cwd like a directory, the index
+// is kept until the archive changes
+static void browse_archive(WINDOW* wind, directory* cwd, const char* name)
+{
+	reporter rep = window_reporter(wind);
+	if (!archive_current(&browsed, name))
+	{
+		free_archive(&browsed);
+		if (!open_archive(&browsed, name, &rep)) return;
+	}
+	list_inner(wind, cwd, strdup(""), NULL);
+}
+
+// one level up, out of the archive from its root
+static void leave_member(WINDOW* wind, directory* cwd)
+{
+	int len = strlen(browsed_inner);
+	if (!len)
+	{
+		reporter rep = window_reporter(wind);
+		char* name = strdup(strrchr(browsed.path, '/') + 1);
+		if (change_dir(cwd, ".", &rep)) select_name(cwd, name);
+		free(name);
+		clear();
+		return;
+	}
+	char* inner = strdup(browsed_inner);
+	inner[len - 1] = '\0';
+	char* slash = strrchr(inner, '/');
+	char* name = strdup(slash ? slash + 1 : inner);
+	if (slash)
+		slash[1] = '\0';
+	else
+		inner[0] = '\0';
+	list_inner(wind, cwd, inner, name);
+	free(name);
+}
+
+static void enter_member(WINDOW* wind, directory* cwd, entry* e)
+{
+	if (!strcmp(e->name, ".")) return;
+	if (!strcmp(e->name, ".."))
+		leave_member(wind, cwd);
+	else if (e->color != ECOLOR_DIR)
+		info(wind, "extract '%s' with c to open it", e->name);
+	else
+		list_inner(wind, cwd, stralloc("%s%s/", browsed_inner, e->name),
+			   NULL);
+}
+
+static void extract_selected(WINDOW* wind, directory* cwd)
+{
+	char* dst = read_target(wind, "extract");
+	if (!dst) return;
+	reporter rep = window_reporter(wind);
+	selected_entries se = get_selected(cwd);
+	bool success = extract_members(&browsed, browsed_inner,
+				       se.entries.items, se.entries.len,
+				       dst, &rep);
+	free(se.entries.items);
+	free(dst);
+	if (split) load_dir(&other->dir, other->dir.path, &rep);
+	if (success) info(wind, "extracted successfully");
+}
+
+// chmod (m), chown (o) or touch (t) the selection, and everything below
+// it if asked to. only the rows of the selection are read again
+static void change_selected(WINDOW* wind, directory* cwd, char what)
+{
+	if (read_only(wind, cwd)) return;
+	const char* command = what == 'm' ? "chmod"
+		: what == 'o' ? "chown" : "touch";
+	char* spec = nreadline(wind, "%s to", command);
+	if (!spec) return;
+
+	reporter rep = window_reporter(wind);
+	attr_change change = no_change();
+	bool parsed = what == 'm' ? parse_mode(&change, spec, &rep)
+		: what == 'o' ? parse_owner(&change, spec, &rep)
+		: parse_mtime(&change, spec, &rep);
+	free(spec);
+	if (!parsed) return;
+
+	selected_entries se = get_selected(cwd);
+	bool dirs = false;
+	for (int i = 0; i < se.entries.len && !dirs; i++)
+		dirs = is_dir(se.entries.items[i]);
+	if (dirs)
+		change.recursive = toupper(confirm(wind, "%s everything below "
+						   "the directories too? (y/N)",
+						   command)) == 'Y';
+	bool success = change_attrs(&change, se.entries.items,
+				    se.entries.len, &rep);
+	free(se.entries.items);
+	restat_selected(cwd);
+	if (split) load_dir(&other->dir, other->dir.path, &rep);
+	if (success) info(wind, "%s successful", command);
+}
+
+static grep_search* search;
+// the listing the hits of search go into
+static unsigned long search_listing;
+
+// the buffer showing the hits of search, NULL once that listing is gone
+static directory* search_dir(void)
+{
+	if (!search) return NULL;
+	for (int i = 0; i < buffers.items.len; i++)
+	{
+		directory* dir = &buffers.items.items[i]->dir;
+		if (dir->generation == search_listing) return dir;
+	}
+	return NULL;
+}
+
+// lists the files under the marked entries (or the whole directory)
+// whose contents match, filled in as they are found
+static void search_contents(WINDOW* wind, directory* cwd, int flags)
+{
+	if (read_only(wind, cwd)) return;
+	char* pattern = nreadline(wind, flags & GREP_REGEX
+				  ? "search regex" : "search");
+	if (!pattern) return;
+
+	reporter rep = window_reporter(wind);
+	selected_entries se = {0};
+	const char* here = ".";
+	const char* const* roots = &here;
+	int n = 1;
+	if (count_entries(cwd))
+	{
+		se = get_selected(cwd);
+		if (se.marked)
+		{
+			roots = se.entries.items;
+			n = se.entries.len;
+		}
+	}
+	grep_destroy(search);
+	search = grep_start(pattern, flags, roots, n, &rep);
+	free(se.entries.items);
+	char* label = stralloc("search '%s'", pattern);
+	free(pattern);
+	if (search && list_paths(cwd, label, NULL, 0, &rep))
+	{
+		search_listing = cwd->generation;
+		clear();
+		info(wind, "searching...");
+	}
+	else
+	{
+		grep_destroy(search);
+		search = NULL;
+	}
+	free(label);
+}
+
+// moves the hits found so far into their listing, true if it changed.
+// the search is stopped once nothing shows its listing anymore
+static bool poll_search(WINDOW* wind)
+{
+	directory* dir = search_dir();
+	if (!dir)
+	{
+		grep_destroy(search);
+		search = NULL;
+		return false;
+	}
+	// the paths are relative to where the search started, the hits wait
+	// while the cwd is somewhere else
+	if (strcmp(dir->path, cur->dir.path)) return false;
+
+	bool busy = grep_busy(search);
+	grep_hits hits;
+	da_construct(hits, GREP_BATCH);
+	grep_poll(search, &hits);
+	int n = hits.len;
+	if (n)
+	{
+		char** paths = malloc(sizeof(*paths) * n);
+		char** notes = malloc(sizeof(*notes) * n);
+		if (!paths || !notes) fatal("failed to alloc");
+		for (int i = 0; i < n; i++)
+		{
+			paths[i] = hits.items[i].path;
+			notes[i] = stralloc("%d: %s", hits.items[i].line,
+					    hits.items[i].text);
+		}
+		reporter rep = window_reporter(wind);
+		append_paths(dir, paths, notes, n, &rep);
+		for (int i = 0; i < n; i++)
+			free(notes[i]);
+		free(paths);
+		free(notes);
+	}
+	free_hits(&hits);
+
+	long long searched, failed;
+	grep_counts(search, &searched, &failed);
+	if (busy)
+		info(wind, "searching, %lld files so far", searched);
+	else
+	{
+		if (failed)
+			info(wind, "matches in %d of %lld files, %lld unreadable",
+			     count_entries(dir), searched, failed);
+		else
+			info(wind, "matches in %d of %lld files",
+			     count_entries(dir), searched);
+		grep_destroy(search);
+		search = NULL;
+	}
+	return n > 0;
+}
+
+static pack_job* packing;
+// the archive packed or unpacked, and the directory the job started in
+static char* packing_name;
+static char* packing_dir;
+static bool unpacking;
+
+static void stop_packing(void)
+{
+	pack_destroy(packing);
+	packing = NULL;
+	free(packing_name);
+	free(packing_dir);
+	packing_name = packing_dir = NULL;
+}
+
+// packs the marked entries (or the selected one) into a new archive, or
+// unpacks the selected archive if nothing is marked. the job runs in the
+// background, Z while it does offers to stop it
+static void pack_command(WINDOW* wind, directory* cwd, entry* e)
+{
+	const char* doing = unpacking ? "unpacking" : "packing";
+	if (packing)
+	{
+		if (toupper(confirm(wind, "stop %s '%s'? (y/N)", doing,
+				    packing_name)) != 'Y')
+			return;
+		info(wind, "stopped %s '%s'", doing, packing_name);
+		stop_packing();
+		return;
+	}
+
+	// a running job can be stopped from anywhere, a new one only
+	// started where the files can be written
+	if (!e || read_only(wind, cwd)) return;
+	reporter rep = window_reporter(wind);
+	selected_entries se = get_selected(cwd);
+	unpacking = !se.marked && e->color != ECOLOR_DIR &&
+		archive_format(e->name);
+	char* dst = unpacking ? read_target(wind, "unpack")
+		: nreadpath(wind, "pack %d into (.tar, .tar.gz or .tar.zst)",
+			    se.entries.len);
+	if (dst && dst[0])
+	{
+		packing = unpacking ? unpack_start(e->name, dst, &rep)
+			: pack_start(dst, se.entries.items, se.entries.len,
+				     &rep);
+	}
+	if (packing)
+	{
+		packing_name = strdup(unpacking ? e->name : dst);
+		packing_dir = strdup(cwd->path);
+		info(wind, "%s '%s'...", unpacking ? "unpacking" : "packing",
+		     packing_name);
+	}
+	free(se.entries.items);
+	free(dst);
+}
+
+// shows how far the job got, and how it went once it's done. true if
+// the listings changed
+static bool poll_packing(WINDOW* wind)
+{
+	const char* doing = unpacking ? "unpacking" : "packing";
+	long long done, total;
+	const char* stage = pack_stage(packing, &done, &total);
+	if (pack_busy(packing))
+	{
+		if (total)
+			info(wind, "'%s': %s %lld of %lld MiB (%lld%%)",
+			     packing_name, stage, done >> 20, total >> 20,
+			     done * 100 / total);
+		else
+			info(wind, "'%s': %s %lld MiB", packing_name, stage,
+			     done >> 20);
+		return false;
+	}
+
+	reporter rep = window_reporter(wind);
+	int failed;
+	if (pack_result(packing, NULL, &failed))
+		info(wind, "%s '%s' successful", doing, packing_name);
+	else if (failed == 1)
+		pack_result(packing, &rep, &failed);
+	else
+		info(wind, "%s '%s' finished with %d errors", doing,
+		     packing_name, failed);
+	// what it made shows up where it was started
+	directory* cwd = &cur->dir;
+	bool changed = false;
+	if (!strcmp(cwd->path, packing_dir) && !cwd->label && !cwd->detached)
+	{
+		change_dir(cwd, ".", &rep);
+		changed = true;
+	}
+	if (split && !other->dir.label && !other->dir.detached)
+	{
+		load_dir(&other->dir, other->dir.path, &rep);
+		changed = true;
+	}
+	stop_packing();
+	return changed;
+}
+
+// whether both paths are in the same directory
+static bool same_parent(const char* a, const char* b)
+{
+	const char* a_slash = strrchr(a, '/');
+	const char* b_slash = strrchr(b, '/');
+	int a_len = a_slash ? a_slash - a : -1;
+	int b_len = b_slash ? b_slash - b : -1;
+	return a_len == b_len && !strncmp(a, b, a_len > 0 ? a_len : 0);
+}
+
+// renames the entries at which to names as one batch. the listing is
+// updated in place, unless entries moved out of it
+static bool rename_batch(WINDOW* wind, directory* cwd, const int* which,
+			 char* const* names, int n)
+{
+	reporter rep = window_reporter(wind);
+	char** from = malloc(sizeof(*from) * (n ? n : 1));
+	if (!from) fatal("failed to alloc");
+	bool moved = false;
+	for (int k = 0; k < n; k++)
+	{
+		from[k] = (char*)entry_name(cwd, which[k]);
+		// a listing of paths has slashes in its names anyway
+		if (!cwd->label && !same_parent(from[k], names[k])) moved = true;
+	}
+	rename_plan plan;
+	bool success = plan_renames(&plan, from, names, n, &rep);
+	if (success)
+	{
+		success = apply_renames(&plan, &rep);
+		free_plan(&plan);
+	}
+	free(from);
+	if (!success) return false;
+	if (moved)
+		change_dir(cwd, ".", &rep);
+	else
+		rename_entries(cwd, which, names, n);
+	if (split) load_dir(&other->dir, other->dir.path, &rep);
+	return true;
+}
+
+static bool is_dots(const char* name)
+{
+	return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+// replaces a regex in the edited names of the marked entries, or of all
+// of them if none are marked
+static void replace_in_edits(WINDOW* wind, directory* cwd, char** edits)
+{
+	char* pattern = nreadline(wind, "replace regex");
+	if (!pattern) return;
+	char* replacement = nreadline(wind, "replace '%s' with", pattern);
+	if (!replacement)
+	{
+		free(pattern);
+		return;
+	}
+
+	int len = count_entries(cwd);
+	bool marked = false;
+	for (int i = 0; i < len && !marked; i++)
+		marked = entry_marked(cwd, i);
+	DA(int) which;
+	DA(char*) names;
+	da_construct(which, 64);
+	da_construct(names, 64);
+	for (int i = 0; i < len; i++)
+	{
+		if (is_dots(entry_name(cwd, i))) continue;
+		if (marked && !entry_marked(cwd, i)) continue;
+		da_append(which, i);
+		da_append(names, edits[i] ? edits[i] : (char*)entry_name(cwd, i));
+	}
+
+	reporter rep = window_reporter(wind);
+	char** out = regex_rename(names.items, names.len, pattern, replacement,
+				  &rep);
+	int changed = 0;
+	for (int k = 0; out && k < which.len; k++)
+	{
+		int i = which.items[k];
+		if (strcmp(out[k], names.items[k])) changed++;
+		free(edits[i]);
+		edits[i] = out[k];
+		if (!strcmp(out[k], entry_name(cwd, i)))
+		{
+			free(out[k]);
+			edits[i] = NULL;
+		}
+	}
+	if (out) info(wind, "replaced in %d names", changed);
+	free(out);
+	free(which.items);
+	free(names.items);
+	free(pattern);
+	free(replacement);
+}
+
+// applies the edited names, false leaves them to be fixed
+static bool apply_edits(WINDOW* wind, directory* cwd, char** edits)
+{
+	int len = count_entries(cwd);
+	DA(int) which;
+	DA(char*) names;
+	da_construct(which, 64);
+	da_construct(names, 64);
+	for (int i = 0; i < len; i++)
+	{
+		if (!edits[i]) continue;
+		da_append(which, i);
+		da_append(names, edits[i]);
+	}
+	int selected = cwd->current + cwd->scroll;
+	char* select = strdup(edits[selected] ? edits[selected]
+			      : entry_name(cwd, selected));
+	bool success = rename_batch(wind, cwd, which.items, names.items,
+				    which.len);
+	if (success)
+	{
+		select_name(cwd, select);
+		info(wind, "renamed %d entr%s", which.len,
+		     which.len == 1 ? "y" : "ies");
+	}
+	free(select);
+	free(which.items);
+	free(names.items);
+	return success;
+}
+
+#define EDIT_HINT "editing names: C-c C-c apply, C-g cancel, C-r replace regex"
+
+// the name column turns into text, every entry can be renamed in place
+// and the renames are applied together once done
+static void edit_names(WINDOW* wind, directory* cwd)
+{
+	if (read_only(wind, cwd)) return;
+	int len = count_entries(cwd);
+	if (!len)
+	{
+		info(wind, "nothing to rename");
+		return;
+	}
+	// the new names, NULL where they didn't change
+	char** edits = calloc(len, sizeof(*edits));
+	if (!edits) fatal("failed to alloc");
+	gapbuf text;
+	gap_init(&text, 64);
+	int row = -1;
+	bool hint = true;
+	bool editing = true;
+	bool applied = false;
+	while (editing)
+	{
+		int selected = cwd->current + cwd->scroll;
+		if (selected != row)
+		{
+			// the column stays where it was on the next row
+			int column = row == -1 ? INT_MAX : text.start;
+			const char* name = edits[selected]
+				? edits[selected] : entry_name(cwd, selected);
+			gap_clear(&text);
+			gap_insert(&text, name, strlen(name));
+			gap_move(&text, column);
+			row = selected;
+		}
+		set_name_edits(cwd, edits, text.start);
+		draw(wind);
+		if (hint) info(wind, EDIT_HINT);
+		hint = true;
+
+		int c = read_key();
+		move(LINES - 1, 0);
+		clrtoeol();
+		bool edit = false;
+		switch (c)
+		{
+		case KEY_RESIZE:
+			clear();
+			break;
+		case control('p'):
+		case KEY_UP:
+			cursor_up(wind, cwd);
+			hint = false;
+			break;
+		case control('n'):
+		case KEY_DOWN:
+			cursor_down(wind, cwd);
+			hint = false;
+			break;
+		case control('a'):
+			gap_move(&text, 0);
+			break;
+		case control('e'):
+			gap_move(&text, gap_len(&text));
+			break;
+		case control('f'):
+		case KEY_RIGHT:
+			gap_move(&text, text.start + 1);
+			break;
+		case control('b'):
+		case KEY_LEFT:
+			gap_move(&text, text.start - 1);
+			break;
+		case control('d'):
+		case KEY_BACKSPACE:
+		case control('k'):
+			edit = true;
+			break;
+		case control('r'):
+			replace_in_edits(wind, cwd, edits);
+			row = -1;
+			hint = false;
+			break;
+		case control('g'):
+			editing = false;
+			break;
+		case control('c'):
+		{
+			int next = read_key();
+			if (next == control('k'))
+				editing = false;
+			else if (next == control('c'))
+			{
+				applied = apply_edits(wind, cwd, edits);
+				editing = !applied;
+			}
+			if (editing) hint = false;
+			break;
+		}
+		default:
+			// keys curses decoded (arrows, function keys) aren't text
+			edit = c >= 0 && c <= 0xff && c != '\n';
+			break;
+		}
+		if (!edit) continue;
+		if (is_dots(entry_name(cwd, row)))
+		{
+			info(wind, "'%s' can't be renamed", entry_name(cwd, row));
+			hint = false;
+			continue;
+		}
+
+		if (c == control('d'))
+			gap_delete_forward(&text);
+		else if (c == KEY_BACKSPACE)
+			gap_delete_back(&text);
+		else if (c == control('k'))
+			gap_kill_eol(&text);
+		else
+		{
+			char ch = c;
+			gap_insert(&text, &ch, 1);
+		}
+		free(edits[row]);
+		edits[row] = gap_string(&text);
+		if (!strcmp(edits[row], entry_name(cwd, row)))
+		{
+			free(edits[row]);
+			edits[row] = NULL;
+		}
+	}
+	set_name_edits(NULL, NULL, 0);
+	for (int i = 0; i < len; i++)
+		free(edits[i]);
+	free(edits);
+	gap_free(&text);
+	if (!applied) info(wind, "renames cancelled");
+}
+
+// shows the directory under the cursor expanded in place, or collapses
+// it again. on any other entry of an expansion it collapses that one
+static void toggle_subtree(WINDOW* wind, directory* cwd)
+{
+	if (!count_entries(cwd)) return;
+	reporter rep = window_reporter(wind);
+	int selected = cwd->current + cwd->scroll;
+	entry* e = get_entry(cwd, selected);
+	if (e->expanded)
+		collapse_entry(cwd, selected);
+	else if (e->depth && e->perms[0] != 'd')
+	{
+		int parent = parent_entry(cwd, selected);
+		collapse_entry(cwd, parent);
+		goto_entry(cwd, parent);
+	}
+	else
+		expand_entry(cwd, selected, &rep);
+}
+
+static key_list macro;
+
+// C-x ( starts recording a macro and C-x ) ends it, C-x e replays it
+// and C-x E does so a number of times. the last one recorded is saved,
+// so it can be replayed in later sessions and with -p
+static void macro_command(WINDOW* wind, int c)
+{
+	if (!macro.items) da_construct(macro, 64);
+	if (c == '(')
+	{
+		if (recording_keys())
+		{
+			info(wind, "already defining a macro");
+			return;
+		}
+		record_keys(&macro);
+		info(wind, "defining macro...");
+		return;
+	}
+	if (c == ')')
+	{
+		if (!recording_keys())
+		{
+			info(wind, "not defining a macro");
+			return;
+		}
+		record_keys(NULL);
+		// without the C-x ) that ended it
+		macro.len = macro.len > 2 ? macro.len - 2 : 0;
+		char* path = macro_path();
+		if (path && !save_keys(&macro, path))
+			info(wind, "failed to save macro to '%s': %s", path,
+			     strerror(errno));
+		else
+			info(wind, "macro of %d keys defined", macro.len);
+		free(path);
+		return;
+	}
+
+	if (recording_keys())
+	{
+		macro.len = macro.len > 2 ? macro.len - 2 : 0;
+		info(wind, "can't run a macro while defining one");
+		return;
+	}
+	if (!macro.len)
+	{
+		char* path = macro_path();
+		if (path) load_keys(&macro, path);
+		free(path);
+	}
+	if (!macro.len)
+	{
+		info(wind, "no macro defined");
+		return;
+	}
+	int times = 1;
+	if (c == 'E')
+	{
+		char* input = nreadline(wind, "run macro how many times");
+		if (!input) return;
+		times = atoi(input);
+		free(input);
+		if (times < 1) return;
+		if (times > MACRO_MAX_KEYS / macro.len)
+		{
+			info(wind, "at most %d runs of this macro",
+			     MACRO_MAX_KEYS / macro.len);
+			return;
+		}
+	}
+	queue_keys(macro.items, macro.len, times);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
 }
 
 int main(int argc, char** argv)
 {
 	char* start_path = ".";
+	// replays these keys without a terminal, timing each one
+	const char* replay = NULL;
+	init_buffers(&buffers);
 	for (int i = 1; i < argc; i++)
 	{
-		start_path = argv[i];
+		if (!strcmp(argv[i], "-v"))
+			buffers.virtual = true;
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+			replay = argv[++i];
+		else
+			start_path = argv[i];
 	}
 
-	WINDOW* wind = init_window();
+	WINDOW* wind = replay ? init_headless_window(REPLAY_LINES, REPLAY_COLS)
+		: init_window();
+	latencies took = {0};
+	if (replay)
+	{
+		da_construct(macro, 64);
+		if (!load_keys(&macro, replay))
+			fatal("failed to load keys from '%s': %s\n", replay,
+			      strerror(errno));
+		replay_only();
+		queue_keys(macro.items, macro.len, 1);
+	}
 
-	directory cwd = {0};
-	change_dir(&cwd, start_path);
-	draw_screen(wind, cwd);
+	reporter rep = window_reporter(wind);
+	cur = open_buffer(&buffers, start_path, &rep);
+	if (!cur) cur = open_buffer(&buffers, ".", &rep);
+	if (!cur)
+		fatal("failed to open '%s': %s\n", start_path, strerror(errno));
+	directory* cwd = &cur->dir;
+	record_visit(cwd->path);
+	draw(wind);
+	prefetch* pf = prefetch_create();
+	git_status* gs = git_status_create();
+	bool git_column = false;
+	bool show_notes = true;
+	bool resting = false;
 	int c;
-	while ((c = getch()))
+	while (true)
 	{
+		cwd = &cur->dir;
+		bool pending = cwd->pending || (split && other->dir.pending) ||
+			(git_column && git_status_busy(gs)) || search || packing;
+		// while metadata is still arriving, wake up to fill it in
+		int wait = pending ? PENDING_POLL_MS : -1;
+		if (!resting && (wait == -1 || wait > PREFETCH_DELAY_MS))
+			wait = PREFETCH_DELAY_MS;
+		if (replay && !keys_queued()) break;
+		timeout(wait);
+		c = read_key();
+		timeout(-1);
+		long long started = now_ns();
+		if (c == ERR)
+		{
+			if (!resting)
+			{
+				resting = true;
+				request_prefetch(pf, cwd, true);
+			}
+			bool changed = poll_dir(cwd);
+			if (split && poll_dir(&other->dir)) changed = true;
+			if (git_status_poll(gs) && git_column) changed = true;
+			if (search && poll_search(wind)) changed = true;
+			if (packing && poll_packing(wind)) changed = true;
+			if (changed) draw(wind);
+			continue;
+		}
+		// the cursor may be moving away, don't keep loading behind it
+		if (resting) request_prefetch(pf, cwd, false);
+		resting = false;
 		move(LINES - 1, 0);
 		clrtoeol();
-		entry* e = &cwd.entries.items[cwd.current + cwd.scroll];
+		rep = window_reporter(wind);
+		int selected = cwd->current + cwd->scroll;
+		// none in an empty listing, like the hits of a search that
+		// hasn't found any yet
+		entry* e = count_entries(cwd) ? get_entry(cwd, selected) : NULL;
 		switch (c)
 		{
 		case control('p'):
 		case 'p':
-			if (cwd.current + cwd.scroll <= 0)
-			{
-				info(wind, "reached top of directory");
-			}
-			else if (cwd.current <= 0)
-			{
-				cwd.scroll--;
-			}
-			else cwd.current--;
+			cursor_up(wind, cwd);
 			break;
 		case control('n'):
 		case 'n':
-			if (cwd.current + cwd.scroll + 1 >= cwd.entries.len)
-			{
-				info(wind, "reached end of directory");
-			}
-			else if (cwd.current + 1 >= LINES - RESERVED_LINES)
-			{
-				cwd.scroll++;
-			}
-			else cwd.current++;
+			cursor_down(wind, cwd);
 			break;
 		case '\n':
-			exec_file(wind, &cwd, e->name);
+			if (!e) break;
+			if (e->unknown)
+			{
+				info(wind, "'%s' is not responding", e->name);
+				break;
+			}
+			if (showing_archive(cwd))
+				enter_member(wind, cwd, e);
+			else if (read_only(wind, cwd))
+				break;
+			else if (e->color != ECOLOR_DIR && archive_format(e->name))
+				browse_archive(wind, cwd, e->name);
+			else
+				exec_file(wind, cwd, pf, e->name);
 			break;
 		case 'd':
-			delete_entries(wind, &cwd);
-			change_dir(&cwd, ".");
+			if (read_only(wind, cwd)) break;
+			delete_entries(wind, cwd);
+			change_dir(cwd, ".", &rep);
 			break;
 		case 's':
-			cwd.soft = !cwd.soft;
-			refresh_cwd(&cwd);
+			cwd->soft = !cwd->soft;
+			refresh_cwd(wind, cwd);
 			break;
 		case 'x':
 		{
-			char* dst = nreadline(wind, "move to");
-			selected_entries se = get_selected(&cwd);
-			for (int i = 0; i < se.entries.len; i++)
-			{
-				const char* src = se.entries.items[i];
-				bool success = move_file(src, dst);
-				if (success) continue;
-				info(wind, "failed to move '%s' to '%s': %s",
-				     src, dst, strerror(errno));
-			}
+			if (read_only(wind, cwd)) break;
+			char* dst = read_target(wind, "move");
+			if (!dst) break;
+			selected_entries se = get_selected(cwd);
+			bool success = move_selected(&se, dst, &rep);
 			free(se.entries.items);
-			refresh_cwd(&cwd);
-			info(wind, "move successful");
+			free(dst);
+			if (split) load_dir(&other->dir, other->dir.path, &rep);
+			change_dir(cwd, ".", &rep);
+			if (success) info(wind, "move successful");
 			break;
 		}
 		case 'c':
 		{
-			char* dst = nreadline(wind, "copy to");
-			selected_entries se = get_selected(&cwd);
-			for (int i = 0; i < se.entries.len; i++)
+			if (showing_archive(cwd))
 			{
-				const char* src = se.entries.items[i];
-				bool success = copy_file(src, dst);
-				if (success) continue;
-				info(wind, "failed to copy '%s' to '%s': %s",
-				     src, dst, strerror(errno));
+				extract_selected(wind, cwd);
+				break;
 			}
+			if (read_only(wind, cwd)) break;
+			char* dst = read_target(wind, "copy");
+			if (!dst) break;
+			selected_entries se = get_selected(cwd);
+			bool success = copy_selected(&se, dst, &rep);
 			free(se.entries.items);
-			refresh_cwd(&cwd);
-			info(wind, "copy successful");
+			free(dst);
+			if (split) load_dir(&other->dir, other->dir.path, &rep);
+			change_dir(cwd, ".", &rep);
+			if (success) info(wind, "copy successful");
 			break;
 		}
 		case 'r':
 		{
-			char* new_name = nreadline(wind, "rename '%s' to", e->name);
-			int success = rename(e->name, new_name);
-			if (success == 0)
+			if (!e || read_only(wind, cwd)) break;
+			char* new_name = nreadpath(wind, "rename '%s' to", e->name);
+			if (!new_name) break;
+			if (rename_batch(wind, cwd, &selected, &new_name, 1))
+			{
+				select_name(cwd, new_name);
 				info(wind, "successfully renamed");
-			else
-				info(wind, "failed to rename '%s' to '%s': %s",
-				     e->name, new_name, strerror(errno));
-			refresh_cwd(&cwd);
+			}
+			free(new_name);
 			break;
 		}
+		case '\t':
+			toggle_subtree(wind, cwd);
+			break;
 		case 'g':
 		case KEY_RESIZE:
-			refresh_cwd(&cwd);
+			refresh_cwd(wind, cwd);
 			break;
 		case 'm':
-			e->marked = !e->marked;
+			if (e) mark_entry(cwd, selected, !e->marked);
+			break;
+		case 'v':
+			cwd->virtual = !cwd->virtual;
+			refresh_cwd(wind, cwd);
+			if (!cwd->virtual && cwd->virtualized)
+				info(wind, "listing too large, staying virtual");
 			break;
+		case control('s'):
+		{
+			char* needle = nreadline(wind, "search");
+			if (!needle) break;
+			int found = find_entry(cwd, needle, selected + 1);
+			if (found == -1)
+				info(wind, "no match for '%s'", needle);
+			else
+				goto_entry(cwd, found);
+			free(needle);
+			break;
+		}
 		case 'o':
 		{
-			char* path = nreadline(wind, "open");
+			char* path = nreadpath(wind, "open");
 			if (!path) break;
 			char* expanded = expand_home(path);
 			free(path);
-			if (!is_dir(expanded))
+			if (!is_dir_timed(expanded))
 			{
 				info(wind, "'%s' is not a valid path", expanded);
 				free(expanded);
 				break;
 			}
-			change_dir(&cwd, expanded);
+			change_dir(cwd, expanded, &rep);
 			free(expanded);
 			break;
 		}
 		case KEY_BACKSPACE:
-			change_dir(&cwd, "..");
+			if (showing_archive(cwd))
+				leave_member(wind, cwd);
+			else
+				prefetch_change_dir(pf, cwd, "..", &rep);
 			break;
+		case 'j':
+		{
+			char* path = nreadpick(wind, frecency_rank, "jump");
+			if (!path) break;
+			if (path[0]) change_dir(cwd, path, &rep);
+			free(path);
+			break;
+		}
 		case '~':
 		{
 			const char* home = getenv("HOME");
@@ -143,12 +1368,12 @@ int main(int argc, char** argv)
 				info(wind, "$HOME is not set");
 				break;
 			}
-			change_dir(&cwd, home);
+			change_dir(cwd, home, &rep);
 			break;
 		}
 		case '+':
 		{
-			char* path = nreadline(wind, "create path");
+			char* path = nreadpath(wind, "create path");
 			if (!path) break;
 			if (mkdir(path, 0755) != 0)
 				info(wind, "failed to create '%s': %s",
@@ -156,7 +1381,60 @@ int main(int argc, char** argv)
 			else
 				info(wind, "created directory '%s'", path);
 			free(path);
-			refresh_cwd(&cwd);
+			refresh_cwd(wind, cwd);
+			break;
+		}
+		case 'P':
+			change_selected(wind, cwd, 'm');
+			break;
+		case 'O':
+			change_selected(wind, cwd, 'o');
+			break;
+		case 'T':
+			change_selected(wind, cwd, 't');
+			break;
+		case 'D':
+			if (read_only(wind, cwd)) break;
+			find_duplicates(wind, cwd);
+			break;
+		case 'H':
+			link_duplicates(wind, cwd);
+			break;
+		case 'G':
+			git_column = !git_column;
+			set_git_column(git_column ? gs : NULL);
+			clear();
+			break;
+		case 'F':
+			search_contents(wind, cwd, 0);
+			break;
+		case 'R':
+			search_contents(wind, cwd, GREP_REGEX);
+			break;
+		case 'Z':
+			pack_command(wind, cwd, e);
+			break;
+		case 'L':
+			show_notes = !show_notes;
+			set_notes(show_notes);
+			clear();
+			break;
+		case '=':
+			compare_with(wind, cwd);
+			break;
+		case 'S':
+			sync_comparison(wind, cwd);
+			break;
+		case control('x'):
+		{
+			int next = read_key();
+			if (next == control('q'))
+				edit_names(wind, cwd);
+			else if (next == '(' || next == ')' || next == 'e' ||
+				 next == 'E')
+				macro_command(wind, next);
+			else
+				buffer_command(wind, next);
 			break;
 		}
 		case control('c'):
@@ -164,8 +1442,34 @@ int main(int argc, char** argv)
 		default:
 			break;
 		}
-		draw_screen(wind, cwd);
+		trim();
+		// a replay shouldn't skew where the user goes
+		if (!replay) record_visit(cur->dir.path);
+		draw(wind);
+		if (replay) add_latency(&took, c, now_ns() - started);
 	}
 leave:
-	change_dir(&cwd, "");
+	if (replay)
+	{
+		endwin();
+		if (dropped_keys())
+			fprintf(stderr, "replay stopped by an error, %d keys "
+				"left\n", dropped_keys());
+		report_latencies(&took, stdout, FILED_VERSION, replay);
+		free_latencies(&took);
+	}
+	free(macro.items);
+	grep_destroy(search);
+	// a half written archive is removed
+	stop_packing();
+	free_dupes(&duplicates);
+	free_comparison(&compared);
+	free(compared_in);
+	free_archive(&browsed);
+	free(browsed_inner);
+	free(visited);
+	frecency_close();
+	git_status_destroy(gs);
+	prefetch_destroy(pf);
+	free_buffers(&buffers);
 }
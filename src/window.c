@@ -4,6 +4,13 @@
 #include <termios.h>
 #include <locale.h>
 
+#include "fatal.h"
+#include "gapbuf.h"
+#include "width.h"
+#include "complete.h"
+#include "compare.h"
+#include "keys.h"
+
 static void _info(WINDOW* wind, const char* fmt, va_list args)
 {
 	int y, x;
@@ -38,161 +45,346 @@ char confirm(WINDOW* wind, const char* fmt, ...)
 	_info(wind, fmt, args);
 	va_end(args);
 
-	char c = getch();
+	char c = read_key();
 	move(LINES -1, 0);
 	clrtoeol();
 	move(y, x);
 	return c;
 }
 
-typedef DA(char) sv;
+// progress would otherwise overwrite the error the user needs to see
+static bool error_shown;
 
-__attribute__((format(printf, 2, 3)))
-__attribute__((malloc))
-char* nreadline(WINDOW* wind, const char* fmt, ...)
+static bool window_error(void* data, const char* path, const char* what,
+			 int err)
+{
+	info(data, "%s '%s': %s", what, path, strerror(err));
+	error_shown = true;
+	// like in emacs, a failing command ends the macro that ran it
+	clear_queued_keys();
+	return true;
+}
+
+static bool window_progress(void* data, const char* path,
+			    long long done, long long total)
+{
+	if (error_shown) return true;
+	if (total)
+		info(data, "%s (%lld/%lld)", path, done, total);
+	else
+		info(data, "%s (%lld)", path, done);
+	return true;
+}
+
+reporter window_reporter(WINDOW* wind)
+{
+	error_shown = false;
+	return (reporter){ window_error, window_progress, wind, false, NULL };
+}
+
+// what TAB found, shown after the input until the next key
+static void show_matches(const completion* c)
+{
+	if (c->matches == 1) return;
+	attron(COLOR_PAIR(ECOLOR_MSG));
+	if (!c->matches)
+		printw(" [no match]");
+	else
+	{
+		printw(" {");
+		for (int i = 0; i < c->n_shown; i++)
+			printw(i ? " | %s" : "%s", c->shown[i]);
+		if (c->matches > c->n_shown)
+			printw(" | +%d", c->matches - c->n_shown);
+		printw("}");
+	}
+	attroff(COLOR_PAIR(ECOLOR_MSG));
+}
+
+// the candidates for what has been typed so far, the selected one
+// highlighted
+static void show_picks(const char* const* picks, int n, int selected)
+{
+	attron(COLOR_PAIR(ECOLOR_MSG));
+	printw(n ? " {" : " [no match]");
+	for (int i = 0; i < n; i++)
+	{
+		if (i) printw(" | ");
+		if (i == selected) attron(A_REVERSE);
+		printw("%s", picks[i]);
+		if (i == selected) attroff(A_REVERSE);
+	}
+	if (n) printw("}");
+	attroff(COLOR_PAIR(ECOLOR_MSG));
+}
+
+static char* read_input(WINDOW* wind, const char* prompt, bool paths,
+			picker pick)
 {
 	int y, x;
 	getyx(wind, y, x);
 
-	sv before;
-	sv after;
-	da_construct(before, 15);
-	da_construct(after, 15);
-	da_append(before, '\0');
-	da_append(after, '\0');
-
-	va_list args;
-	va_start(args, fmt);
+	gapbuf text;
+	gap_init(&text, 64);
+	completion c = {0};
+	const char* picks[PICKS_SHOWN];
+	int n_picks = 0;
+	int selected = 0;
+	bool changed = true;
 
 	while (true)
 	{
 		attron(COLOR_PAIR(ECOLOR_MSG));
-		move(LINES - 1, 0);
-		vw_printw(wind, fmt, args);
-		printw(" » ");
+		mvprintw(LINES - 1, 0, "%s » ", prompt);
 		attroff(COLOR_PAIR(ECOLOR_MSG));
 
-		printw("%s", before.items);
+		int len;
+		const char* part = gap_before(&text, &len);
+		printw("%.*s", len, part);
 
 		int input_y, input_x;
 		getyx(wind, input_y, input_x);
 
-		printw("%s", after.items);
+		part = gap_after(&text, &len);
+		printw("%.*s", len, part);
+		if (c.text) show_matches(&c);
+		free_completion(&c);
+		if (pick && changed)
+		{
+			char* input = gap_string(&text);
+			n_picks = pick(input, picks, PICKS_SHOWN);
+			free(input);
+			selected = 0;
+		}
+		if (pick) show_picks(picks, n_picks, selected);
+		changed = true;
 
 		clrtoeol();
 		move(input_y, input_x);
 
-		int c = getch();
-		switch (c)
+		int key = read_key();
+		switch (key)
 		{
 		case KEY_RESIZE: break;
 		case KEY_BACKSPACE:
-			if (before.len <= 1) break;
-			before.len--;
-			before.items[before.len - 1] = '\0';
+			gap_delete_back(&text);
 			break;
 		case control('a'):
-		{
-			before.len--;
-			for (int i = 0; i < after.len; i++)
-			{
-				da_append(before, after.items[i]);
-			}
-			sv temp = before;
-			before = after;
-			after = temp;
-			before.len = 1;
-			before.items[0] = '\0';
+			gap_move(&text, 0);
 			break;
-		}
 		case control('e'):
-		{
-			before.len--;
-			for (int i = 0; i < after.len; i++)
-			{
-				da_append(before, after.items[i]);
-}
-			after.len = 1;
-			after.items[0] = '\0';
+			gap_move(&text, gap_len(&text));
 			break;
-		}
 		case control('f'):
-		{
-			if (after.len <= 1) break;
-			char next = after.items[0];
-			before.items[before.len - 1] = next;
-			da_append(before, '\0');
-			for (int i = 1; i < after.len; i++)
-			{
-				after.items[i - 1] = after.items[i];
-			}
-			after.len--;
+			gap_move(&text, text.start + 1);
 			break;
-		}
 		case control('b'):
-		{
-			if (before.len <= 1) break;
-			char prev = before.items[before.len - 2];
-			for (int i = after.len - 1; i > 0; i--)
-			{
-				after.items[i] = after.items[i - 1];
-			}
-			after.items[0] = prev;
-			da_append(after, '\0');
-			before.items[before.len - 2] = '\0';
-			before.len--;
+			gap_move(&text, text.start - 1);
 			break;
-		}
 		case control('d'):
-			if (after.len <= 1) break;
-			for (int i = 1; i < after.len; i++)
-			{
-				after.items[i - 1] = after.items[i];
-			}
-			after.len--;
+			gap_delete_forward(&text);
 			break;
 		case control('k'):
-			after.len = 1;
-			after.items[0] = '\0';
+			gap_kill_eol(&text);
 			break;
+		case '\t':
+		{
+			changed = false;
+			if (pick && n_picks)
+				selected = (selected + 1) % n_picks;
+			if (!paths) break;
+			// completes what is before the cursor, the rest stays
+			gap_before(&text, &len);
+			char* input = gap_string(&text);
+			input[len] = '\0';
+			c = complete_path(input);
+			free(input);
+			while (gap_delete_back(&text))
+				;
+			gap_insert(&text, c.text, strlen(c.text));
+			break;
+		}
 		case control('g'):
 		case control('c'):
-			free(before.items);
-			free(after.items);
+			gap_free(&text);
 			move(y, x);
 			return NULL;
 		case '\n':
-			before.len--;
-			for (int i = 0; i < after.len; i++)
-			{
-				da_append(before, after.items[i]);
-			}
-			free(after.items);
+		{
+			char* line = pick && n_picks
+				? strdup(picks[selected]) : gap_string(&text);
+			gap_free(&text);
 			move(y, x);
-			return before.items;
+			return line;
+		}
 		default:
-			before.items[before.len - 1] = c;
-			da_append(before, '\0');
+			// keys curses decoded (arrows, function keys) aren't text
+			if (key < 0 || key > 0xff) break;
+			char ch = key;
+			gap_insert(&text, &ch, 1);
 			break;
 		}
 	}
 }
 
+char* nreadline(WINDOW* wind, const char* fmt, ...)
+{
+	char prompt[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(prompt, sizeof(prompt), fmt, args);
+	va_end(args);
+	return read_input(wind, prompt, false, NULL);
+}
+
+char* nreadpath(WINDOW* wind, const char* fmt, ...)
+{
+	char prompt[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(prompt, sizeof(prompt), fmt, args);
+	va_end(args);
+	return read_input(wind, prompt, true, NULL);
+}
+
+char* nreadpick(WINDOW* wind, picker pick, const char* fmt, ...)
+{
+	char prompt[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(prompt, sizeof(prompt), fmt, args);
+	va_end(args);
+	return read_input(wind, prompt, false, pick);
+}
+
 #define LONGEST_MARK sizeof("-")
 #define LONGEST_PERMS sizeof("drwxrwxrwx")
 #define LONGEST_FILESIZE 4
 
-void draw_screen(WINDOW* wind, directory cwd)
+static bool split;
+
+void set_split(bool on)
+{
+	split = on;
+}
+
+static git_status* git_column;
+
+void set_git_column(git_status* gs)
+{
+	git_column = gs;
+}
+
+static const directory* edited;
+static char* const* edits;
+static int edit_cursor;
+
+void set_name_edits(const directory* dir, char* const* names, int cursor)
 {
-	attron(COLOR_PAIR(ECOLOR_HEAD));
-	mvprintw(0, 0, "%s:", cwd.path);
-	if (cwd.soft)
+	edited = dir;
+	edits = names;
+	edit_cursor = cursor;
+}
+
+// the two letters of git's short format, staged in green and the rest
+// in red like git status colors them
+static void draw_git_state(const char* state)
+{
+	if (!state)
+	{
+		printw("   ");
+		return;
+	}
+	if (state[0] == '!')
+	{
+		attron(A_DIM);
+		printw("!! ");
+		attroff(A_DIM);
+		return;
+	}
+	bool untracked = state[0] == '?';
+	attron(COLOR_PAIR(untracked ? ECOLOR_UNSTAGED : ECOLOR_STAGED));
+	printw("%c", state[0]);
+	attroff(COLOR_PAIR(untracked ? ECOLOR_UNSTAGED : ECOLOR_STAGED));
+	attron(COLOR_PAIR(ECOLOR_UNSTAGED));
+	printw("%c ", state[1]);
+	attroff(COLOR_PAIR(ECOLOR_UNSTAGED));
+}
+
+static bool notes = true;
+
+void set_notes(bool on)
+{
+	notes = on;
+}
+
+// dimmed after the name, as much as fits in cols
+static void draw_note(const char* note, int cols)
+{
+	cols -= 2;
+	if (cols <= 0) return;
+	attron(A_DIM);
+	printw("  %.*s", fit_width(note, cols), note);
+	attroff(A_DIM);
+}
+
+// the name and link of e cut down to cols columns, the last one marking
+// the cut instead of letting the line wrap
+static void draw_truncated(const entry* e, int cols)
+{
+	if (cols <= 0) return;
+	cols--;
+	const char* shown = shown_name(e);
+	int name = fit_width(shown, cols);
+	attron(COLOR_PAIR(e->color));
+	printw("%.*s", name, shown);
+	attroff(COLOR_PAIR(e->color));
+	cols -= display_width(shown);
+	if (!shown[name] && e->link && cols > 0)
+	{
+		char* link = stralloc(" -> %s", e->link);
+		printw("%.*s", fit_width(link, cols), link);
+		free(link);
+	}
+	attron(A_REVERSE);
+	printw(">");
+	attroff(A_REVERSE);
+}
+
+int listing_lines(void)
+{
+	if (!split) return LINES - RESERVED_LINES;
+	// two headers share the echo area
+	int lines = (LINES - RESERVED_LINES - 1) / 2;
+	return lines > 1 ? lines : 1;
+}
+
+// header at row top, then `lines` rows of entries
+static void draw_listing(WINDOW* wind, directory* cwd, int top, int lines,
+			 bool active)
+{
+	// the layout may have shrunk since the cursor was placed
+	if (cwd->current >= lines)
+	{
+		cwd->scroll += cwd->current - lines + 1;
+		cwd->current = lines - 1;
+	}
+	// loads the metadata of a virtual listing, widths depend on it
+	view_entries(cwd, cwd->scroll, lines);
+
+	int head = active ? COLOR_PAIR(ECOLOR_HEAD) : A_DIM;
+	attron(head);
+	mvprintw(top, 0, "%s:", cwd->path);
+	if (cwd->label) printw(" %s", cwd->label);
+	if (cwd->soft || cwd->virtualized)
 	{
 		printw(" (");
-		if (cwd.soft) printw("soft");
+		if (cwd->soft) printw("soft");
+		if (cwd->soft && cwd->virtualized) printw(" ");
+		if (cwd->virtualized) printw("virtual");
 		printw(")");
 	}
-	attroff(COLOR_PAIR(ECOLOR_HEAD));
+	attroff(head);
 
 	clrtoeol();
 	printw("\n");
@@ -200,39 +392,42 @@ void draw_screen(WINDOW* wind, directory cwd)
 	int len_all =
 		LONGEST_MARK + 1 +
 		LONGEST_PERMS + 1 +
-		cwd.longest_links + 1 +
-		cwd.longest_owner + 1 +
-		cwd.longest_group + 1 +
+		cwd->longest_links + 1 +
+		cwd->longest_owner + 1 +
+		cwd->longest_group + 1 +
 		LONGEST_FILESIZE + 1 +
-		cwd.longest_date + 1 +
-		cwd.longest_name;
+		cwd->longest_date + 1 +
+		cwd->longest_name;
 
 	// in soft mode remove entries in order of least significance
 	int len_rm_links = len_all;
-	int len_rm_group = len_rm_links - cwd.longest_links - 1;
-	int len_rm_owner = len_rm_group - cwd.longest_group - 1;
-	int len_rm_perms = len_rm_owner - cwd.longest_owner - 1;
+	int len_rm_group = len_rm_links - cwd->longest_links - 1;
+	int len_rm_owner = len_rm_group - cwd->longest_group - 1;
+	int len_rm_perms = len_rm_owner - cwd->longest_owner - 1;
 	int len_rm_fsize = len_rm_perms - LONGEST_PERMS - 1;
 	int len_rm_date = len_rm_fsize - LONGEST_FILESIZE - 1;
 
-	int screen_space = COLS;
+	const git_listing* gl = git_column ? git_listing_of(git_column, cwd) : NULL;
+	int screen_space = git_column ? COLS - 3 : COLS;
 
-	bool draw_links = (len_rm_links <= screen_space) || !cwd.soft;
-	bool draw_group = (len_rm_group <= screen_space) || !cwd.soft;
-	bool draw_perms = (len_rm_perms <= screen_space) || !cwd.soft;
-	bool draw_owner = (len_rm_owner <= screen_space) || !cwd.soft;
-	bool draw_fsize = (len_rm_fsize <= screen_space) || !cwd.soft;
-	bool draw_date = (len_rm_date <= screen_space) || !cwd.soft;
+	bool draw_links = (len_rm_links <= screen_space) || !cwd->soft;
+	bool draw_group = (len_rm_group <= screen_space) || !cwd->soft;
+	bool draw_perms = (len_rm_perms <= screen_space) || !cwd->soft;
+	bool draw_owner = (len_rm_owner <= screen_space) || !cwd->soft;
+	bool draw_fsize = (len_rm_fsize <= screen_space) || !cwd->soft;
+	bool draw_date = (len_rm_date <= screen_space) || !cwd->soft;
 
-	for (int i = 0; i < LINES - RESERVED_LINES; i++)
+	int len = count_entries(cwd);
+	for (int i = 0; i < lines; i++)
 	{
+		move(top + 1 + i, 0);
 		clrtoeol();
-		if (i + cwd.scroll >= cwd.entries.len)
+		if (i + cwd->scroll >= len)
 		{
 			printw("\n");
 			continue;
 		}
-		entry e = cwd.entries.items[i + cwd.scroll];
+		entry e = *get_entry(cwd, i + cwd->scroll);
 
 		attron(COLOR_PAIR(ECOLOR_MARKED));
 		if (e.marked)
@@ -242,12 +437,26 @@ void draw_screen(WINDOW* wind, directory cwd)
 		attroff(COLOR_PAIR(ECOLOR_MARKED));
 
 		if (draw_perms) printw("%s ", e.perms);
-		if (draw_links) printw("%*d ", cwd.longest_links, e.n_links);
-		if (draw_owner) printw("%s ", e.owner);
-		if (draw_group) printw("%s ", e.group);
+		if (draw_links)
+		{
+			if (e.unknown)
+				printw("%*s ", cwd->longest_links, "?");
+			else
+				printw("%*d ", cwd->longest_links, e.n_links);
+		}
+		if (draw_owner)
+			printw("%s%*s ", e.owner,
+			       cwd->longest_owner - display_width(e.owner), "");
+		if (draw_group)
+			printw("%s%*s ", e.group,
+			       cwd->longest_group - display_width(e.group), "");
 		if (draw_fsize)
 		{
-			if (e.sz_unit == 'B')
+			if (e.unknown)
+			{
+				printw("%4s ", "?");
+			}
+			else if (e.sz_unit == 'B')
 			{
 				printw("%4d ", (int)e.sz_amount);
 			}
@@ -260,20 +469,82 @@ void draw_screen(WINDOW* wind, directory cwd)
 				printw("%c ", e.sz_unit);
 			}
 		}
-		if (draw_date) printw("%s ", e.date);
-		if (i == cwd.current)
-			getyx(wind, cwd.y, cwd.x);
+		if (draw_date)
+			printw("%s%*s ", e.date,
+			       cwd->longest_date - display_width(e.date), "");
+		if (git_column)
+		{
+			// expanded entries are in the listing of their directory,
+			// asked for each row as asking may make room for it
+			const git_listing* below = gl
+				? git_listing_below(git_column, cwd, e.name) : NULL;
+			draw_git_state(below ? git_state(below, shown_name(&e))
+				       : NULL);
+		}
+		int x = getcurx(wind);
+		// names being edited are whole paths, so they aren't indented
+		int indent = edited == cwd ? 0 : SUBTREE_INDENT * e.depth;
+		if (indent > COLS - x - 1) indent = COLS - x - 1;
+		if (indent > 0) printw("%*s", indent, "");
+		if (i == cwd->current)
+			getyx(wind, cwd->y, cwd->x);
+
+		if (edited == cwd)
+		{
+			// names being edited stand out once they differ
+			const char* name = edits[i + cwd->scroll];
+			if (!name) name = e.name;
+			int color = name == e.name ? e.color : ECOLOR_MSG;
+			attron(COLOR_PAIR(color));
+			if (i == cwd->current)
+			{
+				printw("%.*s", edit_cursor, name);
+				getyx(wind, cwd->y, cwd->x);
+				name += edit_cursor;
+			}
+			printw("%s\n", name);
+			attroff(COLOR_PAIR(color));
+			continue;
+		}
 
-		attron(COLOR_PAIR(e.color));
-		printw("%s", e.name);
-		attroff(COLOR_PAIR(e.color));
-		if (e.link)
-			printw(" -> %s", e.link);
+		if ((int)e.width <= COLS - x)
+		{
+			attron(COLOR_PAIR(e.color));
+			printw("%s", shown_name(&e));
+			attroff(COLOR_PAIR(e.color));
+			if (e.link)
+				printw(" -> %s", e.link);
+			if (e.note && notes) draw_note(e.note, COLS - getcurx(wind));
+		}
+		else
+			draw_truncated(&e, COLS - getcurx(wind));
 
 		printw("\n");
 	}
+}
+
+void draw_screen(WINDOW* wind, directory* cwd)
+{
+	draw_listing(wind, cwd, 0, LINES - RESERVED_LINES, true);
+	refresh();
+	move(cwd->y, cwd->x);
+}
+
+void draw_split(WINDOW* wind, directory* top, directory* bottom,
+		bool top_active)
+{
+	int lines = listing_lines();
+	draw_listing(wind, top, 0, lines, top_active);
+	draw_listing(wind, bottom, lines + 1, lines, !top_active);
+	// the row left over by an odd height
+	for (int y = 2 * lines + 2; y < LINES - 1; y++)
+	{
+		move(y, 0);
+		clrtoeol();
+	}
 	refresh();
-	move(cwd.y, cwd.x);
+	directory* active = top_active ? top : bottom;
+	move(active->y, active->x);
 }
 
 static struct termios original_termios;
@@ -297,26 +568,42 @@ void close_window(void)
 	close(log_fd);
 }
 
-WINDOW* init_window(void)
+static void init_colors(void)
 {
-	setlocale(LC_ALL, "");
-
-	WINDOW* wind = initscr();
 	start_color();
 	use_default_colors();
-	raw();
-	cbreak();
-	keypad(stdscr, TRUE);
-	noecho();
 
 	init_pair(ECOLOR_FILE, COLOR_WHITE, -1);
 	init_pair(ECOLOR_DIR, COLOR_BLUE, -1);
 	init_pair(ECOLOR_LNK, COLOR_CYAN, -1);
 	init_pair(ECOLOR_EXE, COLOR_GREEN, -1);
+	init_pair(ECOLOR_UNKNOWN, COLOR_RED, -1);
+
+	init_pair(ECOLOR_DIFF + DIFF_SAME, COLOR_WHITE, -1);
+	init_pair(ECOLOR_DIFF + DIFF_LEFT_ONLY, COLOR_GREEN, -1);
+	init_pair(ECOLOR_DIFF + DIFF_RIGHT_ONLY, COLOR_MAGENTA, -1);
+	init_pair(ECOLOR_DIFF + DIFF_LEFT_NEWER, COLOR_YELLOW, -1);
+	init_pair(ECOLOR_DIFF + DIFF_RIGHT_NEWER, COLOR_CYAN, -1);
+	init_pair(ECOLOR_DIFF + DIFF_CHANGED, COLOR_RED, -1);
 
 	init_pair(ECOLOR_MSG, COLOR_YELLOW, -1);
 	init_pair(ECOLOR_HEAD, COLOR_YELLOW, -1);
 	init_pair(ECOLOR_MARKED, COLOR_YELLOW, -1);
+	init_pair(ECOLOR_STAGED, COLOR_GREEN, -1);
+	init_pair(ECOLOR_UNSTAGED, COLOR_RED, -1);
+}
+
+WINDOW* init_window(void)
+{
+	setlocale(LC_ALL, "");
+
+	WINDOW* wind = initscr();
+	raw();
+	cbreak();
+	keypad(stdscr, TRUE);
+	noecho();
+
+	init_colors();
 
 	static bool first_init = true;
 	if (first_init)
@@ -343,6 +630,28 @@ WINDOW* init_window(void)
 	return wind;
 }
 
+// a screen that renders into /dev/null, used to run without a tty
+WINDOW* init_headless_window(int lines, int cols)
+{
+	setlocale(LC_ALL, "");
+
+	FILE* out = fopen("/dev/null", "w");
+	FILE* in = fopen("/dev/null", "r");
+	if (!out || !in)
+		fatal("failed to open /dev/null: %s", strerror(errno));
+
+	SCREEN* screen = newterm("xterm-256color", out, in);
+	if (!screen)
+		fatal("failed to create headless screen");
+	set_term(screen);
+	resizeterm(lines, cols);
+	noecho();
+
+	init_colors();
+
+	return stdscr;
+}
+
 __attribute__((weak))
 void __asan_on_error(void)
 {
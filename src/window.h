@@ -4,6 +4,13 @@
 #include <curses.h>
 
 #include "directory.h"
+#include "gitstatus.h"
+
+#define ECOLOR_MSG 5
+#define ECOLOR_HEAD 6
+#define ECOLOR_MARKED 7
+#define ECOLOR_STAGED 15
+#define ECOLOR_UNSTAGED 16
 
 #define RESERVED_LINES 2
 
@@ -13,16 +20,57 @@ void info(WINDOW* wind, const char* fmt, ...);
 
 char confirm(WINDOW* wind, const char* fmt, ...);
 
+// shows library errors and progress in the echo area
+reporter window_reporter(WINDOW* wind);
+
 __attribute__((format(printf, 2, 3)))
 __attribute__((malloc))
 char* nreadline(WINDOW* wind, const char* fmt, ...);
 
-void draw_screen(WINDOW* wind, directory cwd);
+// fills out with up to max candidates for input, best first
+typedef int (*picker)(const char* input, const char** out, int max);
+
+#define PICKS_SHOWN 5
+
+// nreadline showing the candidates of pick as you type, TAB selects the
+// next one and enter returns the selected one
+__attribute__((format(printf, 3, 4)))
+__attribute__((malloc))
+char* nreadpick(WINDOW* wind, picker pick, const char* fmt, ...);
+
+// nreadline with TAB completing paths
+__attribute__((format(printf, 2, 3)))
+__attribute__((malloc))
+char* nreadpath(WINDOW* wind, const char* fmt, ...);
+
+// rows of entries one listing gets in the current layout
+int listing_lines(void);
+
+// two listings stacked on top of each other instead of one
+void set_split(bool on);
+
+// the notes of entries (like what a search matched) after their names
+void set_notes(bool on);
+
+// a column with the git state of each entry from gs, NULL hides it
+void set_git_column(git_status* gs);
+
+// the listing of dir shows names (NULL for the ones unchanged) in place
+// of its own, with the cursor at byte `cursor` of the current one. a NULL
+// dir goes back to the plain listing
+void set_name_edits(const directory* dir, char* const* names, int cursor);
+
+void draw_screen(WINDOW* wind, directory* cwd);
+
+void draw_split(WINDOW* wind, directory* top, directory* bottom,
+		bool top_active);
 
 void close_window(void);
 
 WINDOW* init_window(void);
 
+WINDOW* init_headless_window(int lines, int cols);
+
 
 
 #endif